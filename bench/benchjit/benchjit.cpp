@@ -0,0 +1,198 @@
+#include <memory>
+#include <sstream>
+#include <string>
+#include "benchmark/benchmark.h"
+
+#include "libkaleidoscope_jit/session.h"
+#include "libkaleidoscope_parser/static_parser.h"
+
+
+namespace
+{
+
+
+typedef double (*UnaryFunction)(double);
+typedef double (*BinaryFunction)(double, double);
+typedef double (*QuaternaryFunction)(double, double, double, double);
+
+
+// Session shared by every benchmark thread, set up once by the first thread.
+static std::unique_ptr<JITSession> session;
+
+
+static void set_up_session(const std::string &source)
+{
+    session = JITSession::Create();
+    std::istringstream stream(source);
+    session->Run(stream);
+}
+
+
+// Calls through the published stub of a function from many threads at once.
+static void BM_ConcurrentCalls(benchmark::State &state)
+{
+    if (state.thread_index() == 0)
+        set_up_session("def f(x) x*2+1");
+    UnaryFunction f = nullptr;
+
+    double sum = 0;
+    for (auto _ : state)
+    {
+        if (!f)
+            f = reinterpret_cast<UnaryFunction>(session->GetFunctionAddress("f"));
+        sum += f(sum);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConcurrentCalls)->ThreadRange(1, 8)->UseRealTime();
+
+
+// Looks up a published function by name from many threads at once, while
+// the session holds a few hundred other functions.
+static void BM_ConcurrentLookups(benchmark::State &state)
+{
+    if (state.thread_index() == 0)
+    {
+        std::string source;
+        for (int i = 0; i < 256; i++)
+            source += "def f" + std::to_string(i) + "(x) x+" + std::to_string(i) + "\n";
+        set_up_session(source);
+    }
+
+    for (auto _ : state)
+        benchmark::DoNotOptimize(session->GetFunctionAddress("f128"));
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConcurrentLookups)->ThreadRange(1, 8)->UseRealTime();
+
+
+// Calls a function from many threads while it is redefined in the
+// background, to measure the cost of the swaps to the callers.
+static void BM_CallsDuringRedefinition(benchmark::State &state)
+{
+    if (state.thread_index() == 0)
+    {
+        set_up_session("def f(x) x*2");
+        for (int version = 0; version < 100; version++)
+            session->RunInBackground("def f(x) x*2+" + std::to_string(version));
+    }
+    UnaryFunction f = nullptr;
+
+    double sum = 0;
+    for (auto _ : state)
+    {
+        if (!f)
+            f = reinterpret_cast<UnaryFunction>(session->GetFunctionAddress("f"));
+        sum += f(1);
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if (state.thread_index() == 0)
+        session->WaitForBackground();
+}
+BENCHMARK(BM_CallsDuringRedefinition)->ThreadRange(1, 8)->UseRealTime();
+
+
+// Evaluates a script of many small top-level expressions, one at a time or
+// in batches of the given size.
+static void BM_TopLevelExpressions(benchmark::State &state)
+{
+    std::string source("def f(x) x*x + 1\n");
+    for (int i = 0; i < 1000; i++)
+        source += "f(" + std::to_string(i) + ") * 2;\n";
+
+    auto session = JITSession::Create();
+    session->SetBatchSize(state.range(0));
+    for (auto _ : state)
+    {
+        std::istringstream stream(source);
+        session->Run(stream);
+    }
+    state.SetItemsProcessed(state.iterations() * 1000);
+}
+BENCHMARK(BM_TopLevelExpressions)->ArgName("batch")->Arg(1)->Arg(64)->Arg(1024)
+    ->Unit(benchmark::kMillisecond);
+
+
+
+// Calls a kernel of independent math calls, compiled without and with
+// fast-math. Math externs are lowered to intrinsics either way; fast-math
+// also lets the sum be reassociated, so the calls can be widened.
+static void BM_MathKernel(benchmark::State &state)
+{
+    auto session = JITSession::Create();
+    session->SetFastMath(state.range(0));
+    std::istringstream stream("extern sin(x)\nextern cos(x)\n"
+                              "def trig(a b c d) sin(a)*cos(b) + sin(b)*cos(c)"
+                              " + sin(c)*cos(d) + sin(d)*cos(a)");
+    session->Run(stream);
+    auto trig = reinterpret_cast<QuaternaryFunction>(session->GetFunctionAddress("trig"));
+
+    double x = 0;
+    for (auto _ : state)
+    {
+        x = trig(x, x + 0.25, x + 0.5, x + 0.75) * 0.1;
+        benchmark::DoNotOptimize(x);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MathKernel)->ArgName("fast_math")->Arg(0)->Arg(1);
+
+
+// Reloads a source of a few hundred chained definitions in which only the
+// last one changed, against compiling the whole source in a fresh session.
+static void BM_ReloadSource(benchmark::State &state)
+{
+    std::string unchanged("def f0(x) x+1\n");
+    for (int i = 1; i < 199; i++)
+        unchanged += "def f" + std::to_string(i) + "(x) f" + std::to_string(i - 1) + "(x)*2\n";
+
+    auto session = JITSession::Create();
+    std::istringstream stream(unchanged + "def f199(x) f198(x)+0");
+    session->Run(stream);
+    int version = 1;
+    for (auto _ : state)
+    {
+        std::string edited = unchanged + "def f199(x) f198(x)+" + std::to_string(version++);
+        if (state.range(0))
+        {
+            std::istringstream stream(edited);
+            session->Run(stream);
+        }
+        else
+        {
+            auto fresh = JITSession::Create();
+            std::istringstream stream(edited);
+            fresh->Run(stream);
+        }
+    }
+}
+BENCHMARK(BM_ReloadSource)->ArgName("incremental")->Arg(0)->Arg(1)
+    ->Unit(benchmark::kMillisecond);
+
+
+
+// Evaluates a small kernel through a static evaluator, which the compiler
+// inlines into the loop, against a call into the code the JIT compiled for
+// the same source.
+static void BM_StaticKernel(benchmark::State &state)
+{
+    auto kernel = KALEIDOSCOPE_STATIC("def kernel(x y) if x < y then (x*3 + y)*x - 5 else x/2");
+    auto session = JITSession::Create();
+    std::istringstream stream("def kernel(x y) if x < y then (x*3 + y)*x - 5 else x/2");
+    session->Run(stream);
+    auto compiled = reinterpret_cast<BinaryFunction>(session->GetFunctionAddress("kernel"));
+
+    double x = 0;
+    for (auto _ : state)
+    {
+        x = (state.range(0) ? kernel(x, 0.5) : compiled(x, 0.5)) * 0.1;
+        benchmark::DoNotOptimize(x);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_StaticKernel)->ArgName("static")->Arg(0)->Arg(1);
+
+}
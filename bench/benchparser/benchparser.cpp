@@ -0,0 +1,174 @@
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "benchmark/benchmark.h"
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include "libkaleidoscope_fuzz/fuzz.h"
+#include "libkaleidoscope_instrumentation/instrumentation.h"
+#include "libkaleidoscope_parser/codegen.h"
+#include "libkaleidoscope_parser/incremental.h"
+#include "libkaleidoscope_parser/parser.h"
+
+
+namespace
+{
+
+
+// Machine-generated scoring functions: every function repeats the same
+// handful of terms, as generated inputs tend to.
+static std::string generate_corpus(int functions)
+{
+    std::string term = "(x*y + x/y - (x-y)*(x+y))";
+    std::string source;
+    for (int i = 0; i < functions; i++)
+    {
+        source += "def score" + std::to_string(i) + "(x y) ";
+        source += term + "*" + term + " + " + term + "*" + std::to_string(i) + "\n";
+    }
+    return source;
+}
+
+
+// Lowers every definition it is handed into a single module.
+class CodegenHandler : public TopLevelHandler
+{
+    llvm::LLVMContext context;
+    llvm::Module module;
+    PrototypeTable prototypes;
+    CodegenContext codegen_context;
+
+  public:
+    CodegenHandler()
+        : module("bench", context), codegen_context(module, prototypes) {}
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        benchmark::DoNotOptimize(function->codegen(this->codegen_context));
+    }
+};
+
+
+// Parses and lowers the corpus, with hash-consing when the second argument
+// is set. Reports the bytes allocated for AST nodes per iteration.
+static void BM_ParseAndCodegen(benchmark::State &state)
+{
+    std::string source = generate_corpus(state.range(0));
+    EnableInstrumentation(true);
+    ResetInstrumentation();
+
+    for (auto _ : state)
+    {
+        std::istringstream stream(source);
+        Parser parser(stream);
+        if (state.range(1))
+            parser.EnableHashConsing();
+        CodegenHandler handler;
+        parser.Driver(handler);
+    }
+
+    state.counters["ast_bytes"] = benchmark::Counter(
+        GetCounter(counter_bytes_allocated), benchmark::Counter::kAvgIterations);
+    state.counters["shared_nodes"] = benchmark::Counter(
+        GetCounter(counter_shared_ast_nodes), benchmark::Counter::kAvgIterations);
+    state.SetBytesProcessed(state.iterations() * source.size());
+    EnableInstrumentation(false);
+}
+BENCHMARK(BM_ParseAndCodegen)->ArgNames({"functions", "hash_consing"})
+    ->Args({100, 0})->Args({100, 1})->Args({1000, 0})->Args({1000, 1});
+
+
+
+// Lexes the corpus from a file, where asking the stream for the position of
+// every token would dominate the cost.
+static void BM_LexFile(benchmark::State &state)
+{
+    std::string path = "/tmp/kaleidoscope-lex-" + std::to_string(getpid()) + ".k";
+    {
+        std::ofstream file(path);
+        file << generate_corpus(state.range(0));
+    }
+
+    size_t tokens = 0;
+    for (auto _ : state)
+    {
+        std::ifstream file(path);
+        Lexer lexer(file);
+        while (lexer.GetToken().token != tok_eof)
+            tokens++;
+    }
+    state.SetItemsProcessed(tokens);
+    std::remove(path.c_str());
+}
+BENCHMARK(BM_LexFile)->ArgName("functions")->Arg(1000)->Unit(benchmark::kMillisecond);
+
+
+// Parses the corpus from scratch, as an editor would on every keystroke
+// without incremental parsing.
+static void BM_FullReparse(benchmark::State &state)
+{
+    std::string source = generate_corpus(state.range(0));
+    for (auto _ : state)
+    {
+        SourceDocument document(source);
+        benchmark::DoNotOptimize(document.get_items().data());
+    }
+}
+BENCHMARK(BM_FullReparse)->ArgName("functions")->Arg(100)->Arg(1000)
+    ->Unit(benchmark::kMicrosecond);
+
+
+// Types and deletes a term in the middle of the corpus, one keystroke per
+// iteration.
+static void BM_IncrementalEdit(benchmark::State &state)
+{
+    std::string source = generate_corpus(state.range(0));
+    SourceDocument document(source);
+    size_t offset = source.find("\n", source.size() / 2);
+
+    bool typed = false;
+    for (auto _ : state)
+    {
+        if (typed)
+            document.Edit(offset, offset + 4, "");
+        else
+            document.Edit(offset, offset, " + x");
+        typed = !typed;
+    }
+}
+BENCHMARK(BM_IncrementalEdit)->ArgName("functions")->Arg(100)->Arg(1000)
+    ->Unit(benchmark::kMicrosecond);
+
+
+// Runs the front-end on an input of the regression corpus that
+// kaleidoscope_fuzzer saved, because its cost grew superlinearly with its
+// size or because it crashed.
+static void BM_ReplayCorpus(benchmark::State &state, const std::string &input)
+{
+    for (auto _ : state)
+        RunFrontEnd(input);
+    state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+
+// Registers a benchmark for every input of the corpus, named after it.
+static bool register_corpus()
+{
+    for (auto &entry : LoadCorpus(CORPUS_DIRECTORY))
+    {
+        std::string input = entry.second;
+        benchmark::RegisterBenchmark(("BM_ReplayCorpus/" + entry.first).c_str(),
+                                     [input](benchmark::State &state) {
+                                         BM_ReplayCorpus(state, input);
+                                     })
+            ->Unit(benchmark::kMicrosecond);
+    }
+    return true;
+}
+static bool corpus_registered = register_corpus();
+
+
+}
@@ -0,0 +1,79 @@
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include "benchmark/benchmark.h"
+
+#include "libkaleidoscope_pipeline/pipeline.h"
+
+
+namespace
+{
+
+
+static double process_cpu_seconds()
+{
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+
+// Spends the given time on every definition, standing in for a backend
+// that compiles them.
+class SlowBackend : public TopLevelHandler
+{
+    std::chrono::microseconds delay;
+
+  public:
+    SlowBackend(int delay_us) : delay(delay_us) {}
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        auto until = std::chrono::steady_clock::now() + this->delay;
+        while (std::chrono::steady_clock::now() < until)
+            ;
+    }
+};
+
+
+// Runs the pipeline over generated definitions, with a backend that takes
+// the given number of microseconds per definition. Reports the wall-clock
+// time over the busy time of the slowest stage, which is close to 1 when
+// the stages overlap, and the cores used, which is close to 1 when the
+// stages waiting on the slowest one sleep instead of spinning.
+static void BM_PipelineSlowestStage(benchmark::State &state)
+{
+    std::string source;
+    for (int i = 0; i < 2000; i++)
+        source += "def f" + std::to_string(i) + "(x y) (x*y + x/y - (x-y)*(x+y)) * "
+            + std::to_string(i) + "\n";
+
+    SlowBackend backend(state.range(0));
+    Pipeline pipeline(backend);
+    double wall_seconds = 0;
+    double slowest_seconds = 0;
+    double cpu_seconds = 0;
+    for (auto _ : state)
+    {
+        std::istringstream stream(source);
+        double cpu_start = process_cpu_seconds();
+        pipeline.Run(stream);
+        cpu_seconds += process_cpu_seconds() - cpu_start;
+
+        const PipelineMetrics &metrics = pipeline.get_metrics();
+        wall_seconds += metrics.wall_seconds;
+        slowest_seconds += std::max({metrics.lexer.busy_seconds, metrics.parser.busy_seconds,
+                                     metrics.backend.busy_seconds});
+    }
+
+    state.counters["wall_over_slowest"] = wall_seconds / slowest_seconds;
+    state.counters["cores"] = cpu_seconds / wall_seconds;
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_PipelineSlowestStage)->ArgName("backend_us")->Arg(0)->Arg(20)
+    ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+
+}
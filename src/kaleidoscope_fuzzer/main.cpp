@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libkaleidoscope_fuzz/fuzz.h"
+
+
+static int usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s CORPUS [--runs N] [--seed N] [--sites N] [--max-size BYTES]\n"
+            "       [--timeout SECONDS] [--max-exponent X]\n"
+            "\n"
+            "Generates front-end inputs from the grammar, or mutates earlier ones, and\n"
+            "records the time and peak memory taken to lex and parse each one. Each\n"
+            "input is then pumped at a few sites to doubling sizes, up to the maximum\n"
+            "size. Inputs whose cost grows faster than size^X, or that crash or time\n"
+            "out, are saved into the CORPUS directory, which runBenchmarks replays.\n"
+            "The inputs already in the corpus seed the mutations.\n"
+            "\n"
+            "Prints one record per input measured: the run, its size in bytes, its\n"
+            "time in seconds, the peak resident set and AST bytes, and its status.\n"
+            "Exits with 1 if any input was saved.\n",
+            program);
+    return 1;
+}
+
+
+// Inputs that took the most time per byte, kept as mutation parents.
+class ParentPool
+{
+    std::vector<std::pair<double, std::string>> parents;
+    size_t capacity;
+
+  public:
+    ParentPool(size_t capacity) : capacity(capacity) {}
+
+    bool empty() const { return this->parents.empty(); }
+    const std::string &get(size_t index) const { return this->parents[index].second; }
+    size_t size() const { return this->parents.size(); }
+
+    void Offer(const std::string &input, double seconds)
+    {
+        double cost = seconds / std::max<size_t>(input.size(), 1);
+        if (this->parents.size() < this->capacity)
+        {
+            this->parents.emplace_back(cost, input);
+            return;
+        }
+        auto cheapest = std::min_element(this->parents.begin(), this->parents.end());
+        if (cheapest->first < cost)
+            *cheapest = std::make_pair(cost, input);
+    }
+};
+
+
+static const char *get_status(const InputCost &cost)
+{
+    if (cost.timed_out)
+        return "timeout";
+    if (cost.signal)
+        return strsignal(cost.signal);
+    return "ok";
+}
+
+
+static void print_record(int run, const InputCost &cost)
+{
+    printf("%d\t%zu\t%.6f\t%zu\t%llu\t%s\n", run, cost.size, cost.seconds,
+           cost.peak_rss_bytes, static_cast<unsigned long long>(cost.ast_bytes),
+           get_status(cost));
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return usage(argv[0]);
+
+    std::string corpus_directory(argv[1]);
+    int runs = 100;
+    uint64_t seed = 1;
+    int sites = 4;
+    FuzzOptions options;
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--runs") && i + 1 < argc)
+            runs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+            seed = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--sites") && i + 1 < argc)
+            sites = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--max-size") && i + 1 < argc)
+            options.max_size = strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--timeout") && i + 1 < argc)
+            options.timeout_seconds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--max-exponent") && i + 1 < argc)
+            options.max_exponent = atof(argv[++i]);
+        else
+            return usage(argv[0]);
+    }
+
+    InputGenerator generator(seed);
+    std::mt19937_64 random(seed);
+    ParentPool pool(64);
+    for (auto &entry : LoadCorpus(corpus_directory))
+        pool.Offer(entry.second, 0);
+
+    int saved = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        std::string input;
+        if (pool.empty() || random() % 2)
+            input = generator.Generate();
+        else
+            input = generator.Mutate(pool.get(random() % pool.size()));
+
+        InputCost cost;
+        if (!MeasureInput(RunFrontEnd, input, options, cost))
+            return 1;
+        print_record(run, cost);
+        if (cost.failed())
+        {
+            fprintf(stderr, "run %d: input %s\n", run, get_status(cost));
+            saved += !SaveToCorpus(corpus_directory, "crash", input).empty();
+            continue;
+        }
+        pool.Offer(input, cost.seconds);
+
+        PumpSite site;
+        for (int i = 0; i < sites && generator.PickPumpSite(input, site); i++)
+        {
+            GrowthReport report = MeasureGrowth(RunFrontEnd, input, site, options);
+            for (const InputCost &pumped : report.costs)
+                print_record(run, pumped);
+
+            // Timing noise can make a single measurement look superlinear,
+            // so growth is only flagged when measured again
+            if (report.superlinear)
+                report = MeasureGrowth(RunFrontEnd, input, site, options);
+            if (!report.failed && !report.superlinear)
+                continue;
+
+            const char *prefix = report.failed ? "crash" : "slow";
+            std::string path = SaveToCorpus(corpus_directory, prefix, report.input);
+            fprintf(stderr, "run %d: %s input of %zu bytes, time ~ size^%.2f, "
+                    "memory ~ size^%.2f, saved to %s\n",
+                    run, prefix, report.input.size(), report.time_exponent,
+                    report.memory_exponent, path.c_str());
+            saved += !path.empty();
+            break;
+        }
+        fflush(stdout);
+    }
+    return saved ? 1 : 0;
+}
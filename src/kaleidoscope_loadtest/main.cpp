@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "libkaleidoscope_server/client.h"
+
+
+static int usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s SOCKET [--clients N] [--requests N] [--request SOURCE]\n"
+            "\n"
+            "Sends requests to a kaleidoscoped server from N concurrent clients and\n"
+            "reports the latency percentiles.\n",
+            program);
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return usage(argv[0]);
+
+    std::string socket_path(argv[1]);
+    int clients = 8;
+    int requests = 1000;
+    std::string request("1+2*3");
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--clients") && i + 1 < argc)
+            clients = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--requests") && i + 1 < argc)
+            requests = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--request") && i + 1 < argc)
+            request = argv[++i];
+        else
+            return usage(argv[0]);
+    }
+
+    std::mutex samples_mutex;
+    std::vector<double> samples;
+    int failures = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++)
+    {
+        threads.emplace_back([&]() {
+            std::vector<double> latencies;
+            int failed = 0;
+            CompileClient client;
+            if (client.Connect(socket_path))
+            {
+                std::string response;
+                for (int j = 0; j < requests; j++)
+                {
+                    auto sent = std::chrono::steady_clock::now();
+                    if (!client.Request(request, response))
+                    {
+                        failed += requests - j;
+                        break;
+                    }
+                    latencies.push_back(std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - sent).count());
+                    // The server answered, but could not run the request
+                    if (response.compare(0, 2, "ok") != 0)
+                        failed++;
+                }
+            }
+            else
+                failed = requests;
+
+            std::lock_guard<std::mutex> lock(samples_mutex);
+            samples.insert(samples.end(), latencies.begin(), latencies.end());
+            failures += failed;
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    LatencyStats stats = ComputeLatencyStats(samples);
+    printf("requests:   %zu (%d failed)\n", stats.count, failures);
+    printf("throughput: %.1f requests/s\n", stats.count / elapsed);
+    printf("latency:    mean %.3f ms, p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, "
+           "p99.9 %.3f ms, max %.3f ms\n",
+           stats.mean * 1e3, stats.p50 * 1e3, stats.p90 * 1e3, stats.p99 * 1e3,
+           stats.p999 * 1e3, stats.max * 1e3);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "libkaleidoscope_jit/session.h"
+#include "libkaleidoscope_server/server.h"
+
+
+static int usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s SOCKET [--threads N] [--prelude FILE] [--perf-map] [--gdb]\n"
+            "       [--tiering] [--profile FILE] [--batch N] [--fast-math] [--streaming]\n"
+            "\n"
+            "Serves compile requests over the Unix domain socket SOCKET until\n"
+            "interrupted. Definitions in the prelude file are compiled at start up.\n"
+            "With --tiering, hot functions are recompiled with their profile; the\n"
+            "profile file, if it exists, is loaded at start up and saved on exit.\n"
+            "With --batch, up to N consecutive top-level expressions of a request\n"
+            "are compiled and evaluated together. With --fast-math, floating-point\n"
+            "math may be reassociated, trading exact results for speed. With\n"
+            "--streaming, definitions are compiled when they are received rather\n"
+            "than on their first call.\n",
+            program);
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return usage(argv[0]);
+
+    std::string socket_path(argv[1]);
+    size_t threads = std::thread::hardware_concurrency();
+    std::string prelude;
+    std::string profile;
+    bool tiering = false;
+    bool fast_math = false;
+    size_t batch_size = 1;
+    JITOptions options;
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--prelude") && i + 1 < argc)
+            prelude = argv[++i];
+        else if (!strcmp(argv[i], "--perf-map"))
+            options.perf_map = true;
+        else if (!strcmp(argv[i], "--gdb"))
+            options.gdb = true;
+        else if (!strcmp(argv[i], "--tiering"))
+            tiering = true;
+        else if (!strcmp(argv[i], "--profile") && i + 1 < argc)
+            profile = argv[++i];
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc)
+            batch_size = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--fast-math"))
+            fast_math = true;
+        else if (!strcmp(argv[i], "--streaming"))
+            options.streaming = true;
+        else
+            return usage(argv[0]);
+    }
+    if (threads == 0)
+        threads = 1;
+
+    // Only the main thread handles the shutdown signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    auto session = JITSession::Create(options);
+    if (!session)
+        return 1;
+
+    session->SetBatchSize(batch_size);
+    session->SetFastMath(fast_math);
+    if (tiering)
+    {
+        if (!profile.empty() && std::ifstream(profile) && !session->LoadProfile(profile))
+            return 1;
+        session->EnableTiering();
+    }
+
+    // Warm up the session with the prelude definitions
+    if (!prelude.empty())
+    {
+        std::ifstream prelude_file(prelude);
+        if (!prelude_file)
+        {
+            fprintf(stderr, "ERROR: could not open prelude %s\n", prelude.c_str());
+            return 1;
+        }
+        std::stringstream source;
+        source << prelude_file.rdbuf();
+        session->SetSource(prelude, source.str());
+        session->Run(source);
+
+        // Requests are not part of the prelude, and are located on their own
+        session->ClearSource();
+    }
+
+    CompileServer server(*session, socket_path, threads);
+    if (!server.Start())
+        return 1;
+    fprintf(stderr, "listening on %s with %zu threads\n", socket_path.c_str(), threads);
+
+    int signal_number;
+    sigwait(&signals, &signal_number);
+    server.Stop();
+
+    if (tiering && !profile.empty() && !session->SaveProfile(profile))
+        return 1;
+    return 0;
+}
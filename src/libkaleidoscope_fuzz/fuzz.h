@@ -0,0 +1,140 @@
+#ifndef FUZZ_H_
+#define FUZZ_H_
+
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Code under test, run on one input at a time.
+typedef std::function<void(const std::string &)> FuzzTarget;
+
+
+// Lexes and parses every top-level item of the input, dropping the items,
+// as the front-end does before code generation.
+void RunFrontEnd(const std::string &input);
+
+
+// Two slices of an input that are repeated together: the input
+// `x u y v z`, with u and v the first and second slice, is pumped n times
+// into `x u^n y v^n z`. Pumping both slices reaches nesting, as in
+// `((((x))))`, as well as repetition. The second slice may be empty.
+struct PumpSite {
+    size_t first_begin = 0;
+    size_t first_end = 0;
+    size_t second_begin = 0;
+    size_t second_end = 0;
+};
+
+
+std::string Pump(const std::string &input, const PumpSite &site, size_t count);
+
+
+// Generates inputs from the grammar of the language, mutates existing ones
+// and picks pump sites in them. Every choice comes from the seed, so a run
+// can be repeated.
+class InputGenerator
+{
+    std::mt19937_64 random;
+    unsigned max_depth;
+
+  public:
+    InputGenerator(uint64_t seed, unsigned max_depth = 5);
+
+    // A program of a few definitions, externs and top-level expressions.
+    std::string Generate();
+    // The input with a few bytes or tokens inserted, removed, repeated or
+    // replaced. The result may not parse.
+    std::string Mutate(const std::string &input);
+    // A site whose slices start and end on token boundaries, so that
+    // pumping repeats whole tokens. Fails if the input has no tokens.
+    bool PickPumpSite(const std::string &input, PumpSite &site);
+
+  private:
+    size_t pick(size_t count);
+    std::string generate_item();
+    std::string generate_prototype();
+    std::string generate_expression(unsigned depth);
+    std::string generate_primary(unsigned depth);
+    std::string generate_identifier();
+    std::string generate_number();
+};
+
+
+// What running a target on one input took.
+struct InputCost {
+    size_t size = 0;
+    // Fastest of the runs
+    double seconds = 0;
+    // Peak resident set of the process that ran the input
+    size_t peak_rss_bytes = 0;
+    // Allocated for AST nodes in a single run
+    uint64_t ast_bytes = 0;
+    // Signal the run was killed by, if any, such as SIGSEGV on a stack
+    // overflow or SIGABRT on an uncaught exception
+    int signal = 0;
+    bool timed_out = false;
+
+    bool failed() const { return this->signal || this->timed_out; }
+};
+
+
+struct FuzzOptions {
+    // Timed runs per input
+    unsigned runs = 3;
+    unsigned timeout_seconds = 10;
+    // Sizes pumped inputs are grown from and up to, in bytes
+    size_t min_size = 1024;
+    size_t max_size = 64 * 1024;
+    // Growth, as the exponent of cost over size, from which a cost is
+    // flagged as superlinear
+    double max_exponent = 1.5;
+    // Times below this are too noisy to tell growth from
+    double min_seconds = 0.001;
+};
+
+
+// Runs the target on the input in a child process, so that a crash or a
+// hang only takes down the child. Returns false, after logging why, if the
+// child could not be started.
+bool MeasureInput(const FuzzTarget &target, const std::string &input,
+                  const FuzzOptions &options, InputCost &cost);
+
+
+// How the cost of an input grows as a site of it is pumped.
+struct GrowthReport {
+    // Costs at each size, smallest first, up to the first failure
+    std::vector<InputCost> costs;
+    // Exponents of time and AST memory over the size of the pumped slices,
+    // over the last two doublings, or 0 when the times were too short to
+    // tell
+    double time_exponent = 0;
+    double memory_exponent = 0;
+    bool superlinear = false;
+    bool failed = false;
+    // The largest input measured, which is the one that failed if any
+    std::string input;
+};
+
+
+// Measures the target on the input pumped at the site to doubling sizes,
+// from the minimum size of the options up to the maximum.
+GrowthReport MeasureGrowth(const FuzzTarget &target, const std::string &input,
+                           const PumpSite &site, const FuzzOptions &options);
+
+
+// Inputs saved into a corpus directory, by file name, sorted. An input is
+// named after its prefix and a hash of its contents, so saving the same
+// input twice keeps a single file. Saving returns the path written, or an
+// empty string, after logging why, on failure.
+std::vector<std::pair<std::string, std::string>> LoadCorpus(const std::string &directory);
+std::string SaveToCorpus(const std::string &directory, const std::string &prefix,
+                         const std::string &input);
+
+
+#endif  // FUZZ_H_
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <sstream>
+
+#include "fuzz.h"
+#include "libkaleidoscope_lexer/lexer.h"
+
+
+static const char *const identifiers[] = {"x", "y", "z", "a", "b", "f", "g", "foo", "bar", "sin"};
+static const char *const keywords[] = {"def ", "extern ", "if ", " then ", " else ", "(", ")", ",", ";"};
+static const char *const binary_operators[] = {"+", "-", "*", "/", "<", ">"};
+
+// Characters mutations insert: every character the lexer treats specially,
+// and a few it does not
+static const char alphabet[] = "()+-*/<>,;#.\n xyzfi0123456789e!";
+
+
+template <typename Element, size_t count>
+static size_t array_size(Element (&)[count])
+{
+    return count;
+}
+
+
+std::string Pump(const std::string &input, const PumpSite &site, size_t count)
+{
+    std::string first = input.substr(site.first_begin, site.first_end - site.first_begin);
+    std::string second = input.substr(site.second_begin, site.second_end - site.second_begin);
+
+    std::string pumped = input.substr(0, site.first_begin);
+    pumped.reserve(input.size() + (first.size() + second.size()) * count);
+    for (size_t i = 0; i < count; i++)
+        pumped += first;
+    pumped.append(input, site.first_end, site.second_begin - site.first_end);
+    for (size_t i = 0; i < count; i++)
+        pumped += second;
+    pumped.append(input, site.second_end, std::string::npos);
+    return pumped;
+}
+
+
+InputGenerator::InputGenerator(uint64_t seed, unsigned max_depth)
+    : random(seed), max_depth(max_depth)
+{
+}
+
+
+std::string InputGenerator::Generate()
+{
+    std::string input;
+    size_t items = 1 + this->pick(6);
+    for (size_t i = 0; i < items; i++)
+    {
+        if (this->pick(8) == 0)
+            input += "# comment " + this->generate_identifier() + "\n";
+        input += this->generate_item();
+        input += this->pick(2) ? "\n" : ";\n";
+    }
+    return input;
+}
+
+
+std::string InputGenerator::Mutate(const std::string &input)
+{
+    if (input.empty())
+        return this->Generate();
+
+    std::string mutated = input;
+    size_t mutations = 1 + this->pick(4);
+    for (size_t i = 0; i < mutations; i++)
+    {
+        size_t offset = this->pick(mutated.size() + 1);
+        size_t length = std::min<size_t>(1 + this->pick(8), mutated.size() - offset);
+        switch (this->pick(6))
+        {
+            case 0:
+                mutated.insert(offset, 1, alphabet[this->pick(sizeof(alphabet) - 1)]);
+                break;
+            case 1:
+                mutated.erase(offset, length);
+                break;
+            case 2:
+                if (offset < mutated.size())
+                    mutated[offset] = alphabet[this->pick(sizeof(alphabet) - 1)];
+                break;
+            case 3:
+                mutated.insert(this->pick(mutated.size() + 1), mutated.substr(offset, length));
+                break;
+            case 4:
+                mutated.insert(offset, this->generate_expression(this->max_depth / 2));
+                break;
+            default:
+                mutated.insert(offset, keywords[this->pick(array_size(keywords))]);
+                break;
+        }
+        if (mutated.empty())
+            return this->Generate();
+    }
+    return mutated;
+}
+
+
+bool InputGenerator::PickPumpSite(const std::string &input, PumpSite &site)
+{
+    // Slices start at a token and end at the start of another one, or at
+    // the end of the input, so they keep the whitespace after their tokens
+    std::vector<size_t> boundaries;
+    std::istringstream stream(input);
+    Lexer lexer(stream);
+    for (Token token = lexer.GetToken(); token.token != tok_eof; token = lexer.GetToken())
+        boundaries.push_back(token.location);
+    if (boundaries.empty())
+        return false;
+    boundaries.push_back(input.size());
+
+    std::vector<size_t> picked;
+    size_t slices = this->pick(2) ? 2 : 1;
+    for (size_t i = 0; i < slices * 2; i++)
+        picked.push_back(boundaries[this->pick(boundaries.size())]);
+    std::sort(picked.begin(), picked.end());
+
+    // The first slice must not be empty, or pumping would not grow it
+    if (picked[0] == picked[1])
+    {
+        auto next = std::upper_bound(boundaries.begin(), boundaries.end(), picked[1]);
+        if (next == boundaries.end())
+            picked[0] = boundaries[boundaries.size() - 2];
+        else
+            picked[1] = *next;
+        std::sort(picked.begin(), picked.end());
+    }
+
+    site.first_begin = picked[0];
+    site.first_end = picked[1];
+    site.second_begin = slices == 2 ? picked[2] : picked[1];
+    site.second_end = slices == 2 ? picked[3] : picked[1];
+    return true;
+}
+
+
+size_t InputGenerator::pick(size_t count)
+{
+    return std::uniform_int_distribution<size_t>(0, count - 1)(this->random);
+}
+
+
+std::string InputGenerator::generate_item()
+{
+    switch (this->pick(4))
+    {
+        case 0:
+            return "extern " + this->generate_prototype();
+        case 1:
+            return this->generate_expression(0);
+        default:
+            return "def " + this->generate_prototype() + " " + this->generate_expression(0);
+    }
+}
+
+
+std::string InputGenerator::generate_prototype()
+{
+    std::string prototype = this->generate_identifier() + "(";
+    size_t args = this->pick(4);
+    for (size_t i = 0; i < args; i++)
+        prototype += (i ? " " : "") + this->generate_identifier();
+    return prototype + ")";
+}
+
+
+std::string InputGenerator::generate_expression(unsigned depth)
+{
+    std::string expression = this->generate_primary(depth);
+    size_t operators = this->pick(4);
+    for (size_t i = 0; i < operators; i++)
+    {
+        expression += this->pick(2) ? " " : "";
+        expression += binary_operators[this->pick(array_size(binary_operators))];
+        expression += this->pick(2) ? " " : "";
+        expression += this->generate_primary(depth);
+    }
+    return expression;
+}
+
+
+std::string InputGenerator::generate_primary(unsigned depth)
+{
+    size_t choices = depth >= this->max_depth ? 2 : 5;
+    switch (this->pick(choices))
+    {
+        case 0:
+            return this->generate_number();
+        case 1:
+            return this->generate_identifier();
+        case 2:
+            return "(" + this->generate_expression(depth + 1) + ")";
+        case 3:
+        {
+            std::string call = this->generate_identifier() + "(";
+            size_t args = this->pick(4);
+            for (size_t i = 0; i < args; i++)
+                call += (i ? ", " : "") + this->generate_expression(depth + 1);
+            return call + ")";
+        }
+        default:
+            return "if " + this->generate_expression(depth + 1) + " then "
+                + this->generate_expression(depth + 1) + " else "
+                + this->generate_expression(depth + 1);
+    }
+}
+
+
+std::string InputGenerator::generate_identifier()
+{
+    return identifiers[this->pick(array_size(identifiers))];
+}
+
+
+std::string InputGenerator::generate_number()
+{
+    std::string number = std::to_string(this->pick(1000));
+    if (this->pick(4) == 0)
+        number += "." + std::to_string(this->pick(100));
+    return number;
+}
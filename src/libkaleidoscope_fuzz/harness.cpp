@@ -0,0 +1,232 @@
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include "fuzz.h"
+#include "libkaleidoscope_instrumentation/instrumentation.h"
+#include "libkaleidoscope_parser/parser.h"
+
+
+void RunFrontEnd(const std::string &input)
+{
+    std::istringstream stream(input);
+    Parser parser(stream);
+    parser.Driver();
+}
+
+
+// Runs the target in the child process and measures it, with
+// instrumentation only enabled for a last run that counts AST bytes, so
+// that the timed runs do not pay for it.
+static InputCost measure_in_child(const FuzzTarget &target, const std::string &input,
+                                  const FuzzOptions &options)
+{
+    InputCost cost;
+    cost.size = input.size();
+    cost.seconds = std::numeric_limits<double>::infinity();
+    for (unsigned run = 0; run < std::max(options.runs, 1u); run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        target(input);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        cost.seconds = std::min(cost.seconds, elapsed.count());
+    }
+
+    EnableInstrumentation(true);
+    ResetInstrumentation();
+    target(input);
+    cost.ast_bytes = GetCounter(counter_bytes_allocated);
+    EnableInstrumentation(false);
+
+    struct rusage usage;
+    if (!getrusage(RUSAGE_SELF, &usage))
+        cost.peak_rss_bytes = static_cast<size_t>(usage.ru_maxrss) * 1024;
+    return cost;
+}
+
+
+bool MeasureInput(const FuzzTarget &target, const std::string &input,
+                  const FuzzOptions &options, InputCost &cost)
+{
+    int fds[2];
+    if (pipe(fds))
+    {
+        fprintf(stderr, "ERROR: cannot create pipe: %s\n", strerror(errno));
+        return false;
+    }
+
+    pid_t child = fork();
+    if (child < 0)
+    {
+        fprintf(stderr, "ERROR: cannot fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (child == 0)
+    {
+        // A hang is killed by the alarm, and reported as a timeout
+        close(fds[0]);
+        alarm(options.timeout_seconds);
+        InputCost measured = measure_in_child(target, input, options);
+        ssize_t written = write(fds[1], &measured, sizeof(measured));
+        _exit(written == sizeof(measured) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    InputCost measured;
+    size_t received = 0;
+    while (received < sizeof(measured))
+    {
+        ssize_t count = read(fds[0], reinterpret_cast<char *>(&measured) + received,
+                             sizeof(measured) - received);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+        received += count;
+    }
+    close(fds[0]);
+
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+        ;
+
+    cost = InputCost();
+    if (received == sizeof(measured))
+        cost = measured;
+    cost.size = input.size();
+    if (WIFSIGNALED(status))
+    {
+        if (WTERMSIG(status) == SIGALRM)
+            cost.timed_out = true;
+        else
+            cost.signal = WTERMSIG(status);
+    }
+    else if (received != sizeof(measured))
+    {
+        fprintf(stderr, "ERROR: lost the measurements of the child process\n");
+        return false;
+    }
+    return true;
+}
+
+
+GrowthReport MeasureGrowth(const FuzzTarget &target, const std::string &input,
+                           const PumpSite &site, const FuzzOptions &options)
+{
+    GrowthReport report;
+    size_t slices = (site.first_end - site.first_begin) + (site.second_end - site.second_begin);
+    if (slices == 0)
+        return report;
+
+    // Start from the smallest count that reaches the minimum size
+    size_t unpumped = input.size() - slices;
+    size_t count = 1;
+    if (options.min_size > unpumped)
+        count = std::max<size_t>(1, (options.min_size - unpumped + slices - 1) / slices);
+
+    for (; unpumped + count * slices <= options.max_size; count *= 2)
+    {
+        std::string pumped = Pump(input, site, count);
+        InputCost cost;
+        if (!MeasureInput(target, pumped, options, cost))
+            break;
+        report.input = std::move(pumped);
+        report.costs.push_back(cost);
+        if (cost.failed())
+        {
+            report.failed = true;
+            return report;
+        }
+    }
+    if (report.costs.size() < 2)
+        return report;
+
+    // Growth over the last two doublings, where a constant overhead matters
+    // least, and a size that happens to spill out of a cache matters less
+    // than over a single doubling. It is measured against the pumped bytes
+    // alone, so the cost of the rest of the input can only make it smaller.
+    size_t first = report.costs.size() - std::min<size_t>(report.costs.size(), 3);
+    const InputCost &previous = report.costs[first];
+    const InputCost &last = report.costs.back();
+    double size_growth = log(static_cast<double>(last.size - unpumped)
+                             / (previous.size - unpumped));
+    if (last.seconds >= options.min_seconds && previous.seconds > 0)
+        report.time_exponent = log(last.seconds / previous.seconds) / size_growth;
+    if (previous.ast_bytes > 0 && last.ast_bytes > 0)
+        report.memory_exponent = log(static_cast<double>(last.ast_bytes) / previous.ast_bytes)
+            / size_growth;
+    report.superlinear = report.time_exponent > options.max_exponent
+        || report.memory_exponent > options.max_exponent;
+    return report;
+}
+
+
+std::vector<std::pair<std::string, std::string>> LoadCorpus(const std::string &directory)
+{
+    std::vector<std::pair<std::string, std::string>> corpus;
+    DIR *entries = opendir(directory.c_str());
+    if (!entries)
+        return corpus;
+
+    while (struct dirent *entry = readdir(entries))
+    {
+        std::string name(entry->d_name);
+        if (name.empty() || name[0] == '.')
+            continue;
+        std::ifstream file(directory + "/" + name, std::ios::binary);
+        if (!file)
+            continue;
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        corpus.emplace_back(name, contents.str());
+    }
+    closedir(entries);
+
+    std::sort(corpus.begin(), corpus.end());
+    return corpus;
+}
+
+
+std::string SaveToCorpus(const std::string &directory, const std::string &prefix,
+                         const std::string &input)
+{
+    if (mkdir(directory.c_str(), 0755) && errno != EEXIST)
+    {
+        fprintf(stderr, "ERROR: cannot create %s: %s\n", directory.c_str(), strerror(errno));
+        return "";
+    }
+
+    // FNV-1a, which is stable across builds, unlike std::hash
+    uint64_t hash = 14695981039346656037ull;
+    for (char character : input)
+    {
+        hash ^= static_cast<unsigned char>(character);
+        hash *= 1099511628211ull;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+
+    std::string path = directory + "/" + prefix + "-" + name;
+    std::ofstream file(path, std::ios::binary);
+    file << input;
+    if (!file)
+    {
+        fprintf(stderr, "ERROR: cannot write %s\n", path.c_str());
+        return "";
+    }
+    return path;
+}
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <functional>
+
+#include "instrumentation.h"
+
+
+std::atomic<bool> instrumentation_enabled(false);
+
+
+// A completed phase scope, kept for the Chrome trace dump.
+struct TraceEvent {
+    Phase phase;
+    std::string detail;
+    uint64_t start_us;
+    uint64_t duration_us;
+    uint64_t thread_id;
+};
+
+
+static std::atomic<uint64_t> counters[counter_count];
+static std::atomic<uint64_t> phase_nanoseconds[phase_count];
+
+// Per-function timings and trace events are only touched when a detailed
+// timer finishes, so a plain mutex is enough here.
+static std::mutex events_mutex;
+static std::vector<FunctionTiming> function_timings;
+static std::vector<TraceEvent> trace_events;
+
+// Trace timestamps are relative to when the process started recording.
+static std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+
+static const char *phase_names[phase_count] = {
+    "lex",
+    "parse",
+    "ast",
+    "codegen",
+    "optimize",
+    "jit",
+};
+
+
+static const char *counter_names[counter_count] = {
+    "tokens",
+    "ast_nodes",
+    "bytes_allocated",
+    "shared_ast_nodes",
+};
+
+
+// Escapes a string for embedding in a JSON string literal.
+static std::string escape_json(const std::string &str)
+{
+    std::string escaped("");
+    for (char character : str)
+    {
+        switch (character)
+        {
+            case '"':
+                escaped += "\\\"";
+                break;
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            default:
+                if (static_cast<unsigned char>(character) < 0x20)
+                {
+                    char buffer[8];
+                    snprintf(buffer, sizeof(buffer), "\\u%04x", character);
+                    escaped += buffer;
+                }
+                else
+                    escaped += character;
+        }
+    }
+    return escaped;
+}
+
+
+static uint64_t microseconds_since_epoch(std::chrono::steady_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - trace_epoch).count();
+}
+
+
+void EnableInstrumentation(bool enabled)
+{
+    instrumentation_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+
+void ResetInstrumentation()
+{
+    for (auto &counter : counters)
+        counter.store(0, std::memory_order_relaxed);
+    for (auto &nanoseconds : phase_nanoseconds)
+        nanoseconds.store(0, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(events_mutex);
+    function_timings.clear();
+    trace_events.clear();
+    trace_epoch = std::chrono::steady_clock::now();
+}
+
+
+void AddToCounterSlow(Counter counter, uint64_t amount)
+{
+    counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+
+uint64_t GetCounter(Counter counter)
+{
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+
+double GetPhaseTime(Phase phase)
+{
+    return phase_nanoseconds[phase].load(std::memory_order_relaxed) / 1e9;
+}
+
+
+std::vector<FunctionTiming> GetFunctionCodegenTimes()
+{
+    std::lock_guard<std::mutex> lock(events_mutex);
+    return function_timings;
+}
+
+
+const char *GetPhaseName(Phase phase)
+{
+    return phase_names[phase];
+}
+
+
+const char *GetCounterName(Counter counter)
+{
+    return counter_names[counter];
+}
+
+
+void DumpInstrumentationJSON(std::ostream &output)
+{
+    output << "{\"counters\":{";
+    for (int i = 0; i < counter_count; i++)
+    {
+        if (i > 0)
+            output << ",";
+        output << "\"" << counter_names[i] << "\":" << GetCounter(static_cast<Counter>(i));
+    }
+
+    output << "},\"phases\":{";
+    for (int i = 0; i < phase_count; i++)
+    {
+        if (i > 0)
+            output << ",";
+        output << "\"" << phase_names[i] << "\":" << GetPhaseTime(static_cast<Phase>(i));
+    }
+
+    output << "},\"functions\":[";
+    auto timings = GetFunctionCodegenTimes();
+    for (size_t i = 0; i < timings.size(); i++)
+    {
+        if (i > 0)
+            output << ",";
+        output << "{\"name\":\"" << escape_json(timings[i].name) << "\","
+               << "\"codegen_seconds\":" << timings[i].seconds << "}";
+    }
+    output << "]}";
+}
+
+
+void DumpChromeTrace(std::ostream &output)
+{
+    std::lock_guard<std::mutex> lock(events_mutex);
+
+    output << "{\"traceEvents\":[";
+    for (size_t i = 0; i < trace_events.size(); i++)
+    {
+        const TraceEvent &event = trace_events[i];
+        if (i > 0)
+            output << ",";
+        output << "{\"name\":\"" << phase_names[event.phase] << "\","
+               << "\"cat\":\"kaleidoscope\",\"ph\":\"X\","
+               << "\"ts\":" << event.start_us << ","
+               << "\"dur\":" << event.duration_us << ","
+               << "\"pid\":1,\"tid\":" << event.thread_id << ","
+               << "\"args\":{\"detail\":\"" << escape_json(event.detail) << "\"}}";
+    }
+    output << "],\"displayTimeUnit\":\"ms\"}";
+}
+
+
+void PhaseTimer::stop()
+{
+    auto end = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - this->start);
+    phase_nanoseconds[this->phase].fetch_add(elapsed.count(), std::memory_order_relaxed);
+
+    if (!this->record_event)
+        return;
+
+    TraceEvent event;
+    event.phase = this->phase;
+    event.detail = this->detail;
+    event.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    event.thread_id = std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000;
+
+    std::lock_guard<std::mutex> lock(events_mutex);
+    event.start_us = microseconds_since_epoch(this->start);
+    if (this->phase == phase_codegen)
+        function_timings.push_back({this->detail, elapsed.count() / 1e9});
+    trace_events.push_back(std::move(event));
+}
+
+
+void *CountedAllocation::operator new(std::size_t size)
+{
+    if (IsInstrumentationEnabled())
+    {
+        AddToCounterSlow(counter_ast_nodes, 1);
+        AddToCounterSlow(counter_bytes_allocated, size);
+    }
+    return ::operator new(size);
+}
+
+
+void CountedAllocation::operator delete(void *pointer)
+{
+    ::operator delete(pointer);
+}
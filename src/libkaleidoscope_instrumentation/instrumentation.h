@@ -0,0 +1,142 @@
+#ifndef INSTRUMENTATION_H_
+#define INSTRUMENTATION_H_
+
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Compiler pipeline phases that can be timed.
+enum Phase {
+    phase_lex = 0,
+    phase_parse,
+    phase_ast,
+    phase_codegen,
+    phase_optimize,
+    phase_jit,
+
+    phase_count,
+};
+
+
+// Event counters collected across the pipeline.
+enum Counter {
+    counter_tokens = 0,
+    counter_ast_nodes,
+    counter_bytes_allocated,
+    counter_shared_ast_nodes,
+
+    counter_count,
+};
+
+
+// Time spent generating code for a single function.
+struct FunctionTiming {
+    std::string name;
+    double seconds;
+};
+
+
+// Instrumentation is disabled by default. All the recording entry points
+// below check this flag inline first, so a disabled build only pays for a
+// relaxed load and a branch.
+extern std::atomic<bool> instrumentation_enabled;
+
+
+inline bool IsInstrumentationEnabled()
+{
+    return instrumentation_enabled.load(std::memory_order_relaxed);
+}
+
+
+void EnableInstrumentation(bool enabled);
+void ResetInstrumentation();
+
+
+// Counters
+void AddToCounterSlow(Counter counter, uint64_t amount);
+inline void AddToCounter(Counter counter, uint64_t amount = 1)
+{
+    if (IsInstrumentationEnabled())
+        AddToCounterSlow(counter, amount);
+}
+uint64_t GetCounter(Counter counter);
+
+
+// Phase timings, reported in seconds. Phases nest (parsing pulls tokens from
+// the lexer), so each phase time is inclusive of the phases it calls into.
+double GetPhaseTime(Phase phase);
+std::vector<FunctionTiming> GetFunctionCodegenTimes();
+const char *GetPhaseName(Phase phase);
+const char *GetCounterName(Counter counter);
+
+
+// Dumps every counter, phase time and per-function codegen time as a JSON
+// object.
+void DumpInstrumentationJSON(std::ostream &output);
+
+// Dumps the recorded phase events in the Chrome trace-event format, which
+// can be loaded into chrome://tracing or Perfetto.
+void DumpChromeTrace(std::ostream &output);
+
+
+// Scoped timer that accumulates the time spent in its scope into a phase.
+// When a detail string is given, a trace event is also recorded; for
+// phase_codegen the detail is taken to be the function name and is added to
+// the per-function codegen times. The detail is only copied while
+// instrumentation is enabled, so timers on hot paths cost nothing more when
+// it is not.
+class PhaseTimer
+{
+    Phase phase;
+    bool active;
+    bool record_event;
+    std::string detail;
+    std::chrono::steady_clock::time_point start;
+
+  public:
+    PhaseTimer(Phase phase)
+        : phase(phase), active(IsInstrumentationEnabled()), record_event(false)
+    {
+        if (this->active)
+            this->start = std::chrono::steady_clock::now();
+    }
+    PhaseTimer(Phase phase, const char *detail)
+        : phase(phase), active(IsInstrumentationEnabled()), record_event(true)
+    {
+        if (this->active)
+        {
+            this->detail = detail;
+            this->start = std::chrono::steady_clock::now();
+        }
+    }
+    ~PhaseTimer()
+    {
+        if (this->active)
+            this->stop();
+    }
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+  private:
+    void stop();
+};
+
+
+// Base class for objects whose allocations should be tracked. Counts every
+// heap allocation of a derived class as one AST node, along with its size.
+class CountedAllocation
+{
+  public:
+    static void *operator new(std::size_t size);
+    static void operator delete(void *pointer);
+};
+
+
+#endif  // INSTRUMENTATION_H_
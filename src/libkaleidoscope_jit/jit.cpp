@@ -0,0 +1,251 @@
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutorProcessControl.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include "jit.h"
+#include "libkaleidoscope_instrumentation/instrumentation.h"
+
+
+// Error of the calls on each thread that reached a function which could not
+// be compiled lazily
+static thread_local std::string call_error;
+
+
+// Where calls to a function that could not be compiled lazily end up. The
+// call gets a NaN, so that the code running it carries on to where the
+// error can be reported.
+static double handle_lazy_compile_error()
+{
+    if (call_error.empty())
+        call_error = "called a function that could not be compiled";
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+
+KaleidoscopeJIT::KaleidoscopeJIT(std::unique_ptr<llvm::orc::ExecutionSession> session,
+                                 llvm::orc::JITTargetMachineBuilder machine_builder,
+                                 std::unique_ptr<llvm::TargetMachine> target_machine,
+                                 llvm::DataLayout data_layout,
+                                 std::unique_ptr<llvm::orc::JITCompileCallbackManager> compile_callbacks,
+                                 const JITOptions &options)
+    : session(std::move(session)),
+      data_layout(std::move(data_layout)),
+      mangle(*this->session, this->data_layout),
+      object_layer(*this->session,
+                   []() { return std::make_unique<llvm::SectionMemoryManager>(); }),
+      compile_layer(*this->session, this->object_layer,
+                    std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(machine_builder))),
+      main_dylib(this->session->createBareJITDylib("<main>")),
+      stubs(llvm::orc::createLocalIndirectStubsManagerBuilder(
+          this->session->getExecutorProcessControl().getTargetTriple())()),
+      compile_callbacks(std::move(compile_callbacks)),
+      target_machine(std::move(target_machine))
+{
+    // Loaded before the process symbols are searched, so vectorized math
+    // calls resolve like the scalar ones
+    this->vector_library = !llvm::sys::DynamicLibrary::LoadLibraryPermanently("libmvec.so.1");
+
+    // Resolve externs against the symbols of the host process
+    this->main_dylib.addGenerator(
+        llvm::cantFail(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            this->data_layout.getGlobalPrefix())));
+
+    if (options.perf_map)
+    {
+        this->perf_map_listener = std::make_unique<PerfMapListener>();
+        this->object_layer.registerJITEventListener(*this->perf_map_listener);
+    }
+    if (options.jitdump)
+    {
+        // Only available when LLVM was built with perf support
+        if (auto listener = llvm::JITEventListener::createPerfJITEventListener())
+            this->object_layer.registerJITEventListener(*listener);
+        else
+            fprintf(stderr, "ERROR: jitdump is not supported by this LLVM build\n");
+    }
+    if (options.gdb)
+        this->object_layer.registerJITEventListener(
+            *llvm::JITEventListener::createGDBRegistrationListener());
+}
+
+
+KaleidoscopeJIT::~KaleidoscopeJIT()
+{
+    if (auto error = this->session->endSession())
+        this->session->reportError(std::move(error));
+}
+
+
+llvm::Expected<std::unique_ptr<KaleidoscopeJIT>> KaleidoscopeJIT::Create(const JITOptions &options)
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    auto process_control = llvm::orc::SelfExecutorProcessControl::Create();
+    if (!process_control)
+        return process_control.takeError();
+
+    auto session = std::make_unique<llvm::orc::ExecutionSession>(std::move(*process_control));
+
+    // Target the host CPU, so that the vectorizer can use all of its
+    // vector registers
+    auto machine_builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!machine_builder)
+        return machine_builder.takeError();
+
+    auto data_layout = machine_builder->getDefaultDataLayoutForTarget();
+    if (!data_layout)
+        return data_layout.takeError();
+
+    auto target_machine = machine_builder->createTargetMachine();
+    if (!target_machine)
+        return target_machine.takeError();
+
+    auto compile_callbacks = llvm::orc::createLocalCompileCallbackManager(
+        session->getExecutorProcessControl().getTargetTriple(), *session,
+        llvm::pointerToJITTargetAddress(&handle_lazy_compile_error));
+    if (!compile_callbacks)
+        return compile_callbacks.takeError();
+
+    return std::make_unique<KaleidoscopeJIT>(std::move(session), std::move(*machine_builder),
+                                             std::move(*target_machine),
+                                             std::move(*data_layout),
+                                             std::move(*compile_callbacks), options);
+}
+
+
+const llvm::DataLayout &KaleidoscopeJIT::get_data_layout()
+{
+    return this->data_layout;
+}
+
+
+llvm::orc::JITDylib &KaleidoscopeJIT::get_main_dylib()
+{
+    return this->main_dylib;
+}
+
+
+llvm::TargetMachine &KaleidoscopeJIT::get_target_machine()
+{
+    return *this->target_machine;
+}
+
+
+bool KaleidoscopeJIT::has_vector_library()
+{
+    return this->vector_library;
+}
+
+
+llvm::Error KaleidoscopeJIT::AddModule(llvm::orc::ThreadSafeModule module,
+                                       llvm::orc::ResourceTrackerSP tracker)
+{
+    if (!tracker)
+        tracker = this->main_dylib.getDefaultResourceTracker();
+    return this->compile_layer.add(tracker, std::move(module));
+}
+
+
+llvm::Expected<llvm::JITEvaluatedSymbol> KaleidoscopeJIT::Lookup(const std::string &name)
+{
+    return this->session->lookup({&this->main_dylib}, this->mangle(name));
+}
+
+
+llvm::Expected<uint64_t> KaleidoscopeJIT::PublishFunction(const std::string &name,
+                                                          const std::string &symbol_name,
+                                                          uint64_t address)
+{
+    std::lock_guard<std::mutex> lock(this->stubs_mutex);
+    return this->point_stub(name, symbol_name, address);
+}
+
+
+llvm::Expected<uint64_t> KaleidoscopeJIT::PublishLazyFunction(const std::string &name,
+                                                              const std::string &symbol_name)
+{
+    // Runs on the thread of the first call. Calls racing it wait for the
+    // same compilation.
+    auto compile = [this, name, symbol_name]() -> llvm::JITTargetAddress {
+        PhaseTimer timer(phase_jit, symbol_name.c_str());
+        auto symbol = this->Lookup(symbol_name);
+        if (!symbol)
+        {
+            // Later calls skip the compile callback and fail right away
+            call_error = "cannot compile " + name + ": " + llvm::toString(symbol.takeError());
+            uint64_t handler = llvm::pointerToJITTargetAddress(&handle_lazy_compile_error);
+            std::lock_guard<std::mutex> lock(this->stubs_mutex);
+            if (this->stub_symbols[name] == symbol_name)
+            {
+                if (auto error = this->stubs->updatePointer(name, handler))
+                    this->session->reportError(std::move(error));
+            }
+            return handler;
+        }
+
+        // The call goes on to this version either way, like calls that were
+        // in flight when a function is redefined
+        std::lock_guard<std::mutex> lock(this->stubs_mutex);
+        if (this->stub_symbols[name] == symbol_name)
+        {
+            if (auto error = this->stubs->updatePointer(name, symbol->getAddress()))
+                this->session->reportError(std::move(error));
+        }
+        return symbol->getAddress();
+    };
+
+    auto trampoline = this->compile_callbacks->getCompileCallback(std::move(compile));
+    if (!trampoline)
+        return trampoline.takeError();
+
+    std::lock_guard<std::mutex> lock(this->stubs_mutex);
+    return this->point_stub(name, symbol_name, *trampoline);
+}
+
+
+std::string KaleidoscopeJIT::TakeCallError()
+{
+    std::string error;
+    error.swap(call_error);
+    return error;
+}
+
+
+// Must be called with the stubs mutex held.
+llvm::Expected<uint64_t> KaleidoscopeJIT::point_stub(const std::string &name,
+                                                     const std::string &symbol_name,
+                                                     uint64_t address)
+{
+    this->stub_symbols[name] = symbol_name;
+
+    // Redefinitions only swap the stub pointer
+    if (auto stub = this->stubs->findStub(name, true))
+    {
+        if (auto error = this->stubs->updatePointer(name, address))
+            return std::move(error);
+        return stub.getAddress();
+    }
+
+    auto flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+    if (auto error = this->stubs->createStub(name, address, flags))
+        return std::move(error);
+
+    // A host function of the same name, resolved for an earlier call, makes
+    // way for the definition. Callers already linked against it keep it.
+    llvm::consumeError(this->main_dylib.remove({this->mangle(name)}));
+
+    uint64_t stub_address = this->stubs->findStub(name, true).getAddress();
+    llvm::orc::SymbolMap symbols;
+    symbols[this->mangle(name)] = llvm::JITEvaluatedSymbol(stub_address, flags);
+    if (auto error = this->main_dylib.define(llvm::orc::absoluteSymbols(std::move(symbols))))
+        return std::move(error);
+
+    return stub_address;
+}
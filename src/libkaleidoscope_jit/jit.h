@@ -0,0 +1,116 @@
+#ifndef JIT_H_
+#define JIT_H_
+
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <llvm/ExecutionEngine/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/Mangling.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "perfmap.h"
+
+
+// Options for JIT compilation. All of these are off by default.
+struct JITOptions {
+    // Compile each definition as soon as it is handed to the JIT, instead of
+    // on its first call, so that its IR is released right away and memory
+    // stays bounded by the largest function rather than by the size of the
+    // input.
+    bool streaming = false;
+
+    // Append an entry per function to /tmp/perf-<pid>.map
+    bool perf_map = false;
+    // Write jitdump records, with line info, for `perf inject --jit`
+    bool jitdump = false;
+    // Register loaded objects with the GDB JIT interface
+    bool gdb = false;
+};
+
+
+// Compiles modules to native code in the current process. Based on the
+// KaleidoscopeJIT from the LLVM tutorial, with the object layer exposed to
+// profiler and debugger event listeners.
+//
+// Functions are published through indirect stubs: the public symbol of a
+// function is a stub that jumps through a pointer to its current
+// implementation, so it can be redefined while other threads call it. A
+// function published lazily starts out pointing at a compile callback, which
+// compiles it on its first call and then points the stub at the code. If it
+// cannot be compiled, calls to it return NaN instead, and leave an error for
+// TakeCallError.
+class KaleidoscopeJIT
+{
+    std::unique_ptr<llvm::orc::ExecutionSession> session;
+    llvm::DataLayout data_layout;
+    llvm::orc::MangleAndInterner mangle;
+    llvm::orc::RTDyldObjectLinkingLayer object_layer;
+    llvm::orc::IRCompileLayer compile_layer;
+    llvm::orc::JITDylib &main_dylib;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+    std::unique_ptr<llvm::orc::JITCompileCallbackManager> compile_callbacks;
+    // Symbol each stub was last published for, so that a lazily compiled
+    // version only takes over its stub if it was not redefined meanwhile
+    std::mutex stubs_mutex;
+    std::map<std::string, std::string> stub_symbols;
+    std::unique_ptr<PerfMapListener> perf_map_listener;
+    std::unique_ptr<llvm::TargetMachine> target_machine;
+    bool vector_library;
+
+  public:
+    KaleidoscopeJIT(std::unique_ptr<llvm::orc::ExecutionSession> session,
+                    llvm::orc::JITTargetMachineBuilder machine_builder,
+                    std::unique_ptr<llvm::TargetMachine> target_machine,
+                    llvm::DataLayout data_layout,
+                    std::unique_ptr<llvm::orc::JITCompileCallbackManager> compile_callbacks,
+                    const JITOptions &options);
+    ~KaleidoscopeJIT();
+
+    static llvm::Expected<std::unique_ptr<KaleidoscopeJIT>> Create(const JITOptions &options);
+
+    const llvm::DataLayout &get_data_layout();
+    llvm::orc::JITDylib &get_main_dylib();
+
+    // Machine code is generated for the host CPU, and modules can be
+    // optimized with its cost model before they are added.
+    llvm::TargetMachine &get_target_machine();
+    // Whether the glibc vector math library (libmvec) could be loaded, so
+    // that vectorized math calls can be resolved.
+    bool has_vector_library();
+
+    llvm::Error AddModule(llvm::orc::ThreadSafeModule module,
+                          llvm::orc::ResourceTrackerSP tracker = nullptr);
+    llvm::Expected<llvm::JITEvaluatedSymbol> Lookup(const std::string &name);
+
+    // Points the public symbol `name` at the code at `address`, compiled for
+    // `symbol_name`, creating its stub the first time. Returns the address of
+    // the stub, which stays the same across redefinitions.
+    llvm::Expected<uint64_t> PublishFunction(const std::string &name,
+                                             const std::string &symbol_name,
+                                             uint64_t address);
+    // Publishes `symbol_name` under `name` like PublishFunction, but only
+    // compiles it when it is first called through the stub.
+    llvm::Expected<uint64_t> PublishLazyFunction(const std::string &name,
+                                                 const std::string &symbol_name);
+
+    // Returns the error left by the calls on this thread that reached a
+    // function which could not be compiled, and clears it. Empty if there
+    // was none.
+    static std::string TakeCallError();
+
+  private:
+    llvm::Expected<uint64_t> point_stub(const std::string &name, const std::string &symbol_name,
+                                        uint64_t address);
+};
+
+
+#endif  // JIT_H_
@@ -0,0 +1,74 @@
+#include <inttypes.h>
+#include <unistd.h>
+#include <llvm/Object/SymbolSize.h>
+
+#include "perfmap.h"
+
+
+PerfMapListener::PerfMapListener()
+{
+    this->file = fopen(GetPath().c_str(), "a");
+    if (!this->file)
+        fprintf(stderr, "ERROR: could not open %s for writing\n", GetPath().c_str());
+}
+
+
+PerfMapListener::~PerfMapListener()
+{
+    if (this->file)
+        fclose(this->file);
+}
+
+
+std::string PerfMapListener::GetPath()
+{
+    return "/tmp/perf-" + std::to_string(getpid()) + ".map";
+}
+
+
+void PerfMapListener::notifyObjectLoaded(ObjectKey key,
+                                         const llvm::object::ObjectFile &object,
+                                         const llvm::RuntimeDyld::LoadedObjectInfo &info)
+{
+    if (!this->file)
+        return;
+
+    // The debug object has its sections relocated to where they were loaded,
+    // so symbol addresses are the real addresses of the code.
+    llvm::object::OwningBinary<llvm::object::ObjectFile> debug_object =
+        info.getObjectForDebug(object);
+    if (!debug_object.getBinary())
+        return;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (const auto &symbol_and_size : llvm::object::computeSymbolSizes(*debug_object.getBinary()))
+    {
+        const llvm::object::SymbolRef &symbol = symbol_and_size.first;
+
+        auto type = symbol.getType();
+        if (!type)
+        {
+            llvm::consumeError(type.takeError());
+            continue;
+        }
+        if (*type != llvm::object::SymbolRef::ST_Function)
+            continue;
+
+        auto name = symbol.getName();
+        auto address = symbol.getAddress();
+        if (!name || !address)
+        {
+            if (!name)
+                llvm::consumeError(name.takeError());
+            if (!address)
+                llvm::consumeError(address.takeError());
+            continue;
+        }
+
+        // Kaleidoscope names have no dots, so the first one starts the version
+        llvm::StringRef function_name = name->split('.').first;
+        fprintf(this->file, "%" PRIx64 " %" PRIx64 " %s\n",
+                *address, symbol_and_size.second, function_name.str().c_str());
+    }
+    fflush(this->file);
+}
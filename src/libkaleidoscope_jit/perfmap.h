@@ -0,0 +1,32 @@
+#ifndef PERFMAP_H_
+#define PERFMAP_H_
+
+
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+
+
+// Writes an entry to /tmp/perf-<pid>.map for every function in each object
+// loaded by the JIT, so that perf can name samples that land in JIT code.
+// Versions of a function, compiled under `name.N`, are all written under the
+// name of the function, so that their samples add up.
+class PerfMapListener : public llvm::JITEventListener
+{
+    std::mutex mutex;
+    FILE *file;
+
+  public:
+    PerfMapListener();
+    ~PerfMapListener();
+
+    void notifyObjectLoaded(ObjectKey key,
+                            const llvm::object::ObjectFile &object,
+                            const llvm::RuntimeDyld::LoadedObjectInfo &info) override;
+
+    static std::string GetPath();
+};
+
+
+#endif  // PERFMAP_H_
@@ -0,0 +1,1017 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Pass.h>
+#include <llvm/Transforms/InstCombine/InstCombine.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Scalar/GVN.h>
+#include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Vectorize.h>
+
+#include "session.h"
+#include "libkaleidoscope_instrumentation/instrumentation.h"
+
+
+// Prefix of the names given to the functions wrapping top-level expressions
+static const char *anonymous_expression_name = "__anon_expr";
+// Prefix of the names given to the entry points of expression batches
+static const char *anonymous_batch_name = "__anon_batch";
+
+
+// Hands the items of one input to the session, collecting consecutive
+// top-level expressions into batches, and their values and errors into the
+// result of the run, if any.
+class JITSession::RunHandler : public TopLevelHandler
+{
+    JITSession &session;
+    size_t batch_size;
+    RunResult *result;
+    std::vector<std::unique_ptr<FunctionAST>> pending;
+
+  public:
+    RunHandler(JITSession &session, size_t batch_size, RunResult *result)
+        : session(session), batch_size(batch_size), result(result) {}
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        this->Flush();
+        this->session.define(std::move(function), this->result);
+    }
+
+    void HandleExtern(std::unique_ptr<PrototypeAST> prototype) override
+    {
+        this->Flush();
+        this->session.declare(std::move(prototype), this->result);
+    }
+
+    void HandleTopLevelExpression(std::unique_ptr<FunctionAST> function) override
+    {
+        if (this->batch_size <= 1)
+        {
+            this->session.evaluate(std::move(function), this->result);
+            return;
+        }
+        this->pending.push_back(std::move(function));
+        if (this->pending.size() >= this->batch_size)
+            this->Flush();
+    }
+
+    void Flush()
+    {
+        if (this->pending.empty())
+            return;
+        this->session.evaluate_batch(std::move(this->pending), this->result);
+        this->pending.clear();
+    }
+};
+
+
+// Sends the errors found while compiling for a run to its result, for as
+// long as the compile mutex is held.
+class RunDiagnosticsScope
+{
+    DiagnosticBuffer *&target;
+
+  public:
+    RunDiagnosticsScope(DiagnosticBuffer *&target, RunResult *result) : target(target)
+    {
+        this->target = result ? &result->diagnostics : nullptr;
+    }
+    ~RunDiagnosticsScope()
+    {
+        this->target = nullptr;
+    }
+};
+
+
+static void log_error(llvm::Error error)
+{
+    fprintf(stderr, "ERROR: %s\n", llvm::toString(std::move(error)).c_str());
+}
+
+
+std::unique_ptr<JITSession> JITSession::Create(const JITOptions &options)
+{
+    auto jit = KaleidoscopeJIT::Create(options);
+    if (!jit)
+    {
+        log_error(jit.takeError());
+        return nullptr;
+    }
+    return std::make_unique<JITSession>(std::move(*jit), options.streaming);
+}
+
+
+JITSession::~JITSession()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->background_mutex);
+        this->background_stopping = true;
+    }
+    this->background_changed.notify_all();
+    if (this->background_thread.joinable())
+        this->background_thread.join();
+    if (this->profiler_thread.joinable())
+        this->profiler_thread.join();
+}
+
+
+void JITSession::SetSource(const std::string &filename, const std::string &source)
+{
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    this->filename = filename;
+    this->lines = std::make_unique<LineTable>(source);
+}
+
+
+void JITSession::ClearSource()
+{
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    this->filename.clear();
+    this->lines.reset();
+}
+
+
+void JITSession::SetResultHandler(std::function<void(double)> handler)
+{
+    this->result_handler = handler;
+}
+
+
+void JITSession::SetHashConsing(bool enabled)
+{
+    this->hash_consing = enabled;
+}
+
+
+void JITSession::SetUpdateHandler(std::function<void(const UpdateReport &)> handler)
+{
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    this->update_handler = handler;
+}
+
+
+void JITSession::SetBatchSize(size_t size)
+{
+    this->batch_size = size;
+}
+
+
+void JITSession::Run(std::istream &input)
+{
+    Parser parser(input);
+    if (this->hash_consing)
+        parser.EnableHashConsing();
+
+    RunHandler handler(*this, this->batch_size, nullptr);
+    parser.Driver(handler);
+    handler.Flush();
+
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    parser.get_diagnostics().Print(stderr, this->lines.get());
+}
+
+
+void JITSession::Run(std::istream &input, RunResult &result)
+{
+    Parser parser(input);
+    if (this->hash_consing)
+        parser.EnableHashConsing();
+
+    RunHandler handler(*this, this->batch_size, &result);
+    parser.Driver(handler);
+    handler.Flush();
+
+    // Parse errors were found before the compile errors of later items
+    for (const Diagnostic &diagnostic : parser.get_diagnostics().get_diagnostics())
+        result.diagnostics.Report(diagnostic.range, diagnostic.message);
+    result.diagnostics.Sort();
+}
+
+
+void JITSession::RunInBackground(const std::string &source)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->background_mutex);
+        this->background_sources.push_back(source);
+        if (!this->background_thread.joinable())
+            this->background_thread = std::thread([this]() { this->run_background(); });
+    }
+    this->background_changed.notify_all();
+}
+
+
+void JITSession::WaitForBackground()
+{
+    std::unique_lock<std::mutex> lock(this->background_mutex);
+    this->background_changed.wait(lock, [this]() {
+        return this->background_sources.empty() && !this->background_busy;
+    });
+}
+
+
+void JITSession::run_background()
+{
+    std::unique_lock<std::mutex> lock(this->background_mutex);
+    while (1)
+    {
+        this->background_changed.wait(lock, [this]() {
+            return this->background_stopping || !this->background_sources.empty();
+        });
+        if (this->background_sources.empty())
+            return;
+
+        std::istringstream input(this->background_sources.front());
+        this->background_sources.pop_front();
+        this->background_busy = true;
+        lock.unlock();
+
+        this->Run(input);
+
+        lock.lock();
+        this->background_busy = false;
+        this->background_changed.notify_all();
+    }
+}
+
+
+void JITSession::EnableTiering(const TieringOptions &options)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->compile_mutex);
+        this->tiering = true;
+        this->tiering_options = options;
+    }
+
+    std::lock_guard<std::mutex> lock(this->background_mutex);
+    if (options.window_ms && !this->profiler_thread.joinable())
+        this->profiler_thread = std::thread([this]() { this->run_profiler(); });
+}
+
+
+void JITSession::run_profiler()
+{
+    while (1)
+    {
+        // The options are guarded by the compile mutex, and may change
+        // between windows
+        std::chrono::milliseconds window;
+        {
+            std::lock_guard<std::mutex> lock(this->compile_mutex);
+            window = std::chrono::milliseconds(this->tiering_options.window_ms);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(this->background_mutex);
+            if (this->background_changed.wait_for(lock, window,
+                                                  [this]() { return this->background_stopping; }))
+                return;
+        }
+
+        this->RecompileHotFunctions();
+    }
+}
+
+
+size_t JITSession::RecompileHotFunctions()
+{
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+
+    size_t recompiled = 0;
+    for (auto &entry : this->tiered_functions)
+    {
+        TieredFunction &tiered = entry.second;
+        if (tiered.optimized
+            || tiered.counters->calls.load(std::memory_order_relaxed) < this->tiering_options.hot_calls)
+            continue;
+
+        tiered.profile = FunctionProfile::FromCounters(*tiered.counters);
+        if (this->compile_tier(entry.first, tiered, true))
+            recompiled++;
+    }
+    return recompiled;
+}
+
+
+bool JITSession::IsOptimized(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    auto tiered = this->tiered_functions.find(name);
+    return tiered != this->tiered_functions.end() && tiered->second.optimized;
+}
+
+
+bool JITSession::SaveProfile(const std::string &path)
+{
+    ProfileTable profiles;
+    {
+        std::lock_guard<std::mutex> lock(this->compile_mutex);
+        profiles = this->loaded_profiles;
+        for (auto &entry : this->tiered_functions)
+        {
+            const TieredFunction &tiered = entry.second;
+            profiles[entry.first] = tiered.optimized
+                ? tiered.profile : FunctionProfile::FromCounters(*tiered.counters);
+        }
+    }
+
+    std::ofstream output(path);
+    WriteProfiles(output, profiles);
+    output.close();
+    if (!output)
+    {
+        fprintf(stderr, "ERROR: could not write profile to %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+bool JITSession::LoadProfile(const std::string &path)
+{
+    std::ifstream input(path);
+    if (!input)
+    {
+        fprintf(stderr, "ERROR: could not read profile from %s\n", path.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    if (!ReadProfiles(input, this->loaded_profiles))
+    {
+        fprintf(stderr, "ERROR: malformed profile in %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+std::unique_ptr<llvm::Module> JITSession::create_module(llvm::LLVMContext &context)
+{
+    auto module = std::make_unique<llvm::Module>("kaleidoscope", context);
+    module->setDataLayout(this->jit->get_data_layout());
+    module->setTargetTriple(this->jit->get_target_machine().getTargetTriple().str());
+    return module;
+}
+
+
+// Applies the math settings of the session to a new codegen context. Must
+// be called with the compile mutex held.
+void JITSession::configure_codegen(CodegenContext &codegen_context)
+{
+    codegen_context.math_externs = &this->math_externs;
+    codegen_context.diagnostics = this->run_diagnostics;
+    if (this->fast_math)
+        codegen_context.EnableFastMath();
+}
+
+
+// Reports an error of the input being compiled, into the result of its
+// run if it has one. Must be called with the compile mutex held.
+void JITSession::report_error(SourceOffset location, const std::string &message)
+{
+    if (this->run_diagnostics)
+        this->run_diagnostics->Report({location, location}, message);
+    else
+        fprintf(stderr, "ERROR: %s\n", message.c_str());
+}
+
+
+// Lowers a single function into a fresh module, named with the given
+// symbol name. Returns an empty module if code generation failed. Must be
+// called with the compile mutex held.
+//
+// With counters, the function is instrumented. With a profile, it is
+// optimized for that profile instead, along with the session functions it
+// calls, which are recorded in inlined.
+llvm::orc::ThreadSafeModule JITSession::compile_function(FunctionAST &function,
+                                                         const std::string &symbol_name,
+                                                         ProfileCounters *counters,
+                                                         const FunctionProfile *profile,
+                                                         std::set<std::string> *inlined)
+{
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = this->create_module(*context);
+
+    {
+        CodegenContext codegen_context(*module, this->prototypes);
+        this->configure_codegen(codegen_context);
+        codegen_context.profile_counters = counters;
+        codegen_context.profile = profile;
+
+        // The source of a recompiled function may have been replaced since
+        if (this->lines && !profile)
+            codegen_context.EnableDebugInfo(this->filename, *this->lines);
+
+        llvm::Function *compiled = function.codegen(codegen_context);
+        if (!compiled)
+            return llvm::orc::ThreadSafeModule();
+        if (inlined)
+            this->lower_callees(codegen_context, *inlined);
+        if (compiled->getName() != symbol_name)
+            compiled->setName(symbol_name);
+
+        codegen_context.FinalizeDebugInfo();
+    }
+
+    this->optimize_module(*module, profile != nullptr);
+    return llvm::orc::ThreadSafeModule(std::move(module), std::move(context));
+}
+
+
+// Lowers the session functions called from the module into it as private
+// copies, so that they can be inlined. Their own callees stay calls through
+// the stubs.
+void JITSession::lower_callees(CodegenContext &codegen_context, std::set<std::string> &inlined)
+{
+    std::vector<llvm::Function *> declarations;
+    for (auto &declared : codegen_context.module)
+    {
+        if (declared.isDeclaration())
+            declarations.push_back(&declared);
+    }
+
+    for (llvm::Function *declaration : declarations)
+    {
+        std::string callee(declaration->getName());
+        auto tiered = this->tiered_functions.find(callee);
+        if (tiered == this->tiered_functions.end()
+            || tiered->second.function->get_prototype()->get_args().size()
+                != declaration->arg_size())
+            continue;
+
+        // Callees are optimized for their own profile
+        FunctionProfile profile = tiered->second.optimized
+            ? tiered->second.profile : FunctionProfile::FromCounters(*tiered->second.counters);
+        codegen_context.profile_counters = nullptr;
+        codegen_context.profile = &profile;
+        llvm::Function *lowered = tiered->second.function->codegen(codegen_context);
+        codegen_context.profile = nullptr;
+        if (!lowered)
+            continue;
+
+        lowered->setLinkage(llvm::Function::InternalLinkage);
+        inlined.insert(callee);
+    }
+}
+
+
+// Runs the standard per-function cleanup passes over the module, followed
+// by the vectorizer, which can widen independent math, including calls to
+// math intrinsics. Optimized tiers also get the inliner first, with a raised
+// threshold.
+void JITSession::optimize_module(llvm::Module &module, bool aggressive)
+{
+    PhaseTimer timer(phase_optimize);
+
+    // Widened math calls go to libmvec when it is available
+    llvm::Triple triple(module.getTargetTriple());
+    llvm::TargetLibraryInfoImpl library_info(triple);
+    if (this->jit->has_vector_library() && triple.getArch() == llvm::Triple::x86_64)
+        library_info.addVectorizableFunctionsFromVecLib(llvm::TargetLibraryInfoImpl::LIBMVEC_X86);
+
+    // User definitions shadow the library functions of the same name, which
+    // must then neither be folded nor lowered to instructions
+    for (auto &function : module)
+    {
+        if (function.isDeclaration() && this->functions.Lookup(function.getName().str()))
+            function.addFnAttr(llvm::Attribute::NoBuiltin);
+    }
+    llvm::TargetMachine &target_machine = this->jit->get_target_machine();
+
+    auto add_passes = [&](llvm::legacy::PassManagerBase &pass_manager) {
+        pass_manager.add(new llvm::TargetLibraryInfoWrapperPass(library_info));
+        pass_manager.add(llvm::createTargetTransformInfoWrapperPass(
+            target_machine.getTargetIRAnalysis()));
+        if (aggressive)
+            pass_manager.add(llvm::createFunctionInliningPass(
+                this->tiering_options.inline_threshold));
+        pass_manager.add(llvm::createInstructionCombiningPass());
+        pass_manager.add(llvm::createReassociatePass());
+        pass_manager.add(llvm::createGVNPass());
+        pass_manager.add(llvm::createCFGSimplificationPass());
+        pass_manager.add(llvm::createInjectTLIMappingsLegacyPass());
+        pass_manager.add(llvm::createSLPVectorizerPass());
+        pass_manager.add(llvm::createInstructionCombiningPass());
+    };
+
+    if (aggressive)
+    {
+        llvm::legacy::PassManager pass_manager;
+        add_passes(pass_manager);
+        pass_manager.run(module);
+        return;
+    }
+
+    llvm::legacy::FunctionPassManager pass_manager(&module);
+    add_passes(pass_manager);
+    pass_manager.doInitialization();
+
+    for (auto &function : module)
+        pass_manager.run(function);
+}
+
+
+// Adds the compiled module to the JIT and points the stub of the function
+// at it. Must be called with the compile mutex held.
+bool JITSession::publish_function(const std::string &name, const std::string &symbol_name,
+                                  llvm::orc::ThreadSafeModule module)
+{
+    if (auto error = this->jit->AddModule(std::move(module)))
+    {
+        log_error(std::move(error));
+        return false;
+    }
+
+    // When streaming, materialize right away, so the JIT compiles and drops
+    // the IR module instead of holding on to it until the first call
+    llvm::Expected<uint64_t> stub(0);
+    if (this->streaming)
+    {
+        uint64_t address;
+        {
+            PhaseTimer timer(phase_jit, symbol_name.c_str());
+            auto symbol = this->jit->Lookup(symbol_name);
+            if (!symbol)
+            {
+                log_error(symbol.takeError());
+                return false;
+            }
+            address = symbol->getAddress();
+        }
+        stub = this->jit->PublishFunction(name, symbol_name, address);
+    }
+    else
+        stub = this->jit->PublishLazyFunction(name, symbol_name);
+    if (!stub)
+    {
+        log_error(stub.takeError());
+        return false;
+    }
+    if (!this->functions.Lookup(name))
+        this->functions.Insert(name, *stub);
+    return true;
+}
+
+
+// Compiles and publishes a new version of a tiered function, either
+// instrumented with fresh counters or optimized for its profile.
+bool JITSession::compile_tier(const std::string &name, TieredFunction &tiered, bool optimized)
+{
+    std::string symbol_name = name + "." + std::to_string(++this->versions[name]);
+
+    ProfileCounters *counters = nullptr;
+    std::set<std::string> inlined;
+    llvm::orc::ThreadSafeModule module;
+    if (optimized)
+        module = this->compile_function(*tiered.function, symbol_name, nullptr,
+                                        &tiered.profile, &inlined);
+    else
+    {
+        this->profile_counters.push_back(std::make_unique<ProfileCounters>());
+        counters = this->profile_counters.back().get();
+        module = this->compile_function(*tiered.function, symbol_name, counters);
+    }
+    if (!module || !this->publish_function(name, symbol_name, std::move(module)))
+        return false;
+
+    tiered.counters = counters;
+    tiered.inlined = std::move(inlined);
+    tiered.optimized = optimized;
+    return true;
+}
+
+
+void JITSession::HandleDefinition(std::unique_ptr<FunctionAST> function)
+{
+    this->define(std::move(function), nullptr);
+}
+
+
+void JITSession::define(std::unique_ptr<FunctionAST> function, RunResult *result)
+{
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    RunDiagnosticsScope diagnostics(this->run_diagnostics, result);
+    std::string name = function->get_prototype()->get_name();
+    SourceOffset location = function->get_prototype()->get_location();
+
+    // Existing callers were compiled against the old signature
+    auto existing = this->prototypes.find(name);
+    if (existing != this->prototypes.end() && this->functions.Lookup(name)
+        && existing->second.size() != function->get_prototype()->get_args().size())
+    {
+        this->report_error(location, "cannot redefine " + name
+                                         + " with a different number of arguments");
+        return;
+    }
+
+    UpdateReport report;
+    report.name = name;
+
+    // Reloading a definition that did not change keeps its machine code.
+    // Fast-math changes the code generated, so it counts as a change.
+    // Fingerprints can collide, so equal ones are confirmed by comparing
+    // the structure of the definitions.
+    uint64_t fingerprint = function->get_fingerprint() * 2 + this->fast_math;
+    std::string structure = function->get_structure();
+    auto compiled = this->compiled_functions.find(name);
+    if (compiled != this->compiled_functions.end()
+        && compiled->second.fingerprint == fingerprint
+        && compiled->second.tiered == this->tiering
+        && compiled->second.structure == structure)
+    {
+        report.unchanged = true;
+        this->report_update(report);
+        return;
+    }
+
+    // Definitions take precedence over the math library, so callers that
+    // lowered calls to the function as an intrinsic are compiled again
+    bool was_intrinsic = this->math_externs.erase(name);
+    std::set<std::string> callees = function->get_callees();
+    size_t reported = result ? result->diagnostics.size() : 0;
+    if (!this->compile_definition(name, std::move(function)))
+    {
+        // Codegen reports what it rejects, the JIT only logs its errors
+        if (result && result->diagnostics.size() == reported)
+            this->report_error(location, "cannot compile " + name);
+        return;
+    }
+    this->compiled_functions[name].fingerprint = fingerprint;
+    this->compiled_functions[name].structure = std::move(structure);
+    this->call_graph.SetCallees(name, callees);
+    report.recompiled.push_back(name);
+
+    // Optimized callers that inlined the previous version would keep using
+    // it, so they go back to the instrumented tier. Other callers go
+    // through the stub and keep their code.
+    std::set<std::string> callers = this->call_graph.get_callers(name);
+    for (const std::string &caller : callers)
+    {
+        if (caller == name)
+            continue;
+        auto tiered = this->tiered_functions.find(caller);
+        bool inlined = tiered != this->tiered_functions.end() && tiered->second.optimized
+            && tiered->second.inlined.count(name);
+        if ((inlined || was_intrinsic) && this->compile_definition(caller, nullptr, inlined))
+            report.recompiled.push_back(caller);
+    }
+    this->report_update(report);
+}
+
+
+// Compiles and publishes a new definition of the function, or its current
+// definition again if none is given, in which case the function can be sent
+// back to the instrumented tier. Records what the compilation took. Must be
+// called with the compile mutex held.
+bool JITSession::compile_definition(const std::string &name,
+                                    std::unique_ptr<FunctionAST> function,
+                                    bool deoptimize)
+{
+    auto start = std::chrono::steady_clock::now();
+    bool again = !function;
+    bool added = !this->compiled_functions.count(name);
+    CompiledFunction &compiled = this->compiled_functions[name];
+    bool tiered = again ? compiled.tiered : this->tiering;
+
+    bool success = false;
+    if (!tiered)
+    {
+        if (again)
+            function = std::move(compiled.function);
+        if (!function)
+            return false;
+
+        // Each definition gets its own symbol, so that versions can coexist
+        std::string symbol_name = name + "." + std::to_string(++this->versions[name]);
+        auto module = this->compile_function(*function, symbol_name);
+        success = module && this->publish_function(name, symbol_name, std::move(module));
+
+        // The AST is no longer needed once lowered, unless calls in it were
+        // lowered to math intrinsics, which a definition may take over
+        std::set<std::string> callees = function->get_callees();
+        bool uses_intrinsics = std::any_of(
+            callees.begin(), callees.end(),
+            [this](const std::string &callee) { return this->math_externs.count(callee); });
+        if (success)
+            compiled.function = uses_intrinsics ? std::move(function) : nullptr;
+        else if (again)
+            compiled.function = std::move(function);
+    }
+    else if (!again)
+    {
+        // Functions with a hot profile from a previous session start optimized
+        TieredFunction tiered_function;
+        size_t arg_count = function->get_prototype()->get_args().size();
+        tiered_function.function = std::move(function);
+        auto loaded = this->loaded_profiles.find(name);
+        bool hot = loaded != this->loaded_profiles.end()
+            && loaded->second.calls >= this->tiering_options.hot_calls
+            && loaded->second.arguments.size() == arg_count;
+        if (hot)
+            tiered_function.profile = loaded->second;
+        success = this->compile_tier(name, tiered_function, hot);
+        if (success)
+            this->tiered_functions[name] = std::move(tiered_function);
+    }
+    else
+    {
+        TieredFunction &tiered_function = this->tiered_functions[name];
+        success = this->compile_tier(name, tiered_function,
+                                     tiered_function.optimized && !deoptimize);
+    }
+
+    if (!success)
+    {
+        if (added)
+            this->compiled_functions.erase(name);
+        return false;
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    this->total_compile_seconds += elapsed.count() - compiled.compile_seconds;
+    compiled.compile_seconds = elapsed.count();
+    compiled.tiered = tiered;
+    return true;
+}
+
+
+// Completes the report of an update with what recompiling every function
+// would have cost, and hands it over. Must be called with the compile mutex
+// held.
+void JITSession::report_update(UpdateReport &report)
+{
+    if (!this->update_handler)
+        return;
+
+    report.kept = this->compiled_functions.size() - report.recompiled.size();
+    report.saved_seconds = this->total_compile_seconds;
+    for (const std::string &name : report.recompiled)
+    {
+        double seconds = this->compiled_functions[name].compile_seconds;
+        report.compile_seconds += seconds;
+        report.saved_seconds -= seconds;
+    }
+    this->update_handler(report);
+}
+
+
+void JITSession::HandleExtern(std::unique_ptr<PrototypeAST> prototype)
+{
+    this->declare(std::move(prototype), nullptr);
+}
+
+
+void JITSession::declare(std::unique_ptr<PrototypeAST> prototype, RunResult *result)
+{
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    RunDiagnosticsScope diagnostics(this->run_diagnostics, result);
+    const std::string &name = prototype->get_name();
+
+    // Like a redefinition, a declaration cannot change the signature callers
+    // of a defined function were compiled against
+    auto existing = this->prototypes.find(name);
+    if (existing != this->prototypes.end() && this->functions.Lookup(name)
+        && existing->second.size() != prototype->get_args().size())
+    {
+        this->report_error(prototype->get_location(), "cannot redefine " + name
+                                                          + " with a different number of arguments");
+        return;
+    }
+
+    this->prototypes[name] = prototype->get_args();
+    if (IsMathIntrinsic(name, prototype->get_args().size()) && !this->functions.Lookup(name))
+        this->math_externs.insert(name);
+    else
+        this->math_externs.erase(name);
+}
+
+
+void JITSession::SetFastMath(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(this->compile_mutex);
+    this->fast_math = enabled;
+}
+
+
+// Adds a module that is run once and then freed again with the tracker,
+// returning the address of its entry point, or 0 if it failed to compile.
+uint64_t JITSession::add_transient_module(llvm::orc::ThreadSafeModule module,
+                                          const std::string &symbol_name,
+                                          llvm::orc::ResourceTrackerSP &tracker)
+{
+    tracker = this->jit->get_main_dylib().createResourceTracker();
+    if (auto error = this->jit->AddModule(std::move(module), tracker))
+    {
+        log_error(std::move(error));
+        return 0;
+    }
+
+    PhaseTimer timer(phase_jit, symbol_name.c_str());
+    auto symbol = this->jit->Lookup(symbol_name);
+    if (!symbol)
+    {
+        log_error(symbol.takeError());
+        return 0;
+    }
+    return symbol->getAddress();
+}
+
+
+// Reports the error left by the code just run, if it called a function
+// that could not be compiled, in which case its values are not to be used.
+static bool report_call_error(SourceOffset location, RunResult *result)
+{
+    std::string error = KaleidoscopeJIT::TakeCallError();
+    if (error.empty())
+        return false;
+    if (result)
+        result->diagnostics.Report({location, location}, error);
+    else
+        fprintf(stderr, "ERROR: %s\n", error.c_str());
+    return true;
+}
+
+
+void JITSession::HandleTopLevelExpression(std::unique_ptr<FunctionAST> function)
+{
+    this->evaluate(std::move(function), nullptr);
+}
+
+
+void JITSession::evaluate(std::unique_ptr<FunctionAST> function, RunResult *result)
+{
+    // Expressions can be evaluated concurrently, so each gets its own name
+    std::string symbol_name = std::string(anonymous_expression_name) + "." + std::to_string(
+        this->expression_count.fetch_add(1, std::memory_order_relaxed));
+    SourceOffset location = function->get_prototype()->get_location();
+
+    llvm::orc::ThreadSafeModule module;
+    {
+        std::lock_guard<std::mutex> lock(this->compile_mutex);
+        RunDiagnosticsScope diagnostics(this->run_diagnostics, result);
+        module = this->compile_function(*function, symbol_name);
+    }
+    if (!module)
+        return;
+    function.reset();
+
+    llvm::orc::ResourceTrackerSP tracker;
+    if (uint64_t address = this->add_transient_module(std::move(module), symbol_name, tracker))
+    {
+        double (*expression)() = reinterpret_cast<double (*)()>(address);
+        KaleidoscopeJIT::TakeCallError();
+        double value = expression();
+        if (!report_call_error(location, result))
+        {
+            if (result)
+                result->values.push_back(value);
+            else if (this->result_handler)
+                this->result_handler(value);
+        }
+    }
+    else if (result)
+        result->diagnostics.Report({location, location}, "cannot evaluate expression");
+
+    if (tracker)
+    {
+        if (auto error = tracker->remove())
+            log_error(std::move(error));
+    }
+}
+
+
+// Lowers every expression into the same module, each as a function of its
+// own, along with an entry point that calls them in order and stores their
+// values into consecutive slots of the results array it is passed. Must be
+// called with the compile mutex held.
+llvm::orc::ThreadSafeModule JITSession::compile_batch(
+    std::vector<std::unique_ptr<FunctionAST>> &expressions,
+    const std::string &symbol_name, size_t &result_count)
+{
+    auto context = std::make_unique<llvm::LLVMContext>();
+    auto module = this->create_module(*context);
+
+    {
+        CodegenContext codegen_context(*module, this->prototypes);
+        this->configure_codegen(codegen_context);
+        if (this->lines)
+            codegen_context.EnableDebugInfo(this->filename, *this->lines);
+
+        std::vector<llvm::Function *> lowered;
+        for (auto &expression : expressions)
+        {
+            llvm::Function *compiled = expression->codegen(codegen_context);
+            if (!compiled)
+                continue;
+            compiled->setName(symbol_name + "." + std::to_string(lowered.size()));
+            compiled->setLinkage(llvm::Function::InternalLinkage);
+            lowered.push_back(compiled);
+        }
+        if (lowered.empty())
+            return llvm::orc::ThreadSafeModule();
+
+        llvm::IRBuilder<> &builder = codegen_context.builder;
+        llvm::Type *double_type = builder.getDoubleTy();
+        llvm::FunctionType *entry_type = llvm::FunctionType::get(
+            builder.getVoidTy(), {llvm::PointerType::getUnqual(double_type)}, false);
+        llvm::Function *entry = llvm::Function::Create(
+            entry_type, llvm::Function::ExternalLinkage, symbol_name, *module);
+        entry->addFnAttr(llvm::Attribute::NoUnwind);
+
+        builder.SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", entry));
+        llvm::Value *results = entry->getArg(0);
+        for (size_t i = 0; i < lowered.size(); i++)
+            builder.CreateStore(builder.CreateCall(lowered[i]),
+                                builder.CreateConstInBoundsGEP1_64(double_type, results, i));
+        builder.CreateRetVoid();
+
+        codegen_context.FinalizeDebugInfo();
+        result_count = lowered.size();
+    }
+
+    this->optimize_module(*module, false);
+    return llvm::orc::ThreadSafeModule(std::move(module), std::move(context));
+}
+
+
+void JITSession::EvaluateBatch(std::vector<std::unique_ptr<FunctionAST>> expressions)
+{
+    this->evaluate_batch(std::move(expressions), nullptr);
+}
+
+
+void JITSession::evaluate_batch(std::vector<std::unique_ptr<FunctionAST>> expressions,
+                                RunResult *result)
+{
+    if (expressions.empty())
+        return;
+
+    std::string symbol_name = std::string(anonymous_batch_name) + "." + std::to_string(
+        this->expression_count.fetch_add(1, std::memory_order_relaxed));
+    SourceOffset location = expressions.front()->get_prototype()->get_location();
+
+    size_t result_count = 0;
+    llvm::orc::ThreadSafeModule module;
+    {
+        std::lock_guard<std::mutex> lock(this->compile_mutex);
+        RunDiagnosticsScope diagnostics(this->run_diagnostics, result);
+        module = this->compile_batch(expressions, symbol_name, result_count);
+    }
+    if (!module)
+        return;
+    expressions.clear();
+
+    llvm::orc::ResourceTrackerSP tracker;
+    if (uint64_t address = this->add_transient_module(std::move(module), symbol_name, tracker))
+    {
+        std::vector<double> values(result_count);
+        void (*batch)(double *) = reinterpret_cast<void (*)(double *)>(address);
+        KaleidoscopeJIT::TakeCallError();
+        batch(values.data());
+        if (!report_call_error(location, result))
+        {
+            if (result)
+                result->values.insert(result->values.end(), values.begin(), values.end());
+            else if (this->result_handler)
+            {
+                for (double value : values)
+                    this->result_handler(value);
+            }
+        }
+    }
+    else if (result)
+        result->diagnostics.Report({location, location}, "cannot evaluate expressions");
+
+    if (tracker)
+    {
+        if (auto error = tracker->remove())
+            log_error(std::move(error));
+    }
+}
+
+
+uint64_t JITSession::GetFunctionAddress(const std::string &name)
+{
+    if (uint64_t address = this->functions.Lookup(name))
+        return address;
+
+    // Not defined in the session, so it may be a symbol of the host
+    PhaseTimer timer(phase_jit, name.c_str());
+    auto symbol = this->jit->Lookup(name);
+    if (!symbol)
+    {
+        log_error(symbol.takeError());
+        return 0;
+    }
+    return symbol->getAddress();
+}
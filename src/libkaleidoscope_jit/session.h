@@ -0,0 +1,279 @@
+#ifndef SESSION_H_
+#define SESSION_H_
+
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "jit.h"
+#include "symbol_table.h"
+#include "libkaleidoscope_lexer/lexer.h"
+#include "libkaleidoscope_parser/ast.h"
+#include "libkaleidoscope_parser/call_graph.h"
+#include "libkaleidoscope_parser/codegen.h"
+#include "libkaleidoscope_parser/diagnostics.h"
+#include "libkaleidoscope_parser/parser.h"
+#include "libkaleidoscope_parser/profile.h"
+
+
+// Settings of the profile-guided tier of a session.
+struct TieringOptions {
+    // Calls after which an instrumented function counts as hot
+    uint64_t hot_calls = 1000;
+    // How often the background thread recompiles the hot functions, or 0 to
+    // only recompile them on RecompileHotFunctions
+    unsigned window_ms = 100;
+    // Inlining threshold of the optimized tier, well above the default 225
+    unsigned inline_threshold = 1000;
+};
+
+
+// What a new definition cost, next to recompiling every function of the
+// session, as reported to the update handler.
+struct UpdateReport {
+    std::string name;
+    // The definition was the same as the current one, so nothing was
+    // compiled
+    bool unchanged = false;
+    // Functions compiled: the definition first, then the callers that had
+    // to be compiled again with it
+    std::vector<std::string> recompiled;
+    // Functions whose machine code was kept
+    size_t kept = 0;
+    double compile_seconds = 0;
+    // What compiling the kept functions took the last time
+    double saved_seconds = 0;
+};
+
+
+// What running one input produced: the value of every top-level expression
+// evaluated, in order, and the errors of the items that could not be parsed
+// or compiled, in source order.
+struct RunResult {
+    std::vector<double> values;
+    DiagnosticBuffer diagnostics;
+};
+
+
+// Compiles and runs top-level items as the parser produces them: each
+// definition goes into its own module in the JIT, and each top-level
+// expression is compiled, evaluated and then removed again.
+//
+// Definitions are lowered as soon as they are handed over and published
+// under their name. Their machine code is generated on their first call, or
+// right away when streaming, so that their IR is released at once. Compiled
+// functions can be looked up and called from any number of threads without
+// locking, while new definitions are compiled, on those threads or in the
+// background. Redefining a function swaps in the new version atomically;
+// calls already running finish on the old version, whose code is kept.
+//
+// With tiering enabled, definitions are first compiled with counters for
+// their calls, argument ranges and branch outcomes. Functions that turn out
+// to be hot are recompiled, in the background, with that profile: branch
+// weights, a copy of the body specialized for arguments that were always
+// the same, and the session functions they call inlined. The profiles can
+// be saved and loaded into another session, whose functions then start out
+// optimized.
+//
+// The session keeps a call graph of its functions, and a fingerprint and
+// a compact encoding of the structure of each definition. Defining a
+// function again as it was keeps its code, so reloading a source only
+// compiles what changed. Callers only have to be compiled again along with
+// a function when they inlined it, or when they lowered calls to it as a
+// math intrinsic before it was defined.
+class JITSession : public TopLevelHandler
+{
+    class RunHandler;
+
+    // A function defined while tiering is enabled. Its AST is kept, so it
+    // can be compiled again.
+    struct TieredFunction {
+        std::unique_ptr<FunctionAST> function;
+        // Counters of the instrumented version, null once optimized
+        ProfileCounters *counters = nullptr;
+        // Profile the optimized version was compiled for
+        FunctionProfile profile;
+        // Functions inlined into the optimized version
+        std::set<std::string> inlined;
+        bool optimized = false;
+    };
+
+    // A function defined in the session.
+    struct CompiledFunction {
+        uint64_t fingerprint = 0;
+        // Structure of the definition, to confirm equal fingerprints with
+        std::string structure;
+        // What its last compilation took
+        double compile_seconds = 0;
+        bool tiered = false;
+        // AST of a function not tiered whose calls were lowered to math
+        // intrinsics, for compiling it again
+        std::unique_ptr<FunctionAST> function;
+    };
+
+    std::unique_ptr<KaleidoscopeJIT> jit;
+    bool streaming;
+
+    // Published functions, by name, for lock-free lookups
+    SymbolTable functions;
+
+    // Compilation state, guarded by the compile mutex
+    std::mutex compile_mutex;
+    PrototypeTable prototypes;
+    std::map<std::string, unsigned> versions;
+    std::string filename;
+    std::unique_ptr<LineTable> lines;
+    std::set<std::string> math_externs;
+    bool fast_math = false;
+    std::map<std::string, CompiledFunction> compiled_functions;
+    CallGraph call_graph;
+    double total_compile_seconds = 0;
+    std::function<void(const UpdateReport &)> update_handler;
+    // Where the errors of the input being compiled go, or null to print them
+    DiagnosticBuffer *run_diagnostics = nullptr;
+
+    // Profile-guided tiering, guarded by the compile mutex. Counters are
+    // kept for as long as the code writing them.
+    bool tiering = false;
+    TieringOptions tiering_options;
+    std::map<std::string, TieredFunction> tiered_functions;
+    std::vector<std::unique_ptr<ProfileCounters>> profile_counters;
+    ProfileTable loaded_profiles;
+
+    std::atomic<uint64_t> expression_count;
+    std::function<void(double)> result_handler;
+    bool hash_consing = false;
+    size_t batch_size = 1;
+
+    // Sources queued with RunInBackground
+    std::mutex background_mutex;
+    std::condition_variable background_changed;
+    std::deque<std::string> background_sources;
+    bool background_busy = false;
+    bool background_stopping = false;
+    std::thread background_thread;
+    std::thread profiler_thread;
+
+  public:
+    JITSession(std::unique_ptr<KaleidoscopeJIT> jit, bool streaming = false)
+        : jit(std::move(jit)), streaming(streaming), expression_count(0) {}
+    ~JITSession();
+
+    // Returns nullptr if the JIT could not be set up for the host.
+    static std::unique_ptr<JITSession> Create(const JITOptions &options = JITOptions());
+
+    // Providing the source text enables debug info, with line tables that
+    // map the generated code back to the given file.
+    void SetSource(const std::string &filename, const std::string &source);
+    // Forgets the source set last, for inputs that come from elsewhere.
+    void ClearSource();
+
+    // Called with the value of every top-level expression evaluated. Must be
+    // set before any items run.
+    void SetResultHandler(std::function<void(double)> handler);
+    // Called with a report of every definition compiled, or found to be
+    // unchanged, from here on.
+    void SetUpdateHandler(std::function<void(const UpdateReport &)> handler);
+
+    // Parses with hash-consing, so that identical subexpressions within an
+    // item are built and compiled only once.
+    void SetHashConsing(bool enabled);
+
+    // Evaluates up to the given number of consecutive top-level expressions
+    // of an input together, compiled into one module with a single entry
+    // point. Pending expressions are evaluated before any definition or
+    // extern that follows them, so results are the same as one at a time.
+    void SetBatchSize(size_t size);
+
+    // Compiles the definitions and expressions that follow with fast-math
+    // flags, so that floating-point math can be reassociated, which lets
+    // sums of math calls be vectorized, at the cost of exact IEEE results.
+    void SetFastMath(bool enabled);
+
+    // Parses and runs every top-level item of the input.
+    void Run(std::istream &input);
+    // Parses and runs every top-level item of the input, collecting its
+    // values and errors into the result instead of handing them to the
+    // result handler and printing them. Inputs can be run this way from any
+    // number of threads at once.
+    void Run(std::istream &input, RunResult &result);
+
+    // Queues the source to be run on the background thread of the session,
+    // in submission order.
+    void RunInBackground(const std::string &source);
+    // Waits until every queued source has been run.
+    void WaitForBackground();
+
+    // Compiles the definitions that follow with profiling counters, and
+    // starts recompiling the hot ones every sampling window.
+    void EnableTiering(const TieringOptions &options = TieringOptions());
+    // Recompiles the instrumented functions that are hot by now with their
+    // profile, returning how many were recompiled.
+    size_t RecompileHotFunctions();
+    bool IsOptimized(const std::string &name);
+
+    // Saves the profile of every function, along with the loaded profiles
+    // of functions not defined in the session. Returns false on failure.
+    bool SaveProfile(const std::string &path);
+    // Loads profiles saved by another session. Functions defined afterwards
+    // whose loaded profile is hot are compiled optimized right away.
+    bool LoadProfile(const std::string &path);
+
+    // Compiles the expressions into one module and evaluates them in one
+    // call, reporting each result in order. Expressions that fail to
+    // compile are skipped.
+    void EvaluateBatch(std::vector<std::unique_ptr<FunctionAST>> expressions);
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override;
+    void HandleExtern(std::unique_ptr<PrototypeAST> prototype) override;
+    void HandleTopLevelExpression(std::unique_ptr<FunctionAST> function) override;
+
+    // Address of a compiled function, or 0 if it is not defined. For
+    // functions defined in the session this is the address of their stub,
+    // which always calls the latest version, and the lookup does not lock.
+    uint64_t GetFunctionAddress(const std::string &name);
+
+  private:
+    std::unique_ptr<llvm::Module> create_module(llvm::LLVMContext &context);
+    void configure_codegen(CodegenContext &codegen_context);
+    void report_error(SourceOffset location, const std::string &message);
+    void define(std::unique_ptr<FunctionAST> function, RunResult *result);
+    void declare(std::unique_ptr<PrototypeAST> prototype, RunResult *result);
+    void evaluate(std::unique_ptr<FunctionAST> function, RunResult *result);
+    void evaluate_batch(std::vector<std::unique_ptr<FunctionAST>> expressions,
+                        RunResult *result);
+    llvm::orc::ThreadSafeModule compile_function(FunctionAST &function,
+                                                 const std::string &symbol_name,
+                                                 ProfileCounters *counters = nullptr,
+                                                 const FunctionProfile *profile = nullptr,
+                                                 std::set<std::string> *inlined = nullptr);
+    llvm::orc::ThreadSafeModule compile_batch(
+        std::vector<std::unique_ptr<FunctionAST>> &expressions,
+        const std::string &symbol_name, size_t &result_count);
+    uint64_t add_transient_module(llvm::orc::ThreadSafeModule module,
+                                  const std::string &symbol_name,
+                                  llvm::orc::ResourceTrackerSP &tracker);
+    void lower_callees(CodegenContext &codegen_context, std::set<std::string> &inlined);
+    void optimize_module(llvm::Module &module, bool aggressive);
+    bool publish_function(const std::string &name, const std::string &symbol_name,
+                          llvm::orc::ThreadSafeModule module);
+    bool compile_tier(const std::string &name, TieredFunction &tiered, bool optimized);
+    bool compile_definition(const std::string &name, std::unique_ptr<FunctionAST> function,
+                            bool deoptimize = false);
+    void report_update(UpdateReport &report);
+    void run_background();
+    void run_profiler();
+};
+
+
+#endif  // SESSION_H_
@@ -0,0 +1,79 @@
+#include <functional>
+
+#include "symbol_table.h"
+
+
+static const size_t initial_bucket_count = 64;
+
+
+SymbolTable::SymbolTable()
+{
+    this->buckets.store(this->create_buckets(initial_bucket_count), std::memory_order_release);
+}
+
+
+SymbolTable::Buckets *SymbolTable::create_buckets(size_t size)
+{
+    auto buckets = std::make_unique<Buckets>();
+    buckets->mask = size - 1;
+    buckets->heads.reset(new std::atomic<Entry *>[size]);
+    for (size_t i = 0; i < size; i++)
+        buckets->heads[i].store(nullptr, std::memory_order_relaxed);
+
+    this->bucket_arrays.push_back(std::move(buckets));
+    return this->bucket_arrays.back().get();
+}
+
+
+// Pushes a new entry onto the front of its bucket chain. The entry is fully
+// built before the release store makes it visible to readers.
+void SymbolTable::link(Buckets *buckets, const std::string &name, uint64_t address)
+{
+    std::atomic<Entry *> &head = buckets->heads[std::hash<std::string>()(name) & buckets->mask];
+
+    auto entry = std::make_unique<Entry>();
+    entry->name = name;
+    entry->address = address;
+    entry->next = head.load(std::memory_order_relaxed);
+    head.store(entry.get(), std::memory_order_release);
+    this->entries.push_back(std::move(entry));
+}
+
+
+uint64_t SymbolTable::Lookup(const std::string &name) const
+{
+    const Buckets *buckets = this->buckets.load(std::memory_order_acquire);
+    const Entry *entry = buckets->heads[std::hash<std::string>()(name) & buckets->mask]
+        .load(std::memory_order_acquire);
+    for (; entry; entry = entry->next)
+    {
+        if (entry->name == name)
+            return entry->address;
+    }
+    return 0;
+}
+
+
+void SymbolTable::Insert(const std::string &name, uint64_t address)
+{
+    Buckets *current = this->buckets.load(std::memory_order_relaxed);
+
+    // Keep the chains short by doubling the buckets when they average two
+    // entries. The new array is filled completely before it is published,
+    // while readers keep using the old one.
+    if (this->count + 1 > 2 * (current->mask + 1))
+    {
+        Buckets *grown = this->create_buckets(2 * (current->mask + 1));
+        for (size_t i = 0; i <= current->mask; i++)
+        {
+            for (Entry *entry = current->heads[i].load(std::memory_order_relaxed);
+                 entry; entry = entry->next)
+                this->link(grown, entry->name, entry->address);
+        }
+        this->buckets.store(grown, std::memory_order_release);
+        current = grown;
+    }
+
+    this->link(current, name, address);
+    this->count++;
+}
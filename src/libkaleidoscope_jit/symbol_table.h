@@ -0,0 +1,56 @@
+#ifndef SYMBOL_TABLE_H_
+#define SYMBOL_TABLE_H_
+
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Append-only map from function names to addresses. Lookups are lock-free
+// and can run on any number of threads while a single writer adds entries.
+// Entries are never removed or changed, so readers need no reclamation
+// scheme: superseded bucket arrays are kept until the table is destroyed.
+class SymbolTable
+{
+    struct Entry {
+        std::string name;
+        uint64_t address;
+        Entry *next;
+    };
+
+    struct Buckets {
+        size_t mask;
+        std::unique_ptr<std::atomic<Entry *>[]> heads;
+    };
+
+    std::atomic<Buckets *> buckets;
+
+    // Only touched by the writer
+    std::vector<std::unique_ptr<Buckets>> bucket_arrays;
+    std::vector<std::unique_ptr<Entry>> entries;
+    size_t count = 0;
+
+  public:
+    SymbolTable();
+
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+
+    // Address of the name, or 0 if it has not been added.
+    uint64_t Lookup(const std::string &name) const;
+
+    // Adds a name that is not in the table yet. Must not be called from more
+    // than one thread at a time.
+    void Insert(const std::string &name, uint64_t address);
+
+  private:
+    Buckets *create_buckets(size_t size);
+    void link(Buckets *buckets, const std::string &name, uint64_t address);
+};
+
+
+#endif  // SYMBOL_TABLE_H_
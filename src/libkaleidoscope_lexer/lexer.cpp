@@ -1,23 +1,26 @@
+#include <algorithm>
 #include <limits>
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
 
 #include "lexer.h"
+#include "libkaleidoscope_instrumentation/instrumentation.h"
 
 
 // Advances pointer while predicate condition for character is true, returning
 // the combined characters as string.
-static std::string ConsumeWhileCondition(std::istream& input,
-                                         int (*character_predicate)(int))
+std::string Lexer::consume_while(int (*character_predicate)(int))
 {
     std::string characters("");
 
     // Keep consuming while predicate is true
-    while ((*character_predicate)(input.peek()))
+    while ((*character_predicate)(this->input.peek()))
     {
-        characters += input.get();
+        characters += this->input.get();
     }
 
+    this->offset += characters.size();
     return characters;
 }
 
@@ -55,21 +58,35 @@ static int is_not_endofline(int character)
 }
 
 
-Token GetToken(std::istream& input)
+Token Lexer::GetToken()
 {
+    PhaseTimer timer(phase_lex);
+    AddToCounter(counter_tokens);
+
     Token token;
     std::string token_identifier;
 
-    // First, trim the leading whitespace
-    ConsumeWhileCondition(input, isspace);
+    while (1)
+    {
+        // First, trim the leading whitespace
+        this->consume_while(isspace);
+
+        // if first character starts a comment, consume until end of line
+        if (this->input.peek() != '#')
+            break;
+        this->consume_while(is_not_endofline);
+    }
+
+    // Record where the token starts
+    token.location = this->offset;
 
     // Now peek the current character
-    int current_character = input.peek();
+    int current_character = this->input.peek();
 
     // if first character is a letter, consume as identifier
     if (isalpha(current_character))
     {
-        token_identifier = ConsumeWhileCondition(input, isalnum);
+        token_identifier = this->consume_while(isalnum);
         token.token = LookupToken(token_identifier);
         token.identifier = token_identifier;
         token.number = std::numeric_limits<double>::quiet_NaN();
@@ -78,18 +95,14 @@ Token GetToken(std::istream& input)
     // if first character is a number, consume as number
     else if (isdigit(current_character))
     {
-        token_identifier = ConsumeWhileCondition(input, is_number_char);
+        token_identifier = this->consume_while(is_number_char);
         token.token = tok_number;
         token.identifier = token_identifier;
-        token.number = stod(token_identifier);
+        // Unlike stod, strtod does not throw on numbers out of range, which
+        // become infinity
+        token.number = strtod(token_identifier.c_str(), nullptr);
         return token;
     }
-    // if first character starts a comment, consume until end of line
-    else if (current_character == '#')
-    {
-        ConsumeWhileCondition(input, is_not_endofline);
-        return GetToken(input);
-    }
     // check for eof
     else if (current_character == EOF)
     {
@@ -100,8 +113,40 @@ Token GetToken(std::istream& input)
     }
 
     // return current character as is
-    token.token = input.get();
+    token.token = this->input.get();
+    this->offset++;
     token.identifier = "";
     token.number = std::numeric_limits<double>::quiet_NaN();
     return token;
 }
+
+
+Token GetToken(std::istream &input)
+{
+    return Lexer(input).GetToken();
+}
+
+
+LineTable::LineTable(const std::string &source)
+{
+    this->line_starts.push_back(0);
+    for (SourceOffset offset = 0; offset < source.size(); offset++)
+    {
+        if (source[offset] == '\n')
+            this->line_starts.push_back(offset + 1);
+    }
+}
+
+
+SourceOffset LineTable::GetLine(SourceOffset offset) const
+{
+    // Index of the last line starting at or before the offset
+    auto line = std::upper_bound(this->line_starts.begin(), this->line_starts.end(), offset);
+    return line - this->line_starts.begin();
+}
+
+
+SourceOffset LineTable::GetColumn(SourceOffset offset) const
+{
+    return offset - this->line_starts[this->GetLine(offset) - 1] + 1;
+}
@@ -2,8 +2,10 @@
 #define LEXER_H_
 
 
+#include <cstdint>
 #include <istream>
 #include <string>
+#include <vector>
 
 
 enum TokenValue {
@@ -24,14 +26,54 @@ enum TokenValue {
 };
 
 
+// Byte offset in a source. Streamed sources can be larger than 4 GiB.
+typedef uint64_t SourceOffset;
+
+
 struct Token {
     int token;
     std::string identifier;
     double number;
+    // Byte offset of the first character of the token in the input
+    SourceOffset location;
 };
 
 
-Token GetToken(std::istream& file);
+// Splits an input stream into tokens. The lexer counts the bytes it
+// consumes, so that tokens know their offset without asking the stream,
+// which is slow on file streams and fails at the end of input.
+class Lexer
+{
+    std::istream &input;
+    SourceOffset offset;
+
+  public:
+    // The input starts at the given offset of the source
+    Lexer(std::istream &input, SourceOffset offset = 0) : input(input), offset(offset) {}
+
+    Token GetToken();
+
+  private:
+    std::string consume_while(int (*character_predicate)(int));
+};
+
+
+// Reads one token from the input. Its location counts from the position the
+// input was at, so use a Lexer to locate tokens across calls.
+Token GetToken(std::istream &input);
+
+
+// Maps byte offsets in a source buffer to 1-based line and column numbers.
+class LineTable
+{
+    std::vector<SourceOffset> line_starts;
+
+  public:
+    LineTable(const std::string &source);
+
+    SourceOffset GetLine(SourceOffset offset) const;
+    SourceOffset GetColumn(SourceOffset offset) const;
+};
 
 
 #endif  // LEXER_H_
@@ -1,5 +1,140 @@
+#include <cstring>
+#include <functional>
+
 #include "ast.h"
 
+
+enum FingerprintKind {
+    fingerprint_number = 1,
+    fingerprint_variable,
+    fingerprint_binary,
+    fingerprint_call,
+    fingerprint_if,
+    fingerprint_function,
+};
+
+
+static uint64_t combine(uint64_t hash, uint64_t value)
+{
+    return hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+}
+
+
+static uint64_t hash_string(const std::string &str)
+{
+    return std::hash<std::string>()(str);
+}
+
+
+// Structures are encoded in prefix order: the kind of each node, its fixed
+// size fields, then its children. Names cannot contain NUL, so they are
+// terminated by one.
+static void encode_bytes(std::string &structure, const void *bytes, size_t size)
+{
+    structure.append(static_cast<const char *>(bytes), size);
+}
+
+
+static void encode_name(std::string &structure, const std::string &name)
+{
+    structure += name;
+    structure += '\0';
+}
+
+
+SourceOffset ExprAST::get_location()
+{
+    return this->location;
+}
+
+
+bool ExprAST::is_shared()
+{
+    return this->shared.load(std::memory_order_relaxed);
+}
+
+
+void ExprAST::mark_shared()
+{
+    this->shared.store(true, std::memory_order_relaxed);
+}
+
+
+// Children waiting to be released by the outermost destructor running on
+// the thread, if any
+static thread_local std::vector<std::shared_ptr<ExprAST>> *pending_children = nullptr;
+
+
+void ExprAST::release_children(std::vector<std::shared_ptr<ExprAST>> children)
+{
+    // Destructors run by the loop below hand their children to it
+    if (pending_children)
+    {
+        for (auto &child : children)
+            pending_children->push_back(std::move(child));
+        return;
+    }
+
+    pending_children = &children;
+    while (!children.empty())
+    {
+        // Only a child this was the last reference to is destroyed, by its
+        // own destructor, so nodes still shared elsewhere are left intact
+        std::shared_ptr<ExprAST> child = std::move(children.back());
+        children.pop_back();
+        child.reset();
+    }
+    pending_children = nullptr;
+}
+
+
+BinaryExprAST::~BinaryExprAST()
+{
+    std::vector<std::shared_ptr<ExprAST>> children;
+    this->take_children(children);
+    release_children(std::move(children));
+}
+
+
+void BinaryExprAST::take_children(std::vector<std::shared_ptr<ExprAST>> &children)
+{
+    children.push_back(std::move(this->left));
+    children.push_back(std::move(this->right));
+}
+
+
+CallExprAST::~CallExprAST()
+{
+    std::vector<std::shared_ptr<ExprAST>> children;
+    this->take_children(children);
+    release_children(std::move(children));
+}
+
+
+void CallExprAST::take_children(std::vector<std::shared_ptr<ExprAST>> &children)
+{
+    for (auto &arg : this->args)
+        children.push_back(std::move(arg));
+    this->args.clear();
+}
+
+
+IfExprAST::~IfExprAST()
+{
+    std::vector<std::shared_ptr<ExprAST>> children;
+    this->take_children(children);
+    release_children(std::move(children));
+}
+
+
+void IfExprAST::take_children(std::vector<std::shared_ptr<ExprAST>> &children)
+{
+    children.push_back(std::move(this->condition));
+    children.push_back(std::move(this->then_expr));
+    children.push_back(std::move(this->else_expr));
+}
+
+
 char BinaryExprAST::get_op()
 {
     return this->op;
@@ -16,3 +151,237 @@ ExprAST* BinaryExprAST::get_right()
 {
     return this->right.get();
 }
+
+
+ExprAST* IfExprAST::get_condition()
+{
+    return this->condition.get();
+}
+
+
+ExprAST* IfExprAST::get_then()
+{
+    return this->then_expr.get();
+}
+
+
+ExprAST* IfExprAST::get_else()
+{
+    return this->else_expr.get();
+}
+
+
+int NumberExprAST::get_speculation_cost()
+{
+    return 0;
+}
+
+
+int VariableExprAST::get_speculation_cost()
+{
+    return 0;
+}
+
+
+int BinaryExprAST::get_speculation_cost()
+{
+    int left_cost = this->left->get_speculation_cost();
+    int right_cost = this->right->get_speculation_cost();
+    if (left_cost < 0 || right_cost < 0)
+        return -1;
+
+    // Division has a much longer latency than the other operators
+    int op_cost = this->op == '/' ? 4 : 1;
+    return left_cost + right_cost + op_cost;
+}
+
+
+int CallExprAST::get_speculation_cost()
+{
+    // The callee may be an extern with side effects
+    return -1;
+}
+
+
+int IfExprAST::get_speculation_cost()
+{
+    int condition_cost = this->condition->get_speculation_cost();
+    int then_cost = this->then_expr->get_speculation_cost();
+    int else_cost = this->else_expr->get_speculation_cost();
+    if (condition_cost < 0 || then_cost < 0 || else_cost < 0)
+        return -1;
+    return condition_cost + then_cost + else_cost + 2;
+}
+
+
+void NumberExprAST::collect_callees(std::set<std::string> &callees) {}
+
+
+void VariableExprAST::collect_callees(std::set<std::string> &callees) {}
+
+
+void BinaryExprAST::collect_callees(std::set<std::string> &callees)
+{
+    this->left->collect_callees(callees);
+    this->right->collect_callees(callees);
+}
+
+
+void CallExprAST::collect_callees(std::set<std::string> &callees)
+{
+    callees.insert(this->function_name);
+    for (auto &arg : this->args)
+        arg->collect_callees(callees);
+}
+
+
+void IfExprAST::collect_callees(std::set<std::string> &callees)
+{
+    this->condition->collect_callees(callees);
+    this->then_expr->collect_callees(callees);
+    this->else_expr->collect_callees(callees);
+}
+
+
+uint64_t NumberExprAST::get_fingerprint()
+{
+    uint64_t bits;
+    memcpy(&bits, &this->val, sizeof(bits));
+    return combine(fingerprint_number, bits);
+}
+
+
+uint64_t VariableExprAST::get_fingerprint()
+{
+    return combine(fingerprint_variable, hash_string(this->name));
+}
+
+
+uint64_t BinaryExprAST::get_fingerprint()
+{
+    uint64_t hash = combine(fingerprint_binary, this->op);
+    hash = combine(hash, this->left->get_fingerprint());
+    return combine(hash, this->right->get_fingerprint());
+}
+
+
+uint64_t CallExprAST::get_fingerprint()
+{
+    uint64_t hash = combine(fingerprint_call, hash_string(this->function_name));
+    hash = combine(hash, this->args.size());
+    for (auto &arg : this->args)
+        hash = combine(hash, arg->get_fingerprint());
+    return hash;
+}
+
+
+uint64_t IfExprAST::get_fingerprint()
+{
+    uint64_t hash = combine(fingerprint_if, this->condition->get_fingerprint());
+    hash = combine(hash, this->then_expr->get_fingerprint());
+    return combine(hash, this->else_expr->get_fingerprint());
+}
+
+
+void NumberExprAST::encode_structure(std::string &structure)
+{
+    structure += static_cast<char>(fingerprint_number);
+    encode_bytes(structure, &this->val, sizeof(this->val));
+}
+
+
+void VariableExprAST::encode_structure(std::string &structure)
+{
+    structure += static_cast<char>(fingerprint_variable);
+    encode_name(structure, this->name);
+}
+
+
+void BinaryExprAST::encode_structure(std::string &structure)
+{
+    structure += static_cast<char>(fingerprint_binary);
+    structure += this->op;
+    this->left->encode_structure(structure);
+    this->right->encode_structure(structure);
+}
+
+
+void CallExprAST::encode_structure(std::string &structure)
+{
+    structure += static_cast<char>(fingerprint_call);
+    encode_name(structure, this->function_name);
+    uint64_t arg_count = this->args.size();
+    encode_bytes(structure, &arg_count, sizeof(arg_count));
+    for (auto &arg : this->args)
+        arg->encode_structure(structure);
+}
+
+
+void IfExprAST::encode_structure(std::string &structure)
+{
+    structure += static_cast<char>(fingerprint_if);
+    this->condition->encode_structure(structure);
+    this->then_expr->encode_structure(structure);
+    this->else_expr->encode_structure(structure);
+}
+
+
+const std::string &PrototypeAST::get_name()
+{
+    return this->name;
+}
+
+
+const std::vector<std::string> &PrototypeAST::get_args()
+{
+    return this->args;
+}
+
+
+SourceOffset PrototypeAST::get_location()
+{
+    return this->location;
+}
+
+
+PrototypeAST* FunctionAST::get_prototype()
+{
+    return this->prototype.get();
+}
+
+
+ExprAST* FunctionAST::get_body()
+{
+    return this->body.get();
+}
+
+
+std::set<std::string> FunctionAST::get_callees()
+{
+    std::set<std::string> callees;
+    this->body->collect_callees(callees);
+    return callees;
+}
+
+
+uint64_t FunctionAST::get_fingerprint()
+{
+    uint64_t hash = combine(fingerprint_function, hash_string(this->prototype->get_name()));
+    hash = combine(hash, this->prototype->get_args().size());
+    for (const std::string &arg : this->prototype->get_args())
+        hash = combine(hash, hash_string(arg));
+    return combine(hash, this->body->get_fingerprint());
+}
+
+
+std::string FunctionAST::get_structure()
+{
+    std::string structure(1, static_cast<char>(fingerprint_function));
+    encode_name(structure, this->prototype->get_name());
+    uint64_t arg_count = this->prototype->get_args().size();
+    encode_bytes(structure, &arg_count, sizeof(arg_count));
+    for (const std::string &arg : this->prototype->get_args())
+        encode_name(structure, arg);
+    this->body->encode_structure(structure);
+    return structure;
+}
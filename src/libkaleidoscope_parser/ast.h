@@ -2,17 +2,65 @@
 #define AST_H_
 
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 #include <llvm/IR/Value.h>
+#include <llvm/IR/Function.h>
 
+#include "libkaleidoscope_instrumentation/instrumentation.h"
+#include "libkaleidoscope_lexer/lexer.h"
 
-class ExprAST
+
+class CodegenContext;
+
+
+// Every node records the byte offset in the source of the token it was
+// parsed from, so that generated code can be mapped back to the source.
+//
+// Expression nodes are held by shared pointers, since the parser can share
+// identical subtrees between expressions (see HashConsTable). Nodes that
+// have been shared are marked, so codegen computes their value only once.
+// The mark is only a hint and may be set while another thread lowers the
+// node, so it is atomic.
+class ExprAST : public CountedAllocation
 {
+    SourceOffset location;
+    std::atomic<bool> shared;
+
   public:
+    ExprAST(SourceOffset location = 0) : location(location), shared(false) {}
     virtual ~ExprAST() {}
-    virtual llvm::Value *codegen() = 0;
+    virtual llvm::Value *codegen(CodegenContext &context) = 0;
+
+    // Number of instructions evaluating the expression takes, or -1 if it
+    // may have side effects and so must not be evaluated speculatively.
+    virtual int get_speculation_cost() = 0;
+
+    // Adds the names of the functions the expression calls.
+    virtual void collect_callees(std::set<std::string> &callees) = 0;
+    // Hash of the structure of the expression, which does not depend on
+    // where it is in the source.
+    virtual uint64_t get_fingerprint() = 0;
+    // Appends an encoding of the structure of the expression, equal for
+    // two expressions exactly when they only differ in their locations.
+    virtual void encode_structure(std::string &structure) = 0;
+
+    SourceOffset get_location();
+    bool is_shared();
+    void mark_shared();
+
+  protected:
+    // Moves the children of the node out into the given vector.
+    virtual void take_children(std::vector<std::shared_ptr<ExprAST>> &children) {}
+    // Drops the references to the children in a loop rather than through
+    // nested destructors, so that long chains like `1+1+...+1` do not
+    // overflow the stack: the destructors of the children hand their own
+    // children to the outermost loop on the thread.
+    static void release_children(std::vector<std::shared_ptr<ExprAST>> children);
 };
 
 
@@ -21,8 +69,13 @@ class NumberExprAST : public ExprAST
     double val;
 
   public:
-    NumberExprAST(double val) : val(val) {}
-    llvm::Value *codegen() override;
+    NumberExprAST(double val, SourceOffset location = 0)
+        : ExprAST(location), val(val) {}
+    llvm::Value *codegen(CodegenContext &context) override;
+    int get_speculation_cost() override;
+    void collect_callees(std::set<std::string> &callees) override;
+    uint64_t get_fingerprint() override;
+    void encode_structure(std::string &structure) override;
 };
 
 
@@ -31,65 +84,136 @@ class VariableExprAST : public ExprAST
     std::string name;
 
   public:
-    VariableExprAST(const std::string &name) : name(name) {}
-    llvm::Value *codegen() override;
+    VariableExprAST(const std::string &name, SourceOffset location = 0)
+        : ExprAST(location), name(name) {}
+    llvm::Value *codegen(CodegenContext &context) override;
+    int get_speculation_cost() override;
+    void collect_callees(std::set<std::string> &callees) override;
+    uint64_t get_fingerprint() override;
+    void encode_structure(std::string &structure) override;
 };
 
 
 class BinaryExprAST : public ExprAST
 {
     char op;
-    std::unique_ptr<ExprAST> left, right;
+    std::shared_ptr<ExprAST> left, right;
 
   public:
     BinaryExprAST(char op,
-                  std::unique_ptr<ExprAST> left,
-                  std::unique_ptr<ExprAST> right)
-        : op(op), left(std::move(left)), right(std::move(right)) {}
-    llvm::Value *codegen() override;
+                  std::shared_ptr<ExprAST> left,
+                  std::shared_ptr<ExprAST> right,
+                  SourceOffset location = 0)
+        : ExprAST(location), op(op), left(std::move(left)), right(std::move(right)) {}
+    ~BinaryExprAST();
+    llvm::Value *codegen(CodegenContext &context) override;
+    int get_speculation_cost() override;
+    void collect_callees(std::set<std::string> &callees) override;
+    uint64_t get_fingerprint() override;
+    void encode_structure(std::string &structure) override;
 
     char get_op();
     ExprAST* get_left();
     ExprAST* get_right();
+
+  protected:
+    void take_children(std::vector<std::shared_ptr<ExprAST>> &children) override;
 };
 
 
 class CallExprAST : public ExprAST
 {
     std::string function_name;
-    std::vector<std::unique_ptr<ExprAST>> args;
+    std::vector<std::shared_ptr<ExprAST>> args;
 
   public:
     CallExprAST(const std::string &function_name,
-                 std::vector<std::unique_ptr<ExprAST>> args)
-        : function_name(function_name), args(std::move(args)) {}
-    llvm::Value *codegen() override;
+                 std::vector<std::shared_ptr<ExprAST>> args,
+                 SourceOffset location = 0)
+        : ExprAST(location), function_name(function_name), args(std::move(args)) {}
+    ~CallExprAST();
+    llvm::Value *codegen(CodegenContext &context) override;
+    int get_speculation_cost() override;
+    void collect_callees(std::set<std::string> &callees) override;
+    uint64_t get_fingerprint() override;
+    void encode_structure(std::string &structure) override;
+
+  protected:
+    void take_children(std::vector<std::shared_ptr<ExprAST>> &children) override;
+};
+
+
+// Conditional expression: `if cond then a else b`. The condition is true
+// when it is not zero.
+class IfExprAST : public ExprAST
+{
+    std::shared_ptr<ExprAST> condition, then_expr, else_expr;
+
+  public:
+    IfExprAST(std::shared_ptr<ExprAST> condition,
+              std::shared_ptr<ExprAST> then_expr,
+              std::shared_ptr<ExprAST> else_expr,
+              SourceOffset location = 0)
+        : ExprAST(location), condition(std::move(condition)),
+          then_expr(std::move(then_expr)), else_expr(std::move(else_expr)) {}
+    ~IfExprAST();
+    llvm::Value *codegen(CodegenContext &context) override;
+    int get_speculation_cost() override;
+    void collect_callees(std::set<std::string> &callees) override;
+    uint64_t get_fingerprint() override;
+    void encode_structure(std::string &structure) override;
+
+    ExprAST* get_condition();
+    ExprAST* get_then();
+    ExprAST* get_else();
+
+  protected:
+    void take_children(std::vector<std::shared_ptr<ExprAST>> &children) override;
 };
 
 
-class PrototypeAST
+class PrototypeAST : public CountedAllocation
 {
     std::string name;
     std::vector<std::string> args;
+    SourceOffset location;
 
   public:
     PrototypeAST(const std::string &name,
-                 std::vector<std::string> args)
-        : name(name), args(std::move(args)) {}
-    llvm::Function *codegen();
+                 std::vector<std::string> args,
+                 SourceOffset location = 0)
+        : name(name), args(std::move(args)), location(location) {}
+    llvm::Function *codegen(CodegenContext &context);
+
+    const std::string &get_name();
+    const std::vector<std::string> &get_args();
+    SourceOffset get_location();
 };
 
 
-class FunctionAST
+class FunctionAST : public CountedAllocation
 {
     std::unique_ptr<PrototypeAST> prototype;
-    std::unique_ptr<ExprAST> body;
+    std::shared_ptr<ExprAST> body;
 
   public:
     FunctionAST(std::unique_ptr<PrototypeAST> prototype,
-                std::unique_ptr<ExprAST> body)
+                std::shared_ptr<ExprAST> body)
         : prototype(std::move(prototype)), body(std::move(body)) {}
-    llvm::Function *codegen();
+    llvm::Function *codegen(CodegenContext &context);
+
+    PrototypeAST* get_prototype();
+    ExprAST* get_body();
+
+    // Names of the functions the body calls.
+    std::set<std::string> get_callees();
+    // Hash of the prototype and body, equal for definitions that only
+    // differ in where they are in the source.
+    uint64_t get_fingerprint();
+    // Encoding of the prototype and body, equal for two definitions exactly
+    // when they only differ in where they are in the source. Settles what
+    // equal fingerprints only suggest, in about the size of the source.
+    std::string get_structure();
 };
 
 
@@ -0,0 +1,43 @@
+#include "call_graph.h"
+
+
+static const std::set<std::string> no_functions;
+
+
+void CallGraph::SetCallees(const std::string &name, const std::set<std::string> &callees)
+{
+    std::set<std::string> &current = this->callees[name];
+    for (const std::string &callee : current)
+    {
+        if (!callees.count(callee))
+        {
+            auto callers = this->callers.find(callee);
+            callers->second.erase(name);
+            if (callers->second.empty())
+                this->callers.erase(callers);
+        }
+    }
+    for (const std::string &callee : callees)
+        this->callers[callee].insert(name);
+    current = callees;
+}
+
+
+const std::set<std::string> &CallGraph::get_callees(const std::string &name) const
+{
+    auto callees = this->callees.find(name);
+    return callees == this->callees.end() ? no_functions : callees->second;
+}
+
+
+const std::set<std::string> &CallGraph::get_callers(const std::string &name) const
+{
+    auto callers = this->callers.find(name);
+    return callers == this->callers.end() ? no_functions : callers->second;
+}
+
+
+size_t CallGraph::size() const
+{
+    return this->callees.size();
+}
@@ -0,0 +1,30 @@
+#ifndef CALL_GRAPH_H_
+#define CALL_GRAPH_H_
+
+
+#include <cstddef>
+#include <map>
+#include <set>
+#include <string>
+
+
+// Which functions call which, by name, as found in the calls of their
+// bodies. Used to find the functions affected by a redefinition. Callees
+// need not be defined, and are tracked by name across redefinitions.
+class CallGraph
+{
+    std::map<std::string, std::set<std::string>> callees;
+    std::map<std::string, std::set<std::string>> callers;
+
+  public:
+    // Replaces the callees of the function with those of its new body.
+    void SetCallees(const std::string &name, const std::set<std::string> &callees);
+
+    const std::set<std::string> &get_callees(const std::string &name) const;
+    const std::set<std::string> &get_callers(const std::string &name) const;
+    // Number of functions with known callees.
+    size_t size() const;
+};
+
+
+#endif  // CALL_GRAPH_H_
@@ -1,46 +1,597 @@
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <llvm/ADT/APFloat.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
+#include <llvm/IR/Verifier.h>
 
 #include "ast.h"
+#include "codegen.h"
 
 
-static llvm::Value *log_error_value(const char *str)
+// Branch weights are 32 bits wide, so larger counts are scaled down.
+static const uint64_t max_branch_weight = UINT32_MAX;
+
+// Conditionals whose arms together take at most this many instructions are
+// lowered to a select, evaluating both arms, instead of branching. Selects
+// do not mispredict and keep loops over the function vectorizable.
+static const int max_select_cost = 8;
+
+
+// LLVM intrinsics for the libm functions, with their number of arguments
+struct MathIntrinsic {
+    llvm::Intrinsic::ID id;
+    size_t arg_count;
+};
+
+static const std::map<std::string, MathIntrinsic> math_intrinsics = {
+    {"sin", {llvm::Intrinsic::sin, 1}},
+    {"cos", {llvm::Intrinsic::cos, 1}},
+    {"exp", {llvm::Intrinsic::exp, 1}},
+    {"exp2", {llvm::Intrinsic::exp2, 1}},
+    {"log", {llvm::Intrinsic::log, 1}},
+    {"log2", {llvm::Intrinsic::log2, 1}},
+    {"log10", {llvm::Intrinsic::log10, 1}},
+    {"sqrt", {llvm::Intrinsic::sqrt, 1}},
+    {"fabs", {llvm::Intrinsic::fabs, 1}},
+    {"floor", {llvm::Intrinsic::floor, 1}},
+    {"ceil", {llvm::Intrinsic::ceil, 1}},
+    {"trunc", {llvm::Intrinsic::trunc, 1}},
+    {"round", {llvm::Intrinsic::round, 1}},
+    {"pow", {llvm::Intrinsic::pow, 2}},
+    {"copysign", {llvm::Intrinsic::copysign, 2}},
+    {"fmin", {llvm::Intrinsic::minnum, 2}},
+    {"fmax", {llvm::Intrinsic::maxnum, 2}},
+    {"fma", {llvm::Intrinsic::fma, 3}},
+};
+
+
+bool IsMathIntrinsic(const std::string &name, size_t arg_count)
 {
-    fprintf(stderr, "ERROR: %s\n", str);
-    return nullptr;
+    auto intrinsic = math_intrinsics.find(name);
+    return intrinsic != math_intrinsics.end() && intrinsic->second.arg_count == arg_count;
 }
 
 
-llvm::Value *NumberExprAST::codegen()
+std::nullptr_t CodegenContext::log_error(SourceOffset location, const char *message)
 {
+    if (this->diagnostics)
+        this->diagnostics->Report({location, location}, message);
+    else
+        fprintf(stderr, "ERROR: %s\n", message);
     return nullptr;
 }
 
 
-llvm::Value *VariableExprAST::codegen()
+void CodegenContext::EnableFastMath()
 {
-    return nullptr;
+    this->builder.setFastMathFlags(llvm::FastMathFlags::getFast());
 }
 
 
-llvm::Value *BinaryExprAST::codegen()
+llvm::Function *CodegenContext::get_function(const std::string &name)
 {
+    // First, see if the function has already been added to the module
+    if (auto function = this->module.getFunction(name))
+        return function;
+
+    // Otherwise, declare it from an existing prototype
+    auto prototype = this->prototypes.find(name);
+    if (prototype != this->prototypes.end())
+        return PrototypeAST(name, prototype->second).codegen(*this);
+
     return nullptr;
 }
 
 
-llvm::Value *CallExprAST::codegen()
+llvm::Value *CodegenContext::codegen(ExprAST &expr)
 {
-    return nullptr;
+    if (!expr.is_shared())
+        return expr.codegen(*this);
+
+    auto existing = this->shared_values.find(&expr);
+    if (existing != this->shared_values.end())
+        return existing->second;
+
+    llvm::Value *value = expr.codegen(*this);
+    if (value)
+    {
+        this->shared_values[&expr] = value;
+        this->shared_order.push_back(&expr);
+    }
+    return value;
 }
 
 
-llvm::Function *FunctionAST::codegen()
+size_t CodegenContext::enter_scope()
 {
-    return nullptr;
+    return this->shared_order.size();
 }
 
 
-llvm::Function *PrototypeAST::codegen()
+void CodegenContext::leave_scope(size_t scope)
 {
-    return nullptr;
+    while (this->shared_order.size() > scope)
+    {
+        this->shared_values.erase(this->shared_order.back());
+        this->shared_order.pop_back();
+    }
+}
+
+
+void CodegenContext::clear_shared_values()
+{
+    this->leave_scope(0);
+}
+
+
+// Constant pointer to a counter in the address space of the compiler,
+// which is also the one the generated code runs in.
+static llvm::Value *counter_pointer(CodegenContext &context, const void *address,
+                                    llvm::Type *type)
+{
+    return context.builder.CreateIntToPtr(
+        context.builder.getInt64(reinterpret_cast<uintptr_t>(address)),
+        llvm::PointerType::getUnqual(type));
+}
+
+
+static llvm::LoadInst *load_counter(CodegenContext &context, llvm::Type *type,
+                                    llvm::Value *pointer)
+{
+    llvm::LoadInst *load = context.builder.CreateAlignedLoad(type, pointer, llvm::Align(8));
+    load->setAtomic(llvm::AtomicOrdering::Monotonic);
+    return load;
+}
+
+
+static void store_counter(CodegenContext &context, llvm::Value *value, llvm::Value *pointer)
+{
+    llvm::StoreInst *store = context.builder.CreateAlignedStore(value, pointer, llvm::Align(8));
+    store->setAtomic(llvm::AtomicOrdering::Monotonic);
+}
+
+
+static void increment_counter(CodegenContext &context, llvm::Value *pointer)
+{
+    llvm::Type *type = context.builder.getInt64Ty();
+    llvm::Value *count = load_counter(context, type, pointer);
+    store_counter(context, context.builder.CreateAdd(count, context.builder.getInt64(1)), pointer);
+}
+
+
+void CodegenContext::emit_entry_profile(llvm::Function *function)
+{
+    if (!this->profile_counters)
+        return;
+
+    ProfileCounters &counters = *this->profile_counters;
+    llvm::Type *count_type = this->builder.getInt64Ty();
+    increment_counter(*this, counter_pointer(*this, &counters.calls, count_type));
+
+    llvm::Type *double_type = this->builder.getDoubleTy();
+    unsigned index = 0;
+    for (auto &arg : function->args())
+    {
+        if (counters.arguments.size() <= index)
+            counters.arguments.emplace_back();
+        ArgumentCounters &argument = counters.arguments[index++];
+
+        llvm::Value *min_pointer = counter_pointer(*this, &argument.min, double_type);
+        llvm::Value *min = load_counter(*this, double_type, min_pointer);
+        store_counter(*this,
+                      this->builder.CreateSelect(this->builder.CreateFCmpOLT(&arg, min), &arg, min),
+                      min_pointer);
+
+        llvm::Value *max_pointer = counter_pointer(*this, &argument.max, double_type);
+        llvm::Value *max = load_counter(*this, double_type, max_pointer);
+        store_counter(*this,
+                      this->builder.CreateSelect(this->builder.CreateFCmpOGT(&arg, max), &arg, max),
+                      max_pointer);
+    }
+}
+
+
+llvm::MDNode *CodegenContext::emit_branch_profile(llvm::Value *condition)
+{
+    size_t index = this->branch_index++;
+
+    if (this->profile_counters)
+    {
+        auto &branches = this->profile_counters->branches;
+        if (branches.size() <= index)
+            branches.emplace_back();
+        BranchCounters &branch = branches[index];
+
+        llvm::Type *count_type = this->builder.getInt64Ty();
+        increment_counter(*this, this->builder.CreateSelect(
+            condition,
+            counter_pointer(*this, &branch.taken, count_type),
+            counter_pointer(*this, &branch.not_taken, count_type)));
+    }
+
+    if (!this->profile || this->profile->branches.size() <= index)
+        return nullptr;
+
+    const FunctionProfile::Branch &branch = this->profile->branches[index];
+    uint64_t scale = std::max(branch.taken, branch.not_taken) / max_branch_weight + 1;
+    return llvm::MDBuilder(this->context).createBranchWeights(
+        static_cast<uint32_t>(branch.taken / scale), static_cast<uint32_t>(branch.not_taken / scale));
+}
+
+
+void CodegenContext::restart_branch_profile()
+{
+    this->branch_index = 0;
+}
+
+
+void CodegenContext::EnableDebugInfo(const std::string &filename, const LineTable &lines)
+{
+    this->lines = &lines;
+    this->debug_builder = std::make_unique<llvm::DIBuilder>(this->module);
+    this->compile_unit = this->debug_builder->createCompileUnit(
+        llvm::dwarf::DW_LANG_C,
+        this->debug_builder->createFile(filename, "."),
+        "Kaleidoscope Compiler", false, "", 0);
+    this->module.addModuleFlag(llvm::Module::Warning, "Debug Info Version",
+                               llvm::DEBUG_METADATA_VERSION);
+}
+
+
+void CodegenContext::FinalizeDebugInfo()
+{
+    if (this->debug_builder)
+        this->debug_builder->finalize();
+}
+
+
+bool CodegenContext::has_debug_info()
+{
+    return this->debug_builder != nullptr;
+}
+
+
+llvm::DISubprogram *CodegenContext::create_subprogram(const std::string &name,
+                                                      unsigned arg_count,
+                                                      SourceOffset location)
+{
+    // Every argument and the return value are doubles
+    llvm::DIType *double_type = this->debug_builder->createBasicType(
+        "double", 64, llvm::dwarf::DW_ATE_float);
+    llvm::SmallVector<llvm::Metadata *, 8> element_types(arg_count + 1, double_type);
+
+    llvm::DIFile *file = this->compile_unit->getFile();
+    unsigned line = this->lines->GetLine(location);
+    auto subprogram = this->debug_builder->createFunction(
+        file, name, llvm::StringRef(), file, line,
+        this->debug_builder->createSubroutineType(
+            this->debug_builder->getOrCreateTypeArray(element_types)),
+        line, llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition);
+
+    this->scope = subprogram;
+    return subprogram;
+}
+
+
+void CodegenContext::emit_location(SourceOffset location)
+{
+    if (!this->debug_builder || !this->scope)
+        return;
+
+    this->builder.SetCurrentDebugLocation(
+        llvm::DILocation::get(this->context,
+                              this->lines->GetLine(location),
+                              this->lines->GetColumn(location),
+                              this->scope));
+}
+
+
+void CodegenContext::finish_subprogram()
+{
+    if (this->scope)
+        this->debug_builder->finalizeSubprogram(this->scope);
+    this->scope = nullptr;
+    this->builder.SetCurrentDebugLocation(llvm::DebugLoc());
+}
+
+
+llvm::Value *NumberExprAST::codegen(CodegenContext &context)
+{
+    context.emit_location(this->get_location());
+    return llvm::ConstantFP::get(context.context, llvm::APFloat(this->val));
+}
+
+
+llvm::Value *VariableExprAST::codegen(CodegenContext &context)
+{
+    context.emit_location(this->get_location());
+    llvm::Value *value = context.named_values[this->name];
+    if (!value)
+        return context.log_error(this->get_location(), "Unknown variable name");
+    return value;
+}
+
+
+llvm::Value *BinaryExprAST::codegen(CodegenContext &context)
+{
+    llvm::Value *left_value = context.codegen(*this->left);
+    llvm::Value *right_value = context.codegen(*this->right);
+    if (!left_value || !right_value)
+        return nullptr;
+
+    context.emit_location(this->get_location());
+    switch (this->op)
+    {
+        case '+':
+            return context.builder.CreateFAdd(left_value, right_value, "addtmp");
+        case '-':
+            return context.builder.CreateFSub(left_value, right_value, "subtmp");
+        case '*':
+            return context.builder.CreateFMul(left_value, right_value, "multmp");
+        case '/':
+            return context.builder.CreateFDiv(left_value, right_value, "divtmp");
+        case '<':
+            left_value = context.builder.CreateFCmpULT(left_value, right_value, "cmptmp");
+            // Convert bool 0/1 to double 0.0 or 1.0
+            return context.builder.CreateUIToFP(left_value,
+                                                llvm::Type::getDoubleTy(context.context),
+                                                "booltmp");
+        case '>':
+            left_value = context.builder.CreateFCmpUGT(left_value, right_value, "cmptmp");
+            return context.builder.CreateUIToFP(left_value,
+                                                llvm::Type::getDoubleTy(context.context),
+                                                "booltmp");
+        default:
+            return context.log_error(this->get_location(), "invalid binary operator");
+    }
+}
+
+
+llvm::Value *CallExprAST::codegen(CodegenContext &context)
+{
+    // Look up the name in the global module table, unless it is a math
+    // function with an intrinsic
+    llvm::Function *callee = nullptr;
+    if (context.math_externs && context.math_externs->count(this->function_name)
+        && IsMathIntrinsic(this->function_name, this->args.size()))
+        callee = llvm::Intrinsic::getDeclaration(
+            &context.module, math_intrinsics.at(this->function_name).id,
+            {llvm::Type::getDoubleTy(context.context)});
+    else
+        callee = context.get_function(this->function_name);
+    if (!callee)
+        return context.log_error(this->get_location(), "Unknown function referenced");
+
+    if (callee->arg_size() != this->args.size())
+        return context.log_error(this->get_location(), "Incorrect # arguments passed");
+
+    std::vector<llvm::Value *> arg_values;
+    for (auto &arg : this->args)
+    {
+        arg_values.push_back(context.codegen(*arg));
+        if (!arg_values.back())
+            return nullptr;
+    }
+
+    context.emit_location(this->get_location());
+    return context.builder.CreateCall(callee, arg_values, "calltmp");
+}
+
+
+llvm::Value *IfExprAST::codegen(CodegenContext &context)
+{
+    llvm::Value *condition_value = context.codegen(*this->condition);
+    if (!condition_value)
+        return nullptr;
+
+    // Convert condition to a bool by comparing non-equal to 0.0
+    context.emit_location(this->get_location());
+    condition_value = context.builder.CreateFCmpONE(
+        condition_value, llvm::ConstantFP::get(context.context, llvm::APFloat(0.0)), "ifcond");
+    llvm::MDNode *weights = context.emit_branch_profile(condition_value);
+
+    int then_cost = this->then_expr->get_speculation_cost();
+    int else_cost = this->else_expr->get_speculation_cost();
+    if (then_cost >= 0 && else_cost >= 0 && then_cost + else_cost <= max_select_cost)
+    {
+        // Both arms are cheap and pure, so evaluate both and pick one
+        llvm::Value *then_value = context.codegen(*this->then_expr);
+        llvm::Value *else_value = context.codegen(*this->else_expr);
+        if (!then_value || !else_value)
+            return nullptr;
+
+        context.emit_location(this->get_location());
+        llvm::Value *select = context.builder.CreateSelect(condition_value, then_value,
+                                                           else_value, "iftmp");
+        if (weights && llvm::isa<llvm::SelectInst>(select))
+            llvm::cast<llvm::SelectInst>(select)->setMetadata(llvm::LLVMContext::MD_prof, weights);
+        return select;
+    }
+
+    llvm::Function *function = context.builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock *then_block = llvm::BasicBlock::Create(context.context, "then", function);
+    llvm::BasicBlock *else_block = llvm::BasicBlock::Create(context.context, "else", function);
+    llvm::BasicBlock *merge_block = llvm::BasicBlock::Create(context.context, "ifcont", function);
+    context.builder.CreateCondBr(condition_value, then_block, else_block, weights);
+
+    // Each arm may add blocks of its own, so the phi takes its incoming
+    // blocks from wherever the arm ended
+    size_t scope = context.enter_scope();
+    context.builder.SetInsertPoint(then_block);
+    llvm::Value *then_value = context.codegen(*this->then_expr);
+    if (!then_value)
+        return nullptr;
+    context.leave_scope(scope);
+    context.builder.CreateBr(merge_block);
+    then_block = context.builder.GetInsertBlock();
+
+    context.builder.SetInsertPoint(else_block);
+    llvm::Value *else_value = context.codegen(*this->else_expr);
+    if (!else_value)
+        return nullptr;
+    context.leave_scope(scope);
+    context.builder.CreateBr(merge_block);
+    else_block = context.builder.GetInsertBlock();
+
+    context.builder.SetInsertPoint(merge_block);
+    context.emit_location(this->get_location());
+    llvm::PHINode *phi = context.builder.CreatePHI(llvm::Type::getDoubleTy(context.context),
+                                                   2, "iftmp");
+    phi->addIncoming(then_value, then_block);
+    phi->addIncoming(else_value, else_block);
+    return phi;
+}
+
+
+llvm::Function *PrototypeAST::codegen(CodegenContext &context)
+{
+    // Every argument and the return value are doubles
+    std::vector<llvm::Type *> doubles(this->args.size(),
+                                      llvm::Type::getDoubleTy(context.context));
+    llvm::FunctionType *function_type =
+        llvm::FunctionType::get(llvm::Type::getDoubleTy(context.context), doubles, false);
+
+    llvm::Function *function = llvm::Function::Create(
+        function_type, llvm::Function::ExternalLinkage, this->name, context.module);
+
+    // Name the arguments after the prototype
+    unsigned index = 0;
+    for (auto &arg : function->args())
+        arg.setName(this->args[index++]);
+
+    return function;
+}
+
+
+// Lowers the body of the function. When the profile shows arguments that
+// always had the same value, the body is lowered twice: once with those
+// arguments replaced by their value, behind a guard checking that they
+// still have it, and once for any other values.
+static llvm::Value *codegen_body(CodegenContext &context, llvm::Function *function,
+                                 ExprAST &body)
+{
+    std::vector<std::pair<llvm::Argument *, double>> constants;
+    if (context.profile && context.profile->arguments.size() == function->arg_size())
+    {
+        for (auto &arg : function->args())
+        {
+            if (context.profile->is_constant_argument(arg.getArgNo()))
+                constants.push_back({&arg, context.profile->arguments[arg.getArgNo()].min});
+        }
+    }
+    if (constants.empty())
+        return context.codegen(body);
+
+    // Compare the bits, so that -0 and NaN take the generic path
+    llvm::Value *guard = nullptr;
+    for (auto &constant : constants)
+    {
+        uint64_t bits;
+        memcpy(&bits, &constant.second, sizeof(bits));
+        llvm::Value *matches = context.builder.CreateICmpEQ(
+            context.builder.CreateBitCast(constant.first, context.builder.getInt64Ty()),
+            context.builder.getInt64(bits));
+        guard = guard ? context.builder.CreateAnd(guard, matches) : matches;
+    }
+
+    llvm::BasicBlock *specialized_block =
+        llvm::BasicBlock::Create(context.context, "specialized", function);
+    llvm::BasicBlock *generic_block = llvm::BasicBlock::Create(context.context, "generic", function);
+    llvm::BasicBlock *merge_block = llvm::BasicBlock::Create(context.context, "return", function);
+    context.builder.CreateCondBr(guard, specialized_block, generic_block,
+                                 llvm::MDBuilder(context.context).createBranchWeights(
+                                     max_branch_weight, 1));
+
+    size_t scope = context.enter_scope();
+    context.builder.SetInsertPoint(specialized_block);
+    for (auto &constant : constants)
+        context.named_values[std::string(constant.first->getName())] =
+            llvm::ConstantFP::get(context.context, llvm::APFloat(constant.second));
+    context.restart_branch_profile();
+    llvm::Value *specialized_value = context.codegen(body);
+    if (!specialized_value)
+        return nullptr;
+    context.leave_scope(scope);
+    context.builder.CreateBr(merge_block);
+    specialized_block = context.builder.GetInsertBlock();
+
+    context.builder.SetInsertPoint(generic_block);
+    for (auto &constant : constants)
+        context.named_values[std::string(constant.first->getName())] = constant.first;
+    context.restart_branch_profile();
+    llvm::Value *generic_value = context.codegen(body);
+    if (!generic_value)
+        return nullptr;
+    context.leave_scope(scope);
+    context.builder.CreateBr(merge_block);
+    generic_block = context.builder.GetInsertBlock();
+
+    context.builder.SetInsertPoint(merge_block);
+    llvm::PHINode *phi = context.builder.CreatePHI(context.builder.getDoubleTy(), 2, "result");
+    phi->addIncoming(specialized_value, specialized_block);
+    phi->addIncoming(generic_value, generic_block);
+    return phi;
+}
+
+
+llvm::Function *FunctionAST::codegen(CodegenContext &context)
+{
+    PhaseTimer timer(phase_codegen, this->prototype->get_name().c_str());
+
+    // Record the prototype so that later modules can call this function
+    const std::string &name = this->prototype->get_name();
+    context.prototypes[name] = this->prototype->get_args();
+
+    llvm::Function *function = context.get_function(name);
+    if (!function)
+        return nullptr;
+    if (!function->empty())
+        return context.log_error(this->prototype->get_location(),
+                                 "Function cannot be redefined.");
+
+    // Kaleidoscope has no exceptions, so no unwind tables need to be emitted
+    function->addFnAttr(llvm::Attribute::NoUnwind);
+
+    llvm::BasicBlock *entry = llvm::BasicBlock::Create(context.context, "entry", function);
+    context.builder.SetInsertPoint(entry);
+
+    if (context.has_debug_info())
+        function->setSubprogram(context.create_subprogram(
+            name, function->arg_size(), this->prototype->get_location()));
+
+    // Record the function arguments in the named values map
+    context.named_values.clear();
+    context.clear_shared_values();
+    context.restart_branch_profile();
+    for (auto &arg : function->args())
+        context.named_values[std::string(arg.getName())] = &arg;
+    context.emit_entry_profile(function);
+
+    llvm::Value *return_value = codegen_body(context, function, *this->body);
+    if (!return_value)
+    {
+        // Error reading body, remove function
+        context.finish_subprogram();
+        function->eraseFromParent();
+        return nullptr;
+    }
+
+    context.builder.CreateRet(return_value);
+    context.finish_subprogram();
+
+    // Validate the generated code, checking for consistency
+    if (llvm::verifyFunction(*function, &llvm::errs()))
+    {
+        function->eraseFromParent();
+        return nullptr;
+    }
+
+    return function;
 }
@@ -0,0 +1,117 @@
+#ifndef CODEGEN_H_
+#define CODEGEN_H_
+
+
+#include <map>
+#include <set>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include "ast.h"
+#include "diagnostics.h"
+#include "profile.h"
+#include "libkaleidoscope_lexer/lexer.h"
+
+
+// Prototypes of every function known to the compiler, by name. Functions
+// can be declared in one module and called from another, so these outlive
+// any single module.
+typedef std::map<std::string, std::vector<std::string>> PrototypeTable;
+
+
+// Whether calls to an extern with this name and number of arguments can be
+// lowered to an LLVM intrinsic: the standard math functions of libm.
+bool IsMathIntrinsic(const std::string &name, size_t arg_count);
+
+
+// State shared by the codegen methods of the AST while lowering into a
+// single module.
+class CodegenContext
+{
+  public:
+    llvm::LLVMContext &context;
+    llvm::Module &module;
+    llvm::IRBuilder<> builder;
+    std::map<std::string, llvm::Value *> named_values;
+    PrototypeTable &prototypes;
+
+    // Profile-guided codegen. With counters set, the functions lowered
+    // count their calls, argument ranges and branch outcomes into them.
+    // With a profile set instead, conditionals get branch weights from it,
+    // and arguments that always had the same value get a specialized copy
+    // of the body.
+    ProfileCounters *profile_counters = nullptr;
+    const FunctionProfile *profile = nullptr;
+
+    // Externs to lower to LLVM intrinsics. Intrinsics are constant folded
+    // and widened by the vectorizer, where calls to libm are not. Only
+    // names for which IsMathIntrinsic holds are considered.
+    const std::set<std::string> *math_externs = nullptr;
+
+    // Errors found while lowering go here when set, located at the node
+    // they were found at. Otherwise they are printed.
+    DiagnosticBuffer *diagnostics = nullptr;
+
+    CodegenContext(llvm::Module &module, PrototypeTable &prototypes)
+        : context(module.getContext()), module(module), builder(module.getContext()),
+          prototypes(prototypes) {}
+
+    // Lets the optimizer reassociate and contract floating-point math, and
+    // assume there are no NaNs or infinities, in the code lowered from here.
+    void EnableFastMath();
+
+    // Reports an error found while lowering the node at the location.
+    std::nullptr_t log_error(SourceOffset location, const char *message);
+
+    // Looks up a function in the module, declaring it from the known
+    // prototypes if it was defined in another module.
+    llvm::Function *get_function(const std::string &name);
+
+    // Lowers a subexpression. A shared node is only lowered once per
+    // function; later uses reuse its value while that value is in scope.
+    llvm::Value *codegen(ExprAST &expr);
+    // Values computed in a conditional arm do not dominate the code after
+    // it, so each arm runs in a scope that forgets them on exit.
+    size_t enter_scope();
+    void leave_scope(size_t scope);
+    void clear_shared_values();
+
+    // Emits the entry counters, once the arguments are in place.
+    void emit_entry_profile(llvm::Function *function);
+    // Emits the counters of the next conditional, returning its branch
+    // weights if there is a profile for it.
+    llvm::MDNode *emit_branch_profile(llvm::Value *condition);
+    // Numbers the conditionals from the first one again, for a body that is
+    // lowered more than once.
+    void restart_branch_profile();
+
+    // Debug info: once enabled, every function gets a subprogram and every
+    // expression a line and column, computed from the node source offsets.
+    void EnableDebugInfo(const std::string &filename, const LineTable &lines);
+    void FinalizeDebugInfo();
+    bool has_debug_info();
+    llvm::DISubprogram *create_subprogram(const std::string &name,
+                                          unsigned arg_count,
+                                          SourceOffset location);
+    void emit_location(SourceOffset location);
+    void finish_subprogram();
+
+  private:
+    std::unordered_map<ExprAST *, llvm::Value *> shared_values;
+    std::vector<ExprAST *> shared_order;
+    size_t branch_index = 0;
+
+    std::unique_ptr<llvm::DIBuilder> debug_builder;
+    llvm::DICompileUnit *compile_unit = nullptr;
+    llvm::DISubprogram *scope = nullptr;
+    const LineTable *lines = nullptr;
+};
+
+
+#endif  // CODEGEN_H_
@@ -0,0 +1,68 @@
+#include <algorithm>
+
+#include "diagnostics.h"
+
+
+void DiagnosticBuffer::Report(SourceRange range, const std::string &message)
+{
+    this->diagnostics.push_back({range, message});
+}
+
+
+void DiagnosticBuffer::Clear()
+{
+    this->diagnostics.clear();
+}
+
+
+void DiagnosticBuffer::Sort()
+{
+    std::stable_sort(this->diagnostics.begin(), this->diagnostics.end(),
+                     [](const Diagnostic &a, const Diagnostic &b) {
+                         return a.range.begin < b.range.begin;
+                     });
+}
+
+
+const std::vector<Diagnostic> &DiagnosticBuffer::get_diagnostics() const
+{
+    return this->diagnostics;
+}
+
+
+bool DiagnosticBuffer::empty() const
+{
+    return this->diagnostics.empty();
+}
+
+
+size_t DiagnosticBuffer::size() const
+{
+    return this->diagnostics.size();
+}
+
+
+void DiagnosticBuffer::Print(FILE *output, const LineTable *lines) const
+{
+    for (const Diagnostic &diagnostic : this->diagnostics)
+    {
+        if (lines)
+            fprintf(output, "ERROR: %llu:%llu: %s\n",
+                    static_cast<unsigned long long>(lines->GetLine(diagnostic.range.begin)),
+                    static_cast<unsigned long long>(lines->GetColumn(diagnostic.range.begin)),
+                    diagnostic.message.c_str());
+        else
+            fprintf(output, "ERROR: %s\n", diagnostic.message.c_str());
+    }
+}
+
+
+SourceRange GetTokenRange(const Token &token)
+{
+    // Identifiers, keywords and numbers keep their text; anything else but
+    // the end of input is a single character
+    SourceOffset length = 1;
+    if (!token.identifier.empty() || token.token == tok_eof)
+        length = token.identifier.size();
+    return {token.location, token.location + length};
+}
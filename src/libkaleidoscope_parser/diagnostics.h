@@ -0,0 +1,55 @@
+#ifndef DIAGNOSTICS_H_
+#define DIAGNOSTICS_H_
+
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "libkaleidoscope_lexer/lexer.h"
+
+
+// Byte offsets of the first character and one past the last character of
+// a span of the source.
+struct SourceRange {
+    SourceOffset begin;
+    SourceOffset end;
+};
+
+
+// A parse error, along with the source of the token it was found at.
+struct Diagnostic {
+    SourceRange range;
+    std::string message;
+};
+
+
+// Collects the errors found while parsing, so that a single pass over the
+// input reports all of them instead of stopping at the first.
+class DiagnosticBuffer
+{
+    std::vector<Diagnostic> diagnostics;
+
+  public:
+    void Report(SourceRange range, const std::string &message);
+    void Clear();
+    // Orders the diagnostics by where they begin in the source, keeping the
+    // order they were reported in for the same location.
+    void Sort();
+
+    const std::vector<Diagnostic> &get_diagnostics() const;
+    bool empty() const;
+    size_t size() const;
+
+    // Prints every diagnostic on its own line, prefixed with its line and
+    // column when a line table for the source is given.
+    void Print(FILE *output, const LineTable *lines = nullptr) const;
+};
+
+
+// Range of the source covered by the token.
+SourceRange GetTokenRange(const Token &token);
+
+
+#endif  // DIAGNOSTICS_H_
@@ -2,65 +2,60 @@
 #include <memory>
 #include <iostream>
 #include <vector>
-#include <map>
 
 #include "ast.h"
+#include "grammar.h"
 #include "parser.h"
 #include "libkaleidoscope_lexer/lexer.h"
 
 
-static std::unique_ptr<ExprAST> log_error(const char *str)
+static int is_simple_identifier(Token current_token, Token next_token)
 {
-    fprintf(stderr, "ERROR: %s\n", str);
-    return nullptr;
+    return current_token.token == tok_identifier && next_token.token != '(';
 }
 
 
-static int is_simple_identifier(Token current_token, Token next_token)
+// Counts a level of nesting for as long as it is in scope.
+class NestingScope
 {
-    return current_token.token == tok_identifier && next_token.token != '(';
-}
+    unsigned &depth;
+
+  public:
+    NestingScope(unsigned &depth) : depth(depth) { this->depth++; }
+    ~NestingScope() { this->depth--; }
+};
 
 
-static std::map<char, int> BinaryOpPrecedence = { {'<', 10},
-                                                  {'>', 10},
-                                                  {'+', 20},
-                                                  {'-', 20},
-                                                  {'*', 40},
-                                                  {'/', 40}
-                                                };
 int GetOperatorPrecedence(Token token)
 {
-    // Token must be char token as operator
-    if (!isascii(token.token))
-        return -1;
-
-    int token_precedence = BinaryOpPrecedence[token.token];
-    // Check to make sure token is a known binary operator
-    if (token_precedence <= 0)
-        return -1;
-    return token_precedence;
+    return GetBinaryOperatorPrecedence(token.token);
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParseExpression()
+std::shared_ptr<ExprAST> Parser::ParseExpression()
 {
     Token token = this->get_next_token();
     return this->ParseExpression(token);
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParseExpression(Token current_token)
+std::shared_ptr<ExprAST> Parser::ParseExpression(Token current_token)
 {
-    std::unique_ptr<ExprAST> LHS = this->ParsePrimaryExpr(current_token);
+    std::shared_ptr<ExprAST> LHS = this->ParsePrimaryExpr(current_token);
+    if (!LHS)
+        return nullptr;
     Token next_token = this->get_next_token();
     return ParseBinOpRHS(0, next_token, std::move(LHS));
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParsePrimaryExpr(Token current_token)
+std::shared_ptr<ExprAST> Parser::ParsePrimaryExpr(Token current_token)
 {
-    std::unique_ptr<ExprAST> LHS = nullptr;
+    if (this->depth >= max_expression_depth)
+        return this->log_error(current_token, "expression is nested too deeply!");
+    NestingScope scope(this->depth);
+
+    std::shared_ptr<ExprAST> LHS = nullptr;
     Token next_token = this->get_next_token();
     if (is_simple_identifier(current_token, next_token))
     {
@@ -84,9 +79,16 @@ std::unique_ptr<ExprAST> Parser::ParsePrimaryExpr(Token current_token)
         // paren expr will consume the next token
         LHS = this->ParseParenExpr(current_token, next_token);
     }
+    else if (current_token.token == tok_if)
+    {
+        // if expr will consume the next token
+        LHS = this->ParseIfExpr(current_token, next_token);
+    }
     else
     {
-        return log_error("unknown token when expecting a primary expression!");
+        this->return_token(next_token);
+        return this->log_error(current_token,
+                               "unknown token when expecting a primary expression!");
     }
 
     if (!LHS)
@@ -96,9 +98,9 @@ std::unique_ptr<ExprAST> Parser::ParsePrimaryExpr(Token current_token)
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int expression_precedence,
+std::shared_ptr<ExprAST> Parser::ParseBinOpRHS(int expression_precedence,
                                                Token current_token,
-                                               std::unique_ptr<ExprAST> LHS)
+                                               std::shared_ptr<ExprAST> LHS)
 {
     while (1)
     {
@@ -118,6 +120,7 @@ std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int expression_precedence,
         // The current token is a binary operator with precedence, so parse it
         // with the next primary expr
         int binary_operator = current_token.token;
+        SourceOffset operator_location = current_token.location;
         Token next_token = this->get_next_token();
         auto RHS = this->ParsePrimaryExpr(next_token);
         if (!RHS)
@@ -141,27 +144,27 @@ std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int expression_precedence,
         {
             current_token = next_token;
         }
-        LHS = std::make_unique<BinaryExprAST>(binary_operator,
-                                              std::move(LHS),
-                                              std::move(RHS));
+        LHS = this->make_binary(binary_operator,
+                                std::move(LHS),
+                                std::move(RHS),
+                                operator_location);
     }
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParseNumberExpr(Token token)
+std::shared_ptr<ExprAST> Parser::ParseNumberExpr(Token token)
 {
     if (token.token != tok_number)
-        return log_error("cannot parse number: current token is not a number literal!");
+        return this->log_error(token, "cannot parse number: current token is not a number literal!");
 
-    auto result = std::make_unique<NumberExprAST>(token.number);
-    return std::move(result);
+    return this->make_number(token.number, token.location);
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParseParenExpr(Token token, Token next_token)
+std::shared_ptr<ExprAST> Parser::ParseParenExpr(Token token, Token next_token)
 {
     if (token.token != '(')
-        return log_error("cannot parse parentheses expression: not an open paren!");
+        return this->log_error(token, "cannot parse parentheses expression: not an open paren!");
 
     // parse next token which should be the containing
     // expression within the parentheses.
@@ -172,31 +175,31 @@ std::unique_ptr<ExprAST> Parser::ParseParenExpr(Token token, Token next_token)
     // consume next token, which should be closing paren
     next_token = this->get_next_token();
     if (next_token.token != ')')
-        return log_error("cannot parse parentheses expression: no closing paren!");
+        return this->log_error(next_token, "cannot parse parentheses expression: no closing paren!");
 
     return value;
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParseIdentifierExpr(Token current_token)
+std::shared_ptr<ExprAST> Parser::ParseIdentifierExpr(Token current_token)
 {
     if (current_token.token != tok_identifier)
-        return log_error("cannot parse identifier: not an identifier!");
+        return this->log_error(current_token, "cannot parse identifier: not an identifier!");
 
-    return std::make_unique<VariableExprAST>(current_token.identifier);
+    return this->make_variable(current_token.identifier, current_token.location);
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParseCallExpr(Token current_token, Token next_token)
+std::shared_ptr<ExprAST> Parser::ParseCallExpr(Token current_token, Token next_token)
 {
 
     if (current_token.token != tok_identifier)
-        return log_error("cannot parse call expr: first token not an identifier!");
+        return this->log_error(current_token, "cannot parse call expr: first token not an identifier!");
     if (next_token.token != '(')
-        return log_error("cannot parse call expr: second token not an open paren!");
+        return this->log_error(next_token, "cannot parse call expr: second token not an open paren!");
 
     // parse call args list
-    std::vector<std::unique_ptr<ExprAST>> args;
+    std::vector<std::shared_ptr<ExprAST>> args;
     next_token = this->get_next_token();
     while (next_token.token != ')')
     {
@@ -210,10 +213,83 @@ std::unique_ptr<ExprAST> Parser::ParseCallExpr(Token current_token, Token next_t
             // consume next arg
             next_token = this->get_next_token();
         else if (next_token.token != ')')
-            return log_error("cannot parse function call: expected ')' or ',' in args list!");
+            return this->log_error(next_token,
+                                   "cannot parse function call: expected ')' or ',' in args list!");
 
     }
 
     return std::make_unique<CallExprAST>(current_token.identifier,
-                                         std::move(args));
+                                         std::move(args),
+                                         current_token.location);
+}
+
+
+std::shared_ptr<ExprAST> Parser::ParseIfExpr(Token current_token, Token next_token)
+{
+    if (current_token.token != tok_if)
+        return this->log_error(current_token, "cannot parse if expr: first token not 'if'!");
+
+    // next token starts the condition
+    auto condition = this->ParseExpression(next_token);
+    if (!condition)
+        return nullptr;
+
+    next_token = this->get_next_token();
+    if (next_token.token != tok_then)
+        return this->log_error(next_token, "cannot parse if expr: expected 'then'!");
+    auto then_expr = this->ParseExpression();
+    if (!then_expr)
+        return nullptr;
+
+    next_token = this->get_next_token();
+    if (next_token.token != tok_else)
+        return this->log_error(next_token, "cannot parse if expr: expected 'else'!");
+    auto else_expr = this->ParseExpression();
+    if (!else_expr)
+        return nullptr;
+
+    return this->make_if(std::move(condition),
+                         std::move(then_expr),
+                         std::move(else_expr),
+                         current_token.location);
+}
+
+
+std::shared_ptr<ExprAST> Parser::make_number(double val, SourceOffset location)
+{
+    if (this->hash_cons)
+        return this->hash_cons->Number(val, location);
+    return std::make_unique<NumberExprAST>(val, location);
+}
+
+
+std::shared_ptr<ExprAST> Parser::make_variable(const std::string &name, SourceOffset location)
+{
+    if (this->hash_cons)
+        return this->hash_cons->Variable(name, location);
+    return std::make_unique<VariableExprAST>(name, location);
+}
+
+
+std::shared_ptr<ExprAST> Parser::make_binary(char op,
+                                             std::shared_ptr<ExprAST> left,
+                                             std::shared_ptr<ExprAST> right,
+                                             SourceOffset location)
+{
+    if (this->hash_cons)
+        return this->hash_cons->Binary(op, std::move(left), std::move(right), location);
+    return std::make_unique<BinaryExprAST>(op, std::move(left), std::move(right), location);
+}
+
+
+std::shared_ptr<ExprAST> Parser::make_if(std::shared_ptr<ExprAST> condition,
+                                         std::shared_ptr<ExprAST> then_expr,
+                                         std::shared_ptr<ExprAST> else_expr,
+                                         SourceOffset location)
+{
+    if (this->hash_cons)
+        return this->hash_cons->If(std::move(condition), std::move(then_expr),
+                                   std::move(else_expr), location);
+    return std::make_unique<IfExprAST>(std::move(condition), std::move(then_expr),
+                                       std::move(else_expr), location);
 }
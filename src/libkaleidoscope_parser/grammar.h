@@ -0,0 +1,35 @@
+#ifndef GRAMMAR_H_
+#define GRAMMAR_H_
+
+
+// Rules of the grammar shared by Parser and the compile-time StaticParser,
+// so that both read a source the same way.
+
+
+// Precedence of a binary operator token, or -1 if the token is not one.
+// Operators of higher precedence bind tighter.
+constexpr int GetBinaryOperatorPrecedence(int token)
+{
+    switch (token)
+    {
+        case '<':
+        case '>':
+            return 10;
+        case '+':
+        case '-':
+            return 20;
+        case '*':
+        case '/':
+            return 40;
+        default:
+            return -1;
+    }
+}
+
+
+// Nested expressions are parsed recursively, so deeper ones are rejected
+// before they overflow the stack.
+constexpr unsigned max_expression_depth = 256;
+
+
+#endif  // GRAMMAR_H_
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "hash_cons.h"
+#include "libkaleidoscope_instrumentation/instrumentation.h"
+
+
+enum NodeKind {
+    node_number = 0,
+    node_variable,
+    node_binary,
+    node_if,
+};
+
+
+static const size_t initial_sweep_threshold = 1024;
+
+
+bool HashConsTable::Key::operator==(const Key &other) const
+{
+    return this->kind == other.kind && this->value == other.value && this->name == other.name
+        && this->children[0] == other.children[0] && this->children[1] == other.children[1]
+        && this->children[2] == other.children[2];
+}
+
+
+size_t HashConsTable::KeyHash::operator()(const Key &key) const
+{
+    size_t hash = std::hash<std::string>()(key.name);
+    hash = hash * 31 + key.kind;
+    hash = hash * 31 + std::hash<uint64_t>()(key.value);
+    for (const ExprAST *child : key.children)
+        hash = hash * 31 + std::hash<const ExprAST *>()(child);
+    return hash;
+}
+
+
+HashConsTable::HashConsTable() : sweep_threshold(initial_sweep_threshold) {}
+
+
+std::shared_ptr<ExprAST> HashConsTable::find(const Key &key)
+{
+    auto existing = this->nodes.find(key);
+    if (existing == this->nodes.end())
+        return nullptr;
+
+    // An expired entry can not be matched by a live key, since its children
+    // are gone too, but its key may be reused once they are freed
+    auto node = existing->second.lock();
+    if (node)
+    {
+        node->mark_shared();
+        AddToCounter(counter_shared_ast_nodes);
+    }
+    return node;
+}
+
+
+void HashConsTable::insert(Key key, const std::shared_ptr<ExprAST> &node)
+{
+    if (this->nodes.size() >= this->sweep_threshold)
+    {
+        for (auto entry = this->nodes.begin(); entry != this->nodes.end();)
+        {
+            if (entry->second.expired())
+                entry = this->nodes.erase(entry);
+            else
+                ++entry;
+        }
+        this->sweep_threshold = std::max(initial_sweep_threshold, 2 * this->nodes.size());
+    }
+    this->nodes[std::move(key)] = node;
+}
+
+
+std::shared_ptr<ExprAST> HashConsTable::Number(double val, SourceOffset location)
+{
+    // Compare the bits, so that 0 and -0 stay apart
+    Key key = {node_number, 0, "", {nullptr, nullptr, nullptr}};
+    memcpy(&key.value, &val, sizeof(val));
+    if (auto node = this->find(key))
+        return node;
+
+    std::shared_ptr<ExprAST> node = std::make_unique<NumberExprAST>(val, location);
+    this->insert(std::move(key), node);
+    return node;
+}
+
+
+std::shared_ptr<ExprAST> HashConsTable::Variable(const std::string &name, SourceOffset location)
+{
+    Key key = {node_variable, 0, name, {nullptr, nullptr, nullptr}};
+    if (auto node = this->find(key))
+        return node;
+
+    std::shared_ptr<ExprAST> node = std::make_unique<VariableExprAST>(name, location);
+    this->insert(std::move(key), node);
+    return node;
+}
+
+
+std::shared_ptr<ExprAST> HashConsTable::Binary(char op,
+                                               std::shared_ptr<ExprAST> left,
+                                               std::shared_ptr<ExprAST> right,
+                                               SourceOffset location)
+{
+    Key key = {node_binary, static_cast<uint64_t>(op), "", {left.get(), right.get(), nullptr}};
+    if (auto node = this->find(key))
+        return node;
+
+    std::shared_ptr<ExprAST> node = std::make_unique<BinaryExprAST>(
+        op, std::move(left), std::move(right), location);
+    this->insert(std::move(key), node);
+    return node;
+}
+
+
+std::shared_ptr<ExprAST> HashConsTable::If(std::shared_ptr<ExprAST> condition,
+                                           std::shared_ptr<ExprAST> then_expr,
+                                           std::shared_ptr<ExprAST> else_expr,
+                                           SourceOffset location)
+{
+    Key key = {node_if, 0, "", {condition.get(), then_expr.get(), else_expr.get()}};
+    if (auto node = this->find(key))
+        return node;
+
+    std::shared_ptr<ExprAST> node = std::make_unique<IfExprAST>(
+        std::move(condition), std::move(then_expr), std::move(else_expr), location);
+    this->insert(std::move(key), node);
+    return node;
+}
+
+
+size_t HashConsTable::size()
+{
+    return this->nodes.size();
+}
+
+
+void HashConsTable::Clear()
+{
+    this->nodes.clear();
+    this->sweep_threshold = initial_sweep_threshold;
+}
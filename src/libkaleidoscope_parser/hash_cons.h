@@ -0,0 +1,74 @@
+#ifndef HASH_CONS_H_
+#define HASH_CONS_H_
+
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "ast.h"
+
+
+// Builds expression nodes so that structurally identical subtrees share a
+// single node, turning the tree of a parsed function into a DAG.
+// Children are interned before their parents, so two subtrees are equal
+// exactly when their roots have the same kind, operator or value, and the
+// same child nodes.
+//
+// Calls are never interned, since they may have side effects, and so no
+// subtree containing a call is shared either. A shared node keeps the
+// source location of its first occurrence, so the table is cleared before
+// every top-level item: nodes are never shared between functions, and
+// diagnostics and debug info of a function always point into it.
+//
+// The table only holds weak references: nodes go away with the function
+// using them, and their entries are swept as the table grows.
+class HashConsTable
+{
+    struct Key {
+        int kind;
+        uint64_t value;
+        std::string name;
+        const ExprAST *children[3];
+
+        bool operator==(const Key &other) const;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const;
+    };
+
+    std::unordered_map<Key, std::weak_ptr<ExprAST>, KeyHash> nodes;
+    size_t sweep_threshold;
+
+  public:
+    HashConsTable();
+
+    std::shared_ptr<ExprAST> Number(double val, SourceOffset location = 0);
+    std::shared_ptr<ExprAST> Variable(const std::string &name, SourceOffset location = 0);
+    std::shared_ptr<ExprAST> Binary(char op,
+                                    std::shared_ptr<ExprAST> left,
+                                    std::shared_ptr<ExprAST> right,
+                                    SourceOffset location = 0);
+    std::shared_ptr<ExprAST> If(std::shared_ptr<ExprAST> condition,
+                                std::shared_ptr<ExprAST> then_expr,
+                                std::shared_ptr<ExprAST> else_expr,
+                                SourceOffset location = 0);
+
+    // Number of distinct nodes in the table, including expired ones not yet
+    // swept.
+    size_t size();
+
+    // Forgets every node, so that the nodes built from here on are not
+    // shared with those built before.
+    void Clear();
+
+  private:
+    std::shared_ptr<ExprAST> find(const Key &key);
+    void insert(Key key, const std::shared_ptr<ExprAST> &node);
+};
+
+
+#endif  // HASH_CONS_H_
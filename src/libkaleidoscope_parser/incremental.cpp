@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <algorithm>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <streambuf>
+
+#include "incremental.h"
+#include "parser.h"
+
+
+// Reads a string from an offset on, without copying it.
+class StringInput : public std::streambuf
+{
+  public:
+    StringInput(const std::string &source, size_t offset)
+    {
+        char *begin = const_cast<char *>(source.data());
+        this->setg(begin, begin + offset, begin + source.size());
+    }
+};
+
+
+// Keeps the AST of the single item it is handed.
+class ItemHandler : public TopLevelHandler
+{
+    SourceItem &item;
+
+  public:
+    ItemHandler(SourceItem &item) : item(item) {}
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        this->item.function = std::move(function);
+    }
+    void HandleExtern(std::unique_ptr<PrototypeAST> prototype) override
+    {
+        this->item.prototype = std::move(prototype);
+    }
+    void HandleTopLevelExpression(std::unique_ptr<FunctionAST> function) override
+    {
+        this->item.function = std::move(function);
+    }
+};
+
+
+// Replaces the elements in [begin, end) of the vector with the new ones,
+// moving the elements after them only once.
+template <typename Element>
+static void splice(std::vector<Element> &elements, size_t begin, size_t end,
+                   std::vector<Element> &replacement)
+{
+    size_t common = std::min(end - begin, replacement.size());
+    std::move(replacement.begin(), replacement.begin() + common, elements.begin() + begin);
+    if (common < replacement.size())
+        elements.insert(elements.begin() + end,
+                        std::make_move_iterator(replacement.begin() + common),
+                        std::make_move_iterator(replacement.end()));
+    else
+        elements.erase(elements.begin() + begin + common, elements.begin() + end);
+}
+
+
+static bool same_token(const Token &left, const Token &right)
+{
+    return left.token == right.token && left.identifier == right.identifier;
+}
+
+
+// Source range of the token, as of the current source, for a token of an
+// item that moved by the given displacement since it was lexed.
+static SourceRange moved_range(const Token &token, int64_t displacement)
+{
+    SourceRange range = GetTokenRange(token);
+    range.begin += displacement;
+    range.end += displacement;
+    return range;
+}
+
+
+SourceDocument::SourceDocument(const std::string &source)
+    : source(source)
+{
+    std::vector<Token> lexed;
+    TokenPosition old_stop;
+    this->lex(0, 0, {0, 0}, 0, lexed, old_stop);
+
+    std::vector<SourceItem> parsed;
+    this->parse(std::move(lexed), old_stop, 0, parsed);
+    this->items = std::move(parsed);
+}
+
+
+bool SourceDocument::Edit(size_t begin, size_t end, const std::string &text,
+                          EditStats *stats)
+{
+    if (begin > end || end > this->source.size())
+    {
+        fprintf(stderr, "ERROR: edit range %zu-%zu is outside the source\n", begin, end);
+        return false;
+    }
+    int64_t delta = static_cast<int64_t>(text.size()) - static_cast<int64_t>(end - begin);
+
+    // A token ending where the edit starts may grow into it, and the
+    // whitespace or comment before the edit may change meaning, so lexing
+    // resumes right after the last token before it. The item of that token
+    // ended on the token after it, which may be gone, so parsing starts
+    // over from that item.
+    TokenPosition first_changed = this->find_token(begin);
+    size_t restart = 0;
+    size_t lex_offset = 0;
+    std::vector<Token> fresh;
+    if (first_changed.item > 0 || first_changed.index > 0)
+    {
+        TokenPosition last_kept = first_changed;
+        if (last_kept.index > 0)
+            last_kept.index--;
+        else
+        {
+            last_kept.item--;
+            last_kept.index = this->items[last_kept.item].tokens.size() - 1;
+        }
+        restart = last_kept.item;
+
+        const SourceItem &item = this->items[restart];
+        lex_offset = moved_range(item.tokens[last_kept.index], item.displacement).end;
+        for (size_t i = 0; i <= last_kept.index; i++)
+        {
+            fresh.push_back(item.tokens[i]);
+            fresh.back().location += item.displacement;
+        }
+    }
+
+    this->source.replace(begin, end - begin, text);
+    std::vector<Token> lexed;
+    TokenPosition old_stop;
+    this->lex(lex_offset, begin + text.size(), first_changed, delta, lexed, old_stop);
+    size_t lexed_count = lexed.size();
+    fresh.insert(fresh.end(), std::make_move_iterator(lexed.begin()),
+                 std::make_move_iterator(lexed.end()));
+
+    std::vector<SourceItem> parsed;
+    size_t reused = this->parse(std::move(fresh), old_stop, delta, parsed);
+    size_t parsed_count = parsed.size();
+
+    for (size_t i = reused; i < this->items.size(); i++)
+        this->items[i].displacement += delta;
+    splice(this->items, restart, reused, parsed);
+
+    if (stats)
+    {
+        stats->lexed_tokens = lexed_count;
+        stats->parsed_items = parsed_count;
+        stats->reused_items = this->items.size() - parsed_count;
+    }
+    return true;
+}
+
+
+const std::string &SourceDocument::get_source() const
+{
+    return this->source;
+}
+
+
+const std::vector<SourceItem> &SourceDocument::get_items() const
+{
+    return this->items;
+}
+
+
+std::vector<Token> SourceDocument::GetTokens() const
+{
+    std::vector<Token> tokens;
+    for (const SourceItem &item : this->items)
+    {
+        for (Token token : item.tokens)
+        {
+            token.location += item.displacement;
+            tokens.push_back(std::move(token));
+        }
+    }
+    return tokens;
+}
+
+
+std::vector<Diagnostic> SourceDocument::GetDiagnostics() const
+{
+    std::vector<Diagnostic> diagnostics;
+    for (const SourceItem &item : this->items)
+    {
+        for (Diagnostic diagnostic : item.diagnostics)
+        {
+            diagnostic.range.begin += item.displacement;
+            diagnostic.range.end += item.displacement;
+            diagnostics.push_back(std::move(diagnostic));
+        }
+    }
+    return diagnostics;
+}
+
+
+// Finds the first token ending at or after the offset, or the end of the
+// items if there is none.
+SourceDocument::TokenPosition SourceDocument::find_token(size_t offset)
+{
+    auto item = std::lower_bound(
+        this->items.begin(), this->items.end(), offset,
+        [](const SourceItem &item, size_t offset) {
+            return moved_range(item.tokens.back(), item.displacement).end < offset;
+        });
+    if (item == this->items.end())
+        return {this->items.size(), 0};
+
+    int64_t displacement = item->displacement;
+    auto token = std::lower_bound(
+        item->tokens.begin(), item->tokens.end(), offset,
+        [displacement](const Token &token, size_t offset) {
+            return moved_range(token, displacement).end < offset;
+        });
+    return {static_cast<size_t>(item - this->items.begin()),
+            static_cast<size_t>(token - item->tokens.begin())};
+}
+
+
+void SourceDocument::next_token(TokenPosition &position)
+{
+    if (++position.index == this->items[position.item].tokens.size())
+    {
+        position.item++;
+        position.index = 0;
+    }
+}
+
+
+// Location of the token in the source as it was before the current edit.
+SourceOffset SourceDocument::get_location(TokenPosition position)
+{
+    const SourceItem &item = this->items[position.item];
+    return item.tokens[position.index].location + item.displacement;
+}
+
+
+// Lexes the source from the offset into the given tokens, until the end of
+// input or until a token at or after the unchanged offset lexes the same as
+// an old token, from the given one on, once moved by delta bytes. Sets the
+// old stop to that old token, or to the end of the items.
+void SourceDocument::lex(size_t offset, size_t unchanged_offset, TokenPosition first_old,
+                         int64_t delta, std::vector<Token> &lexed, TokenPosition &old_stop)
+{
+    // Tokens get their offsets in the whole source
+    StringInput buffer(this->source, offset);
+    std::istream input(&buffer);
+    Lexer lexer(input, offset);
+
+    old_stop = first_old;
+    while (1)
+    {
+        Token token = lexer.GetToken();
+        if (token.token == tok_eof)
+        {
+            old_stop = {this->items.size(), 0};
+            return;
+        }
+
+        if (token.location >= unchanged_offset)
+        {
+            int64_t old_location = static_cast<int64_t>(token.location) - delta;
+            while (old_stop.item < this->items.size()
+                   && static_cast<int64_t>(this->get_location(old_stop)) < old_location)
+                this->next_token(old_stop);
+            if (old_stop.item < this->items.size()
+                && static_cast<int64_t>(this->get_location(old_stop)) == old_location
+                && same_token(this->items[old_stop.item].tokens[old_stop.index], token))
+                return;
+        }
+        lexed.push_back(std::move(token));
+    }
+}
+
+
+// Parses the fresh tokens, followed by the old tokens from the old stop on,
+// moved by delta bytes, into items. Stops at the end of input, or once the
+// next item would start where an old item started after the old stop.
+// Returns the index of that old item, which is kept along with the ones
+// after it, or the number of old items if none is.
+size_t SourceDocument::parse(std::vector<Token> fresh, TokenPosition old_stop, int64_t delta,
+                             std::vector<SourceItem> &parsed)
+{
+    const size_t not_kept = static_cast<size_t>(-1);
+
+    // Every token handed to the parser, along with the old item it starts,
+    // if any
+    std::vector<Token> read;
+    std::vector<size_t> starts;
+    size_t fresh_index = 0;
+    TokenPosition old = old_stop;
+    size_t read_count = 0;
+
+    Token eof_token;
+    eof_token.token = tok_eof;
+    eof_token.identifier = "";
+    eof_token.number = std::numeric_limits<double>::quiet_NaN();
+    eof_token.location = this->source.size();
+
+    Parser parser([&]() {
+        read_count++;
+        if (fresh_index < fresh.size())
+        {
+            read.push_back(std::move(fresh[fresh_index++]));
+            starts.push_back(not_kept);
+        }
+        else if (old.item < this->items.size())
+        {
+            read.push_back(this->items[old.item].tokens[old.index]);
+            read.back().location = this->get_location(old) + delta;
+            starts.push_back(old.index == 0 ? old.item : not_kept);
+            this->next_token(old);
+        }
+        else
+            return eof_token;
+        return read.back();
+    });
+
+    size_t position = 0;
+    while (1)
+    {
+        // Look at where the next item starts, without reading it
+        size_t start = not_kept;
+        if (position < read.size())
+            start = starts[position];
+        else if (fresh_index < fresh.size())
+            start = not_kept;
+        else if (old.item < this->items.size())
+            start = old.index == 0 ? old.item : not_kept;
+        else
+            return this->items.size();
+        if (start != not_kept)
+            return start;
+
+        SourceItem item;
+        item.displacement = 0;
+        size_t diagnostic_count = parser.get_diagnostics().size();
+        ItemHandler handler(item);
+        parser.ParseTopLevelItem(handler);
+
+        // Tokens read past the end of input are not part of any item
+        size_t end = std::min(read_count - parser.get_lookahead(), read.size());
+        item.tokens.assign(std::make_move_iterator(read.begin() + position),
+                           std::make_move_iterator(read.begin() + end));
+        auto &diagnostics = parser.get_diagnostics().get_diagnostics();
+        item.diagnostics.assign(diagnostics.begin() + diagnostic_count, diagnostics.end());
+        parsed.push_back(std::move(item));
+        position = end;
+    }
+}
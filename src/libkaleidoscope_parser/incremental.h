@@ -0,0 +1,98 @@
+#ifndef INCREMENTAL_H_
+#define INCREMENTAL_H_
+
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.h"
+#include "diagnostics.h"
+#include "libkaleidoscope_lexer/lexer.h"
+
+
+// A top-level item of a source document: a definition, an extern, a
+// top-level expression, a lone `;`, or an item that failed to parse along
+// with the tokens skipped after it.
+struct SourceItem {
+    std::vector<Token> tokens;
+
+    // Set for definitions and top-level expressions
+    std::unique_ptr<FunctionAST> function;
+    // Set for externs
+    std::unique_ptr<PrototypeAST> prototype;
+    std::vector<Diagnostic> diagnostics;
+
+    // Bytes the item moved by since it was parsed, because of edits before
+    // it. The locations in its tokens, AST and diagnostics are off by this
+    // much.
+    int64_t displacement;
+};
+
+
+// What an edit cost.
+struct EditStats {
+    size_t lexed_tokens;
+    size_t parsed_items;
+    size_t reused_items;
+};
+
+
+// A source buffer kept lexed and parsed across edits, for editors that
+// parse on every keystroke.
+//
+// An edit only lexes from the last token before the edited bytes up to the
+// first token after them that lexes the same as before. Only the items
+// whose tokens changed are parsed again, along with the item before them,
+// whose end depends on the token that follows it. Parsing stops at the
+// first item past the change that starts where an old item started, and
+// the items from there on are kept, ASTs included. Their locations are not
+// rewritten; only their displacement is.
+//
+// Lexing and parsing do not grow with the size of the document, but the
+// items after the change still cost a little each: their displacements are
+// updated and they are moved within the item vector when the number of
+// items changes. An edit is thus linear in the number of items after it,
+// with a small constant, rather than in the number of their tokens.
+class SourceDocument
+{
+    // Position of a token in the items.
+    struct TokenPosition {
+        size_t item;
+        size_t index;
+    };
+
+    std::string source;
+    std::vector<SourceItem> items;
+
+  public:
+    SourceDocument(const std::string &source);
+
+    // Replaces the bytes in [begin, end) of the source with the text. Fails
+    // if the range is not within the source.
+    bool Edit(size_t begin, size_t end, const std::string &text,
+              EditStats *stats = nullptr);
+
+    const std::string &get_source() const;
+    const std::vector<SourceItem> &get_items() const;
+    // Every token of the source, up to but not including the end of input,
+    // and diagnostics of every item, in source order. Locations are as of
+    // the current source.
+    std::vector<Token> GetTokens() const;
+    std::vector<Diagnostic> GetDiagnostics() const;
+
+  private:
+    TokenPosition find_token(size_t offset);
+    void next_token(TokenPosition &position);
+    SourceOffset get_location(TokenPosition position);
+
+    void lex(size_t offset, size_t unchanged_offset, TokenPosition first_old, int64_t delta,
+             std::vector<Token> &lexed, TokenPosition &old_stop);
+    size_t parse(std::vector<Token> fresh, TokenPosition old_stop, int64_t delta,
+                 std::vector<SourceItem> &parsed);
+};
+
+
+#endif  // INCREMENTAL_H_
@@ -2,44 +2,103 @@
 #define PARSER_H_
 
 
+#include <cstddef>
 #include <iostream>
+#include <functional>
 #include <memory>
 #include <deque>
 
 #include "ast.h"
+#include "diagnostics.h"
+#include "hash_cons.h"
 #include "libkaleidoscope_lexer/lexer.h"
 
 
+// Receives each top-level item parsed by Parser::Driver. Items that fail to
+// parse are not handed over; their errors go to the diagnostics of the
+// parser instead.
+class TopLevelHandler
+{
+  public:
+    virtual ~TopLevelHandler() {}
+    virtual void HandleDefinition(std::unique_ptr<FunctionAST> function) {}
+    virtual void HandleExtern(std::unique_ptr<PrototypeAST> prototype) {}
+    virtual void HandleTopLevelExpression(std::unique_ptr<FunctionAST> function) {}
+};
+
+
 class Parser
 {
-    std::istream &input;
+    std::function<Token()> token_source;
     std::deque<Token> buffer = std::deque<Token>();
+    std::unique_ptr<HashConsTable> hash_cons;
+    DiagnosticBuffer diagnostics;
+    // Primary expressions being parsed, nested in one another
+    unsigned depth = 0;
 
   public:
     // Constructors
-    Parser(std::istream &input) : input(input) {}
+    Parser(std::istream &input)
+        : token_source([lexer = Lexer(input)]() mutable { return lexer.GetToken(); }) {}
+    // Reads tokens from the given source instead of lexing an input stream.
+    // The source must keep returning tok_eof once the input is exhausted.
+    Parser(std::function<Token()> token_source)
+        : token_source(std::move(token_source)) {}
 
     // API
-    std::unique_ptr<ExprAST> ParseExpression();
-    std::unique_ptr<ExprAST> ParseExpression(Token token);
+    std::shared_ptr<ExprAST> ParseExpression();
+    std::shared_ptr<ExprAST> ParseExpression(Token token);
     std::unique_ptr<PrototypeAST> ParsePrototype();
 
-    // Test function
+    // Shares structurally identical pure subexpressions within each item
+    // parsed from here on, instead of building a separate tree for each.
+    void EnableHashConsing();
+
+    // Parses every top-level item until the end of input, passing each one
+    // to the handler. Without a handler, the items are dropped. After an
+    // item fails to parse, the rest of it is skipped up to the next `def`,
+    // `extern` or `;`, so that one error does not set off more.
     void Driver();
+    void Driver(TopLevelHandler &handler);
+
+    // Parses a single top-level item, or a lone `;`, as Driver does.
+    // Returns false once the input is exhausted.
+    bool ParseTopLevelItem(TopLevelHandler &handler);
+
+    // Number of tokens read from the source that the parser has not
+    // consumed yet. A top-level item ends this many tokens before the last
+    // token read.
+    size_t get_lookahead() const;
+
+    // Errors found so far. Nothing is printed while parsing.
+    const DiagnosticBuffer &get_diagnostics() const;
 
   private:
     // Helper
     Token get_next_token();
     void return_token(Token token);
+    std::nullptr_t log_error(const Token &token, const char *message);
+    void synchronize();
 
     // Expression parsing methods
-    std::unique_ptr<ExprAST> ParsePrimaryExpr(Token current_token);
-    std::unique_ptr<ExprAST> ParseBinOpRHS(int expression_precedence, Token current_token,
-                                           std::unique_ptr<ExprAST> LHS);
-    std::unique_ptr<ExprAST> ParseNumberExpr(Token token);
-    std::unique_ptr<ExprAST> ParseParenExpr(Token token, Token next_token);
-    std::unique_ptr<ExprAST> ParseIdentifierExpr(Token current_token);
-    std::unique_ptr<ExprAST> ParseCallExpr(Token current_token, Token next_token);
+    std::shared_ptr<ExprAST> ParsePrimaryExpr(Token current_token);
+    std::shared_ptr<ExprAST> ParseBinOpRHS(int expression_precedence, Token current_token,
+                                           std::shared_ptr<ExprAST> LHS);
+    std::shared_ptr<ExprAST> ParseNumberExpr(Token token);
+    std::shared_ptr<ExprAST> ParseParenExpr(Token token, Token next_token);
+    std::shared_ptr<ExprAST> ParseIdentifierExpr(Token current_token);
+    std::shared_ptr<ExprAST> ParseCallExpr(Token current_token, Token next_token);
+    std::shared_ptr<ExprAST> ParseIfExpr(Token current_token, Token next_token);
+
+    // Node construction, through the hash-consing table when enabled
+    std::shared_ptr<ExprAST> make_number(double val, SourceOffset location);
+    std::shared_ptr<ExprAST> make_variable(const std::string &name, SourceOffset location);
+    std::shared_ptr<ExprAST> make_binary(char op, std::shared_ptr<ExprAST> left,
+                                         std::shared_ptr<ExprAST> right, SourceOffset location);
+    std::shared_ptr<ExprAST> make_if(std::shared_ptr<ExprAST> condition,
+                                     std::shared_ptr<ExprAST> then_expr,
+                                     std::shared_ptr<ExprAST> else_expr,
+                                     SourceOffset location);
 
     // Protoype parsing methods
 
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits>
+#include <sstream>
+
+#include "profile.h"
+
+
+ArgumentCounters::ArgumentCounters()
+    : min(std::numeric_limits<double>::infinity()),
+      max(-std::numeric_limits<double>::infinity()) {}
+
+
+FunctionProfile FunctionProfile::FromCounters(const ProfileCounters &counters)
+{
+    FunctionProfile profile;
+    profile.calls = counters.calls.load(std::memory_order_relaxed);
+    for (auto &argument : counters.arguments)
+        profile.arguments.push_back({argument.min.load(std::memory_order_relaxed),
+                                     argument.max.load(std::memory_order_relaxed)});
+    for (auto &branch : counters.branches)
+        profile.branches.push_back({branch.taken.load(std::memory_order_relaxed),
+                                    branch.not_taken.load(std::memory_order_relaxed)});
+    return profile;
+}
+
+
+bool FunctionProfile::is_constant_argument(size_t index) const
+{
+    return this->calls > 0 && index < this->arguments.size()
+        && this->arguments[index].min == this->arguments[index].max;
+}
+
+
+// Doubles are written with enough digits to read back the same value, and
+// read with strtod, which unlike streams also accepts inf and nan.
+static void write_double(std::ostream &output, double value)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.17g", value);
+    output << buffer;
+}
+
+
+static bool read_double(std::istream &input, double &value)
+{
+    std::string text;
+    if (!(input >> text))
+        return false;
+    char *end;
+    value = strtod(text.c_str(), &end);
+    return *end == '\0';
+}
+
+
+void WriteProfiles(std::ostream &output, const ProfileTable &profiles)
+{
+    for (auto &entry : profiles)
+    {
+        const FunctionProfile &profile = entry.second;
+        output << entry.first << " " << profile.calls << " " << profile.arguments.size()
+               << " " << profile.branches.size();
+        for (auto &range : profile.arguments)
+        {
+            output << " ";
+            write_double(output, range.min);
+            output << " ";
+            write_double(output, range.max);
+        }
+        for (auto &branch : profile.branches)
+            output << " " << branch.taken << " " << branch.not_taken;
+        output << "\n";
+    }
+}
+
+
+bool ReadProfiles(std::istream &input, ProfileTable &profiles)
+{
+    ProfileTable read;
+    std::string line;
+    while (std::getline(input, line))
+    {
+        if (line.empty())
+            continue;
+
+        std::istringstream fields(line);
+        std::string name;
+        FunctionProfile profile;
+        size_t argument_count, branch_count;
+        if (!(fields >> name >> profile.calls >> argument_count >> branch_count))
+            return false;
+        // Every argument and branch takes at least two fields of the line,
+        // so larger counts cannot be right, and must not be allocated for
+        if (argument_count > line.size() / 2 || branch_count > line.size() / 2
+            || argument_count + branch_count > line.size() / 2)
+            return false;
+
+        profile.arguments.resize(argument_count);
+        for (auto &range : profile.arguments)
+        {
+            if (!read_double(fields, range.min) || !read_double(fields, range.max))
+                return false;
+        }
+        profile.branches.resize(branch_count);
+        for (auto &branch : profile.branches)
+        {
+            if (!(fields >> branch.taken >> branch.not_taken))
+                return false;
+        }
+        read[name] = std::move(profile);
+    }
+
+    for (auto &entry : read)
+        profiles[entry.first] = std::move(entry.second);
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+// Counters updated by the instrumented code of one function. Generated code
+// writes them with relaxed atomic loads and stores rather than locked
+// read-modify-writes, so concurrent callers may lose a few counts, which is
+// fine for a profile. The deques keep the addresses of the counters stable
+// as codegen adds them.
+struct BranchCounters {
+    std::atomic<uint64_t> taken;
+    std::atomic<uint64_t> not_taken;
+
+    BranchCounters() : taken(0), not_taken(0) {}
+};
+
+
+struct ArgumentCounters {
+    std::atomic<double> min;
+    std::atomic<double> max;
+
+    ArgumentCounters();
+};
+
+
+struct ProfileCounters {
+    std::atomic<uint64_t> calls;
+    std::deque<ArgumentCounters> arguments;
+    std::deque<BranchCounters> branches;
+
+    ProfileCounters() : calls(0) {}
+};
+
+
+// Snapshot of the counters of a function, used to optimize it. Branches are
+// numbered in the order codegen lowers the conditionals of the function.
+struct FunctionProfile {
+    struct Range {
+        double min;
+        double max;
+    };
+    struct Branch {
+        uint64_t taken;
+        uint64_t not_taken;
+    };
+
+    uint64_t calls = 0;
+    std::vector<Range> arguments;
+    std::vector<Branch> branches;
+
+    static FunctionProfile FromCounters(const ProfileCounters &counters);
+
+    // Whether every call so far passed the same value for the argument.
+    bool is_constant_argument(size_t index) const;
+};
+
+
+typedef std::map<std::string, FunctionProfile> ProfileTable;
+
+
+// Profiles are stored as text, one function per line:
+//   name calls arguments branches (min max)... (taken not_taken)...
+void WriteProfiles(std::ostream &output, const ProfileTable &profiles);
+// Returns false, leaving the table untouched, if the input is malformed.
+bool ReadProfiles(std::istream &input, ProfileTable &profiles);
+
+
+#endif  // PROFILE_H_
@@ -7,33 +7,20 @@
 #include "ast.h"
 #include "parser.h"
 #include "libkaleidoscope_lexer/lexer.h"
-
-
-static std::unique_ptr<PrototypeAST> log_error_prototype(const char *str)
-{
-    fprintf(stderr, "ERROR: %s\n", str);
-    return nullptr;
-}
-
-
-static std::unique_ptr<FunctionAST> log_error_function(const char *str)
-{
-    fprintf(stderr, "ERROR: %s\n", str);
-    return nullptr;
-}
+#include "libkaleidoscope_instrumentation/instrumentation.h"
 
 
 std::unique_ptr<PrototypeAST> Parser::ParsePrototype(Token current_token)
 {
     if (current_token.token != tok_identifier)
-        return log_error_prototype("Expected function name in prototype");
+        return this->log_error(current_token, "Expected function name in prototype");
 
     std::string function_name = current_token.identifier;
 
     // Make sure next token is a paren
     Token next_token = this->get_next_token();
     if (next_token.token != '(')
-        return log_error_prototype("Expected '(' after function name in prototype"); 
+        return this->log_error(next_token, "Expected '(' after function name in prototype"); 
 
     // Parse arg list
     std::vector<std::string> arg_names;
@@ -43,7 +30,7 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype(Token current_token)
         if (next_token.token == tok_identifier)
             arg_names.push_back(next_token.identifier);
         else
-            return log_error_prototype("Expected an identifier, ',', or ')' in arg list for prototype definition");
+            return this->log_error(next_token, "Expected an identifier, ',', or ')' in arg list for prototype definition");
 
         next_token = this->get_next_token();
         // Skip comma
@@ -51,14 +38,18 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype(Token current_token)
             next_token = this->get_next_token();
     }
 
-    return std::make_unique<PrototypeAST>(function_name, std::move(arg_names));
+    return std::make_unique<PrototypeAST>(function_name, std::move(arg_names),
+                                          current_token.location);
 }
 
 
 std::unique_ptr<FunctionAST> Parser::ParseDefinition(Token current_token)
 {
+    PhaseTimer timer(phase_parse, "definition");
     if (current_token.token != tok_def)
-        return log_error_function("Function definition must start with def");
+        return this->log_error(current_token, "Function definition must start with def");
+    if (this->hash_cons)
+        this->hash_cons->Clear();
 
     current_token = this->get_next_token();
     auto prototype = this->ParsePrototype(current_token);
@@ -77,8 +68,9 @@ std::unique_ptr<FunctionAST> Parser::ParseDefinition(Token current_token)
 
 std::unique_ptr<PrototypeAST> Parser::ParseExtern(Token current_token)
 {
+    PhaseTimer timer(phase_parse, "extern");
     if (current_token.token != tok_extern)
-        return log_error_prototype("Extern definition must start with extern");
+        return this->log_error(current_token, "Extern definition must start with extern");
 
     current_token = this->get_next_token();
     return this->ParsePrototype(current_token);
@@ -87,11 +79,15 @@ std::unique_ptr<PrototypeAST> Parser::ParseExtern(Token current_token)
 
 std::unique_ptr<FunctionAST> Parser::ParseTopLevelExpr(Token current_token)
 {
+    PhaseTimer timer(phase_parse, "top-level expression");
+    SourceOffset location = current_token.location;
+    if (this->hash_cons)
+        this->hash_cons->Clear();
     auto expression = this->ParseExpression(current_token);
     if (!expression)
         return nullptr;
 
-    auto prototype = std::make_unique<PrototypeAST>("", std::vector<std::string>());
+    auto prototype = std::make_unique<PrototypeAST>("", std::vector<std::string>(), location);
     return std::make_unique<FunctionAST>(std::move(prototype), 
                                          std::move(expression));
 }
@@ -0,0 +1,670 @@
+#ifndef STATIC_PARSER_H_
+#define STATIC_PARSER_H_
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "grammar.h"
+#include "libkaleidoscope_lexer/lexer.h"
+
+
+// Compile-time front-end for sources whose shape is known when the C++
+// program is built. The source is lexed and parsed by constexpr functions
+// that follow GetToken and Parser, and its tree becomes a nest of types
+// whose evaluate functions the compiler can inline into straight-line
+// code, so that nothing is lexed, parsed or compiled at run time:
+//
+//     auto norm = KALEIDOSCOPE_STATIC("def norm(x y) x*x + y*y");
+//     double result = norm(3, 4);
+//
+// The source is a single definition or top-level expression, optionally
+// followed by `;`, and a source that Parser would reject fails to compile.
+// Calls and externs are rejected too, since there is nothing to call at
+// compile time, as are numbers that the constexpr conversion cannot round
+// exactly as strtod does. Numbers with a decimal point and more than 15
+// digits may fall into the latter.
+
+
+enum StaticNodeKind {
+    static_number_node,
+    static_variable_node,
+    static_binary_node,
+    static_if_node,
+};
+
+
+enum StaticParseError {
+    static_parse_ok,
+    static_error_function_name,
+    static_error_prototype_paren,
+    static_error_argument,
+    static_error_primary,
+    static_error_too_deep,
+    static_error_closing_paren,
+    static_error_then,
+    static_error_else,
+    static_error_trailing,
+    static_error_call,
+    static_error_extern,
+    static_error_variable,
+    static_error_number,
+};
+
+
+struct StaticToken {
+    int token;
+    // Range of the token in the source
+    size_t begin;
+    size_t end;
+};
+
+
+struct StaticNode {
+    int kind;
+    // Operator of a binary node
+    int op;
+    // Indices of the operands of a binary node, or of the condition, then
+    // and else expressions of an if node
+    size_t children[3];
+    double number;
+    // Index of the argument a variable node refers to
+    size_t argument;
+};
+
+
+// Nodes of a parsed source, with the operands of a node before the node.
+// Every node comes from a different token, so a source of n bytes needs
+// at most n nodes.
+template <size_t Capacity>
+struct StaticTree {
+    StaticNode nodes[Capacity];
+    size_t size;
+    size_t root;
+    size_t arity;
+    int error;
+    // Offset in the source of the token the error was found at
+    size_t error_location;
+};
+
+
+constexpr bool is_static_space(char character)
+{
+    return character == ' ' || character == '\t' || character == '\n'
+        || character == '\v' || character == '\f' || character == '\r';
+}
+
+
+constexpr bool is_static_alpha(char character)
+{
+    return (character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z');
+}
+
+
+constexpr bool is_static_digit(char character)
+{
+    return character >= '0' && character <= '9';
+}
+
+
+// Whether the range of the source spells the word.
+constexpr bool static_equals(const char *source, size_t begin, size_t end, const char *word)
+{
+    for (size_t i = begin; i < end; i++, word++)
+    {
+        if (!*word || source[i] != *word)
+            return false;
+    }
+    return !*word;
+}
+
+
+// Whether two tokens of the source are spelled the same.
+constexpr bool same_static_spelling(const char *source, const StaticToken &first,
+                                    const StaticToken &second)
+{
+    if (first.end - first.begin != second.end - second.begin)
+        return false;
+    for (size_t i = 0; i < first.end - first.begin; i++)
+    {
+        if (source[first.begin + i] != source[second.begin + i])
+            return false;
+    }
+    return true;
+}
+
+
+constexpr size_t GetStaticLength(const char *source)
+{
+    size_t length = 0;
+    while (source[length])
+        length++;
+    return length;
+}
+
+
+// Lexes the token at or after the offset, as GetToken would.
+constexpr StaticToken GetStaticToken(const char *source, size_t offset)
+{
+    // Skip whitespace and comments
+    while (1)
+    {
+        while (is_static_space(source[offset]))
+            offset++;
+        if (source[offset] != '#')
+            break;
+        while (source[offset] && source[offset] != '\n' && source[offset] != '\r')
+            offset++;
+    }
+
+    StaticToken token{tok_eof, offset, offset};
+    char character = source[offset];
+    if (is_static_alpha(character))
+    {
+        while (is_static_alpha(source[token.end]) || is_static_digit(source[token.end]))
+            token.end++;
+        if (static_equals(source, token.begin, token.end, "def"))
+            token.token = tok_def;
+        else if (static_equals(source, token.begin, token.end, "extern"))
+            token.token = tok_extern;
+        else if (static_equals(source, token.begin, token.end, "if"))
+            token.token = tok_if;
+        else if (static_equals(source, token.begin, token.end, "then"))
+            token.token = tok_then;
+        else if (static_equals(source, token.begin, token.end, "else"))
+            token.token = tok_else;
+        else
+            token.token = tok_identifier;
+    }
+    else if (is_static_digit(character))
+    {
+        while (is_static_digit(source[token.end]) || source[token.end] == '.')
+            token.end++;
+        token.token = tok_number;
+    }
+    else if (character)
+    {
+        token.end++;
+        token.token = static_cast<unsigned char>(character);
+    }
+    return token;
+}
+
+
+// Value of a number token. As with strtod, the digits after a second
+// decimal point are ignored. The value is exact when the digits fit in 64
+// bits and, if there is a fraction, both the digits and the power of ten
+// they are divided by are exact doubles, so that the one rounding of the
+// division is the one strtod makes. Otherwise exact is set to false.
+constexpr double GetStaticNumber(const char *source, size_t begin, size_t end, bool &exact)
+{
+    uint64_t mantissa = 0;
+    int fraction_digits = 0;
+    bool seen_point = false;
+    exact = true;
+    for (size_t i = begin; i < end; i++)
+    {
+        if (source[i] == '.')
+        {
+            if (seen_point)
+                break;
+            seen_point = true;
+            continue;
+        }
+        uint64_t digit = source[i] - '0';
+        if (mantissa > (UINT64_MAX - digit) / 10)
+        {
+            exact = false;
+            return 0;
+        }
+        mantissa = mantissa * 10 + digit;
+        fraction_digits += seen_point;
+    }
+
+    double value = static_cast<double>(mantissa);
+    if (!fraction_digits)
+        return value;
+    if (mantissa > (uint64_t(1) << 53) || fraction_digits > 22)
+    {
+        exact = false;
+        return 0;
+    }
+    double power = 1;
+    for (int i = 0; i < fraction_digits; i++)
+        power *= 10;
+    return value / power;
+}
+
+
+// Parses a source into a StaticTree, in constant expressions. It follows
+// Parser step for step, so that both build the same tree and stop at the
+// same error. After the first error, every method returns at once.
+template <size_t Capacity>
+class StaticParser
+{
+    const char *source;
+    StaticToken token;
+    StaticTree<Capacity> tree;
+    // Ranges of the argument names in the source
+    StaticToken arguments[Capacity];
+    unsigned depth;
+
+  public:
+    constexpr StaticParser(const char *source)
+        : source(source), token{tok_eof, 0, 0}, tree{}, arguments{}, depth(0) {}
+
+    constexpr StaticTree<Capacity> Parse()
+    {
+        this->next();
+        if (this->token.token == tok_def)
+        {
+            this->next();
+            this->parse_prototype();
+        }
+        else if (this->token.token == tok_extern)
+            this->fail(static_error_extern, this->token);
+        this->tree.root = this->parse_expression();
+
+        if (!this->tree.error && this->token.token == ';')
+            this->next();
+        if (!this->tree.error && this->token.token != tok_eof)
+            this->fail(static_error_trailing, this->token);
+
+        // A source that failed to parse leaves a single number, so that the
+        // types built from it stay valid while the error is reported
+        if (this->tree.error)
+        {
+            this->tree.nodes[0] = StaticNode{static_number_node, 0, {0, 0, 0}, 0, 0};
+            this->tree.size = 1;
+            this->tree.root = 0;
+        }
+        return this->tree;
+    }
+
+  private:
+    constexpr void next()
+    {
+        this->token = GetStaticToken(this->source, this->token.end);
+    }
+
+    constexpr size_t fail(int error, const StaticToken &token)
+    {
+        if (!this->tree.error)
+        {
+            this->tree.error = error;
+            this->tree.error_location = token.begin;
+        }
+        return 0;
+    }
+
+    constexpr size_t add_node(const StaticNode &node)
+    {
+        this->tree.nodes[this->tree.size] = node;
+        return this->tree.size++;
+    }
+
+    constexpr void parse_prototype()
+    {
+        if (this->token.token != tok_identifier)
+        {
+            this->fail(static_error_function_name, this->token);
+            return;
+        }
+        this->next();
+        if (this->token.token != '(')
+        {
+            this->fail(static_error_prototype_paren, this->token);
+            return;
+        }
+
+        this->next();
+        while (this->token.token != ')')
+        {
+            if (this->token.token != tok_identifier)
+            {
+                this->fail(static_error_argument, this->token);
+                return;
+            }
+            this->arguments[this->tree.arity++] = this->token;
+            this->next();
+            // Skip comma
+            if (this->token.token == ',')
+                this->next();
+        }
+        this->next();
+    }
+
+    constexpr size_t parse_expression()
+    {
+        size_t left = this->parse_primary();
+        return this->parse_binary_rhs(0, left);
+    }
+
+    constexpr size_t parse_binary_rhs(int expression_precedence, size_t left)
+    {
+        while (!this->tree.error)
+        {
+            int precedence = GetBinaryOperatorPrecedence(this->token.token);
+            if (precedence < expression_precedence)
+                return left;
+
+            int op = this->token.token;
+            this->next();
+            size_t right = this->parse_primary();
+            if (precedence < GetBinaryOperatorPrecedence(this->token.token))
+                right = this->parse_binary_rhs(precedence + 1, right);
+            if (this->tree.error)
+                break;
+            left = this->add_node(StaticNode{static_binary_node, op, {left, right, 0}, 0, 0});
+        }
+        return 0;
+    }
+
+    constexpr size_t parse_primary()
+    {
+        if (this->tree.error)
+            return 0;
+        if (this->depth >= max_expression_depth)
+            return this->fail(static_error_too_deep, this->token);
+
+        this->depth++;
+        size_t node = this->parse_nested_primary();
+        this->depth--;
+        return node;
+    }
+
+    constexpr size_t parse_nested_primary()
+    {
+        StaticToken current = this->token;
+        this->next();
+        switch (current.token)
+        {
+            case tok_identifier:
+                if (this->token.token == '(')
+                    return this->fail(static_error_call, current);
+                return this->parse_variable(current);
+            case tok_number:
+            {
+                bool exact = true;
+                double number = GetStaticNumber(this->source, current.begin, current.end, exact);
+                if (!exact)
+                    return this->fail(static_error_number, current);
+                return this->add_node(StaticNode{static_number_node, 0, {0, 0, 0}, number, 0});
+            }
+            case '(':
+            {
+                size_t node = this->parse_expression();
+                if (this->tree.error)
+                    return 0;
+                if (this->token.token != ')')
+                    return this->fail(static_error_closing_paren, this->token);
+                this->next();
+                return node;
+            }
+            case tok_if:
+                return this->parse_if();
+            default:
+                return this->fail(static_error_primary, current);
+        }
+    }
+
+    // As in generated code, where LLVM renames later arguments of the same
+    // name, a name refers to the first argument it is given to.
+    constexpr size_t parse_variable(const StaticToken &variable)
+    {
+        for (size_t i = 0; i < this->tree.arity; i++)
+        {
+            if (same_static_spelling(this->source, this->arguments[i], variable))
+                return this->add_node(StaticNode{static_variable_node, 0, {0, 0, 0}, 0, i});
+        }
+        return this->fail(static_error_variable, variable);
+    }
+
+    constexpr size_t parse_if()
+    {
+        size_t condition = this->parse_expression();
+        if (this->tree.error)
+            return 0;
+        if (this->token.token != tok_then)
+            return this->fail(static_error_then, this->token);
+        this->next();
+        size_t then_expr = this->parse_expression();
+        if (this->tree.error)
+            return 0;
+        if (this->token.token != tok_else)
+            return this->fail(static_error_else, this->token);
+        this->next();
+        size_t else_expr = this->parse_expression();
+        if (this->tree.error)
+            return 0;
+        return this->add_node(StaticNode{static_if_node, 0, {condition, then_expr, else_expr}, 0, 0});
+    }
+};
+
+
+// The tree of a source, given as a type with a static constexpr get
+// function returning it, as KALEIDOSCOPE_STATIC declares.
+template <typename Source>
+struct StaticSourceTree
+{
+    static constexpr size_t capacity = GetStaticLength(Source::get()) + 1;
+    static constexpr StaticTree<capacity> tree = StaticParser<capacity>(Source::get()).Parse();
+};
+
+
+template <typename Source>
+constexpr size_t StaticSourceTree<Source>::capacity;
+template <typename Source>
+constexpr StaticTree<StaticSourceTree<Source>::capacity> StaticSourceTree<Source>::tree;
+
+
+// Nodes of an evaluator. Each one evaluates to what the code generated for
+// the same node computes, including on NaN.
+template <typename Tree, size_t Index>
+struct StaticNumber
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &)
+    {
+        return Tree::tree.nodes[Index].number;
+    }
+};
+
+
+template <size_t Argument>
+struct StaticVariable
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &args)
+    {
+        return args[Argument];
+    }
+};
+
+
+template <int Op, typename Left, typename Right>
+struct StaticBinary;
+
+
+template <typename Left, typename Right>
+struct StaticBinary<'+', Left, Right>
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &args)
+    {
+        return Left::evaluate(args) + Right::evaluate(args);
+    }
+};
+
+
+template <typename Left, typename Right>
+struct StaticBinary<'-', Left, Right>
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &args)
+    {
+        return Left::evaluate(args) - Right::evaluate(args);
+    }
+};
+
+
+template <typename Left, typename Right>
+struct StaticBinary<'*', Left, Right>
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &args)
+    {
+        return Left::evaluate(args) * Right::evaluate(args);
+    }
+};
+
+
+template <typename Left, typename Right>
+struct StaticBinary<'/', Left, Right>
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &args)
+    {
+        return Left::evaluate(args) / Right::evaluate(args);
+    }
+};
+
+
+// Unordered less than, which holds when either side is NaN
+template <typename Left, typename Right>
+struct StaticBinary<'<', Left, Right>
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &args)
+    {
+        return !(Left::evaluate(args) >= Right::evaluate(args)) ? 1.0 : 0.0;
+    }
+};
+
+
+// Unordered greater than, which holds when either side is NaN
+template <typename Left, typename Right>
+struct StaticBinary<'>', Left, Right>
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &args)
+    {
+        return !(Left::evaluate(args) <= Right::evaluate(args)) ? 1.0 : 0.0;
+    }
+};
+
+
+// The condition holds when it is ordered and not zero, so NaN is false
+template <typename Condition, typename Then, typename Else>
+struct StaticIf
+{
+    template <size_t Arity>
+    static constexpr double evaluate(const std::array<double, Arity> &args)
+    {
+        double condition = Condition::evaluate(args);
+        return condition < 0 || condition > 0 ? Then::evaluate(args) : Else::evaluate(args);
+    }
+};
+
+
+// Type of the evaluator of a node of the tree.
+template <typename Tree, size_t Index, int Kind = Tree::tree.nodes[Index].kind>
+struct StaticNodeType;
+
+
+template <typename Tree, size_t Index>
+struct StaticNodeType<Tree, Index, static_number_node>
+{
+    typedef StaticNumber<Tree, Index> type;
+};
+
+
+template <typename Tree, size_t Index>
+struct StaticNodeType<Tree, Index, static_variable_node>
+{
+    typedef StaticVariable<Tree::tree.nodes[Index].argument> type;
+};
+
+
+template <typename Tree, size_t Index>
+struct StaticNodeType<Tree, Index, static_binary_node>
+{
+    typedef StaticBinary<Tree::tree.nodes[Index].op,
+                         typename StaticNodeType<Tree, Tree::tree.nodes[Index].children[0]>::type,
+                         typename StaticNodeType<Tree, Tree::tree.nodes[Index].children[1]>::type>
+        type;
+};
+
+
+template <typename Tree, size_t Index>
+struct StaticNodeType<Tree, Index, static_if_node>
+{
+    typedef StaticIf<typename StaticNodeType<Tree, Tree::tree.nodes[Index].children[0]>::type,
+                     typename StaticNodeType<Tree, Tree::tree.nodes[Index].children[1]>::type,
+                     typename StaticNodeType<Tree, Tree::tree.nodes[Index].children[2]>::type>
+        type;
+};
+
+
+// Evaluator of a source, called with one number per argument of the
+// definition, or none for a top-level expression. Errors in the source are
+// reported with the message Parser or code generation would give.
+template <typename Source>
+class StaticFunction
+{
+    typedef StaticSourceTree<Source> Tree;
+    static constexpr int error = Tree::tree.error;
+
+    static_assert(error != static_error_function_name, "Expected function name in prototype");
+    static_assert(error != static_error_prototype_paren,
+                  "Expected '(' after function name in prototype");
+    static_assert(error != static_error_argument,
+                  "Expected an identifier, ',', or ')' in arg list for prototype definition");
+    static_assert(error != static_error_primary,
+                  "unknown token when expecting a primary expression!");
+    static_assert(error != static_error_too_deep, "expression is nested too deeply!");
+    static_assert(error != static_error_closing_paren,
+                  "cannot parse parentheses expression: no closing paren!");
+    static_assert(error != static_error_then, "cannot parse if expr: expected 'then'!");
+    static_assert(error != static_error_else, "cannot parse if expr: expected 'else'!");
+    static_assert(error != static_error_trailing,
+                  "a static source holds a single definition or top-level expression");
+    static_assert(error != static_error_call, "calls are not supported in static sources");
+    static_assert(error != static_error_extern, "externs are not supported in static sources");
+    static_assert(error != static_error_variable, "Unknown variable name");
+    static_assert(error != static_error_number,
+                  "number cannot be converted exactly at compile time");
+
+  public:
+    typedef typename StaticNodeType<Tree, Tree::tree.root>::type Body;
+    static constexpr size_t arity = Tree::tree.arity;
+
+    template <typename... Args>
+    static constexpr double Evaluate(Args... args)
+    {
+        static_assert(sizeof...(Args) == arity, "wrong number of arguments");
+        return Body::evaluate(std::array<double, arity>{{static_cast<double>(args)...}});
+    }
+
+    template <typename... Args>
+    constexpr double operator()(Args... args) const
+    {
+        return Evaluate(args...);
+    }
+};
+
+
+// Evaluator of a string literal, of type StaticFunction. The literal is
+// wrapped in a local type, since a string cannot be a template argument.
+#define KALEIDOSCOPE_STATIC(source)                                             \
+    ([]() {                                                                     \
+        struct Source                                                           \
+        {                                                                       \
+            static constexpr const char *get() { return source; }               \
+        };                                                                      \
+        return StaticFunction<Source>();                                        \
+    }())
+
+
+#endif  // STATIC_PARSER_H_
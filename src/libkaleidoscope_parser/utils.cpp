@@ -7,7 +7,7 @@ Token Parser::get_next_token()
     // Get directly from input if buffer is empty
     if (this->buffer.empty())
     {
-        return GetToken(this->input);
+        return this->token_source();
     }
     // Otherwise get from buffer and consume it
     else
@@ -27,26 +27,103 @@ void Parser::return_token(Token token)
 }
 
 
-void Parser::Driver()
+// Whether parsing can resume at the token after an error.
+static bool is_synchronization_token(const Token &token)
+{
+    return token.token == tok_def || token.token == tok_extern
+        || token.token == ';' || token.token == tok_eof;
+}
+
+
+// Records an error at the token. A token the parser can resume at is given
+// back, so that the item it starts is not skipped along with the bad one.
+std::nullptr_t Parser::log_error(const Token &token, const char *message)
+{
+    this->diagnostics.Report(GetTokenRange(token), message);
+    if (is_synchronization_token(token))
+        this->return_token(token);
+    return nullptr;
+}
+
+
+// Skips the rest of an item that failed to parse, up to and including the
+// next `;`, or up to the next `def`, `extern` or the end of input.
+void Parser::synchronize()
 {
     while (1)
     {
-        Token current_token = this->get_next_token();
-        switch (current_token.token)
+        Token token = this->get_next_token();
+        if (token.token == ';')
+            return;
+        if (is_synchronization_token(token))
         {
-            case tok_eof:
-                return;
-            case ';':
-                break;
-            case tok_def:
-                this->ParseDefinition(current_token);
-                break;
-            case tok_extern:
-                this->ParseExtern(current_token);
-                break;
-            default:
-                this->ParseTopLevelExpr(current_token);
-                break;
+            this->return_token(token);
+            return;
         }
     }
 }
+
+
+const DiagnosticBuffer &Parser::get_diagnostics() const
+{
+    return this->diagnostics;
+}
+
+
+void Parser::EnableHashConsing()
+{
+    if (!this->hash_cons)
+        this->hash_cons = std::make_unique<HashConsTable>();
+}
+
+
+void Parser::Driver()
+{
+    TopLevelHandler handler;
+    this->Driver(handler);
+}
+
+
+void Parser::Driver(TopLevelHandler &handler)
+{
+    while (this->ParseTopLevelItem(handler))
+        ;
+}
+
+
+bool Parser::ParseTopLevelItem(TopLevelHandler &handler)
+{
+    Token current_token = this->get_next_token();
+    switch (current_token.token)
+    {
+        case tok_eof:
+            return false;
+        case ';':
+            break;
+        case tok_def:
+            if (auto function = this->ParseDefinition(current_token))
+                handler.HandleDefinition(std::move(function));
+            else
+                this->synchronize();
+            break;
+        case tok_extern:
+            if (auto prototype = this->ParseExtern(current_token))
+                handler.HandleExtern(std::move(prototype));
+            else
+                this->synchronize();
+            break;
+        default:
+            if (auto function = this->ParseTopLevelExpr(current_token))
+                handler.HandleTopLevelExpression(std::move(function));
+            else
+                this->synchronize();
+            break;
+    }
+    return true;
+}
+
+
+size_t Parser::get_lookahead() const
+{
+    return this->buffer.size();
+}
@@ -0,0 +1,195 @@
+#include <chrono>
+#include <thread>
+
+#include "pipeline.h"
+
+
+typedef std::chrono::steady_clock Clock;
+
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+// Pushes the value, adding the time spent waiting for room. The clock is
+// only read when the queue is full.
+template <typename T>
+static void timed_push(RingBuffer<T> &queue, T &value, double &waited_seconds)
+{
+    if (queue.try_push(value))
+        return;
+
+    auto start = Clock::now();
+    queue.push(value);
+    waited_seconds += seconds_since(start);
+}
+
+
+// Pops a value, adding the time spent waiting for one. The clock is only
+// read when the queue is empty.
+template <typename T>
+static void timed_pop(RingBuffer<T> &queue, T &value, double &waited_seconds)
+{
+    if (queue.try_pop(value))
+        return;
+
+    auto start = Clock::now();
+    queue.pop(value);
+    waited_seconds += seconds_since(start);
+}
+
+
+// Hands the items parsed by the driver over to the backend queue.
+class ItemQueueHandler : public TopLevelHandler
+{
+    RingBuffer<TopLevelItem> &items;
+    StageMetrics &metrics;
+
+  public:
+    ItemQueueHandler(RingBuffer<TopLevelItem> &items, StageMetrics &metrics)
+        : items(items), metrics(metrics) {}
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        TopLevelItem item;
+        item.kind = item_definition;
+        item.function = std::move(function);
+        this->push(item);
+    }
+
+    void HandleExtern(std::unique_ptr<PrototypeAST> prototype) override
+    {
+        TopLevelItem item;
+        item.kind = item_extern;
+        item.prototype = std::move(prototype);
+        this->push(item);
+    }
+
+    void HandleTopLevelExpression(std::unique_ptr<FunctionAST> function) override
+    {
+        TopLevelItem item;
+        item.kind = item_expression;
+        item.function = std::move(function);
+        this->push(item);
+    }
+
+    void push(TopLevelItem &item)
+    {
+        timed_push(this->items, item, this->metrics.blocked_seconds);
+        this->metrics.items++;
+    }
+};
+
+
+double StageMetrics::get_occupancy(double wall_seconds) const
+{
+    if (wall_seconds <= 0)
+        return 0;
+    return this->busy_seconds / wall_seconds;
+}
+
+
+void Pipeline::Run(std::istream &input)
+{
+    this->metrics = PipelineMetrics();
+    RingBuffer<Token> tokens(this->options.token_queue_capacity);
+    RingBuffer<TopLevelItem> items(this->options.item_queue_capacity);
+    auto start = Clock::now();
+
+    std::thread lexer_thread([&]() {
+        StageMetrics &metrics = this->metrics.lexer;
+        auto lexer_start = Clock::now();
+        Lexer lexer(input);
+        while (1)
+        {
+            Token token = lexer.GetToken();
+            bool is_eof = token.token == tok_eof;
+            timed_push(tokens, token, metrics.blocked_seconds);
+            metrics.items++;
+            if (is_eof)
+                break;
+        }
+        metrics.busy_seconds = seconds_since(lexer_start) - metrics.blocked_seconds;
+    });
+
+    std::thread parser_thread([&]() {
+        StageMetrics &metrics = this->metrics.parser;
+        auto parser_start = Clock::now();
+
+        // The parser may ask for more tokens after the end of input, which
+        // the lexer would answer with more eof tokens.
+        bool finished = false;
+        Token eof_token;
+        Parser parser([&]() {
+            if (finished)
+                return eof_token;
+            Token token;
+            timed_pop(tokens, token, metrics.starved_seconds);
+            if (token.token == tok_eof)
+            {
+                finished = true;
+                eof_token = token;
+            }
+            return token;
+        });
+        if (this->options.hash_consing)
+            parser.EnableHashConsing();
+
+        ItemQueueHandler handler(items, metrics);
+        parser.Driver(handler);
+        parser.get_diagnostics().Print(stderr);
+
+        TopLevelItem end;
+        handler.push(end);
+        metrics.items--;
+        metrics.busy_seconds = seconds_since(parser_start)
+            - metrics.starved_seconds - metrics.blocked_seconds;
+    });
+
+    // Run the backend on this thread
+    StageMetrics &metrics = this->metrics.backend;
+    auto backend_start = Clock::now();
+    while (1)
+    {
+        TopLevelItem item;
+        timed_pop(items, item, metrics.starved_seconds);
+        if (item.kind == item_end)
+            break;
+
+        switch (item.kind)
+        {
+            case item_definition:
+                this->backend.HandleDefinition(std::move(item.function));
+                break;
+            case item_extern:
+                this->backend.HandleExtern(std::move(item.prototype));
+                break;
+            case item_expression:
+                this->backend.HandleTopLevelExpression(std::move(item.function));
+                break;
+            default:
+                break;
+        }
+        metrics.items++;
+    }
+    metrics.busy_seconds = seconds_since(backend_start) - metrics.starved_seconds;
+
+    lexer_thread.join();
+    parser_thread.join();
+
+    this->metrics.wall_seconds = seconds_since(start);
+    this->metrics.tokens.capacity = tokens.capacity();
+    this->metrics.tokens.pushes = tokens.get_pushes();
+    this->metrics.tokens.average_occupancy = tokens.get_average_occupancy();
+    this->metrics.items.capacity = items.capacity();
+    this->metrics.items.pushes = items.get_pushes();
+    this->metrics.items.average_occupancy = items.get_average_occupancy();
+}
+
+
+const PipelineMetrics &Pipeline::get_metrics()
+{
+    return this->metrics;
+}
@@ -0,0 +1,94 @@
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+
+#include "ring_buffer.h"
+#include "libkaleidoscope_lexer/lexer.h"
+#include "libkaleidoscope_parser/ast.h"
+#include "libkaleidoscope_parser/parser.h"
+
+
+enum ItemKind {
+    item_end = 0,
+    item_definition,
+    item_extern,
+    item_expression,
+};
+
+
+// A parsed top-level item on its way from the parser to the backend.
+struct TopLevelItem {
+    ItemKind kind = item_end;
+    std::unique_ptr<FunctionAST> function;
+    std::unique_ptr<PrototypeAST> prototype;
+};
+
+
+struct PipelineOptions {
+    size_t token_queue_capacity = 4096;
+    size_t item_queue_capacity = 64;
+    // Share identical subexpressions within each parsed item
+    bool hash_consing = false;
+};
+
+
+// Where a stage spent its time. Starved is time spent waiting for input from
+// the previous stage, blocked is time spent waiting for room in the queue to
+// the next stage. The rest of the time the stage was busy.
+struct StageMetrics {
+    double busy_seconds = 0;
+    double starved_seconds = 0;
+    double blocked_seconds = 0;
+    uint64_t items = 0;
+
+    // Fraction of the pipeline wall-clock time the stage was busy
+    double get_occupancy(double wall_seconds) const;
+};
+
+
+struct QueueMetrics {
+    size_t capacity = 0;
+    uint64_t pushes = 0;
+    double average_occupancy = 0;
+};
+
+
+struct PipelineMetrics {
+    double wall_seconds = 0;
+    StageMetrics lexer;
+    StageMetrics parser;
+    StageMetrics backend;
+    QueueMetrics tokens;
+    QueueMetrics items;
+};
+
+
+// Runs the lexer, the parser and a backend on separate threads, connected by
+// bounded single-producer single-consumer queues. A full queue blocks its
+// producer, so a slow stage throttles the stages in front of it instead of
+// letting the queues grow. The backend runs on the calling thread.
+class Pipeline
+{
+    TopLevelHandler &backend;
+    PipelineOptions options;
+    PipelineMetrics metrics;
+
+  public:
+    Pipeline(TopLevelHandler &backend, const PipelineOptions &options = PipelineOptions())
+        : backend(backend), options(options) {}
+
+    // Processes every top-level item of the input, returning once the
+    // backend has handled them all.
+    void Run(std::istream &input);
+
+    // Metrics of the last run
+    const PipelineMetrics &get_metrics();
+};
+
+
+#endif  // PIPELINE_H_
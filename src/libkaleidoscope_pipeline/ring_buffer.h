@@ -0,0 +1,167 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. The producer only writes the tail and the consumer only writes the
+// head, so each side needs a single atomic store per operation.
+//
+// A side that has to wait for the other spins for a bounded number of
+// attempts, since the other side is usually just behind, and then sleeps on
+// a condition variable until the other side pushes or pops. Sides only take
+// the lock when the other one is asleep.
+template <typename T>
+class RingBuffer
+{
+    // Attempts before a waiting side goes to sleep
+    static const unsigned spin_limit = 128;
+
+    std::vector<T> slots;
+    size_t mask;
+
+    // Kept on separate cache lines so the two threads do not contend
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+
+    // Whether a side is asleep, or about to, waiting for the other
+    alignas(64) std::atomic<unsigned> sleepers;
+    std::mutex sleep_mutex;
+    std::condition_variable changed;
+
+    // Producer side statistics, for the occupancy metrics
+    uint64_t pushes = 0;
+    uint64_t occupancy_total = 0;
+
+  public:
+    // The capacity is rounded up to a power of two.
+    RingBuffer(size_t capacity) : head(0), tail(0), sleepers(0)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        this->slots.resize(size);
+        this->mask = size - 1;
+    }
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    size_t capacity() const
+    {
+        return this->slots.size();
+    }
+
+    // Producer: returns false without blocking if the queue is full.
+    bool try_push(T &value)
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        size_t head = this->head.load(std::memory_order_acquire);
+        if (tail - head == this->slots.size())
+            return false;
+
+        this->slots[tail & this->mask] = std::move(value);
+        this->tail.store(tail + 1, std::memory_order_release);
+
+        this->pushes++;
+        this->occupancy_total += tail + 1 - head;
+        this->wake_up();
+        return true;
+    }
+
+    // Producer: pushes the value, waiting for room if the queue is full.
+    void push(T &value)
+    {
+        for (unsigned attempts = 1; !this->try_push(value); attempts++)
+        {
+            if (attempts < spin_limit)
+                std::this_thread::yield();
+            else
+                this->sleep([this]() {
+                    return this->tail.load(std::memory_order_relaxed)
+                        - this->head.load(std::memory_order_acquire) < this->slots.size();
+                });
+        }
+    }
+
+    // Consumer: returns false without blocking if the queue is empty.
+    bool try_pop(T &value)
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        size_t tail = this->tail.load(std::memory_order_acquire);
+        if (head == tail)
+            return false;
+
+        value = std::move(this->slots[head & this->mask]);
+        this->head.store(head + 1, std::memory_order_release);
+        this->wake_up();
+        return true;
+    }
+
+    // Consumer: pops a value, waiting for one if the queue is empty.
+    void pop(T &value)
+    {
+        for (unsigned attempts = 1; !this->try_pop(value); attempts++)
+        {
+            if (attempts < spin_limit)
+                std::this_thread::yield();
+            else
+                this->sleep([this]() {
+                    return this->head.load(std::memory_order_relaxed)
+                        != this->tail.load(std::memory_order_acquire);
+                });
+        }
+    }
+
+    // Number of pushes so far. Only meaningful once the producer is done.
+    uint64_t get_pushes() const
+    {
+        return this->pushes;
+    }
+
+    // Average number of queued elements seen right after each push. Only
+    // meaningful once the producer is done.
+    double get_average_occupancy() const
+    {
+        if (this->pushes == 0)
+            return 0;
+        return static_cast<double>(this->occupancy_total) / this->pushes;
+    }
+
+  private:
+    // Sleeps until the side is ready to go on. The fence pairs with the one
+    // in wake_up: either the other side sees this one asleep, or this one
+    // sees what the other side did.
+    template <typename Ready>
+    void sleep(Ready ready)
+    {
+        std::unique_lock<std::mutex> lock(this->sleep_mutex);
+        this->sleepers.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        this->changed.wait(lock, ready);
+        this->sleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void wake_up()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->sleepers.load(std::memory_order_relaxed) == 0)
+            return;
+        // Taking the lock makes sure the sleeper is waiting, not still
+        // checking whether it is ready
+        std::lock_guard<std::mutex> lock(this->sleep_mutex);
+        this->changed.notify_all();
+    }
+};
+
+
+#endif  // RING_BUFFER_H_
@@ -0,0 +1,118 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "client.h"
+
+
+CompileClient::~CompileClient()
+{
+    if (this->fd >= 0)
+        close(this->fd);
+}
+
+
+bool CompileClient::Connect(const std::string &socket_path)
+{
+    struct sockaddr_un address;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "ERROR: socket path too long: %s\n", socket_path.c_str());
+        return false;
+    }
+
+    this->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (this->fd < 0)
+    {
+        fprintf(stderr, "ERROR: could not create socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    if (connect(this->fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        fprintf(stderr, "ERROR: could not connect to %s: %s\n", socket_path.c_str(), strerror(errno));
+        close(this->fd);
+        this->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+
+bool CompileClient::Request(const std::string &source, std::string &response)
+{
+    if (this->fd < 0)
+        return false;
+
+    // Requests are a single line
+    std::string line = source;
+    std::replace(line.begin(), line.end(), '\n', ' ');
+    line += '\n';
+
+    size_t written = 0;
+    while (written < line.size())
+    {
+        ssize_t count = send(this->fd, line.data() + written, line.size() - written, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        written += count;
+    }
+
+    size_t newline;
+    while ((newline = this->pending.find('\n')) == std::string::npos)
+    {
+        char buffer[4096];
+        ssize_t count = recv(this->fd, buffer, sizeof(buffer), 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        this->pending.append(buffer, count);
+    }
+
+    response = this->pending.substr(0, newline);
+    this->pending.erase(0, newline + 1);
+    return true;
+}
+
+
+// Value below which the given fraction of the sorted samples fall.
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    size_t rank = static_cast<size_t>(ceil(fraction * sorted.size()));
+    if (rank == 0)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+
+LatencyStats ComputeLatencyStats(std::vector<double> &samples)
+{
+    LatencyStats stats;
+    if (samples.empty())
+        return stats;
+
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (double sample : samples)
+        total += sample;
+
+    stats.count = samples.size();
+    stats.mean = total / samples.size();
+    stats.p50 = percentile(samples, 0.5);
+    stats.p90 = percentile(samples, 0.9);
+    stats.p99 = percentile(samples, 0.99);
+    stats.p999 = percentile(samples, 0.999);
+    stats.max = samples.back();
+    return stats;
+}
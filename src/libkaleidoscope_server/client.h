@@ -0,0 +1,47 @@
+#ifndef CLIENT_H_
+#define CLIENT_H_
+
+
+#include <string>
+#include <vector>
+
+
+// Client side of the CompileServer protocol.
+class CompileClient
+{
+    int fd = -1;
+    std::string pending;
+
+  public:
+    CompileClient() {}
+    ~CompileClient();
+
+    CompileClient(const CompileClient &) = delete;
+    CompileClient &operator=(const CompileClient &) = delete;
+
+    // Returns false, after logging why, if the server is not reachable.
+    bool Connect(const std::string &socket_path);
+
+    // Sends one request line and waits for its response line. Returns false
+    // if the connection was lost.
+    bool Request(const std::string &source, std::string &response);
+};
+
+
+// Summary of a set of latency samples, in seconds.
+struct LatencyStats {
+    size_t count = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    double max = 0;
+};
+
+
+// Nearest-rank percentiles of the samples, which are sorted in place.
+LatencyStats ComputeLatencyStats(std::vector<double> &samples);
+
+
+#endif  // CLIENT_H_
@@ -0,0 +1,320 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <sstream>
+#include <vector>
+
+#include "server.h"
+
+
+static bool log_error_errno(const char *str)
+{
+    fprintf(stderr, "ERROR: %s: %s\n", str, strerror(errno));
+    return false;
+}
+
+
+// Writes all of the buffer, retrying on short writes.
+static bool write_all(int fd, const std::string &data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t count = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        written += count;
+    }
+    return true;
+}
+
+
+CompileServer::~CompileServer()
+{
+    this->Stop();
+}
+
+
+bool CompileServer::Start()
+{
+    struct sockaddr_un address;
+    if (this->socket_path.size() >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "ERROR: socket path too long: %s\n", this->socket_path.c_str());
+        return false;
+    }
+
+    this->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (this->listen_fd < 0)
+        return log_error_errno("could not create socket");
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, this->socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    // Replace any socket left behind by a previous server
+    unlink(this->socket_path.c_str());
+    if (bind(this->listen_fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) < 0
+        || listen(this->listen_fd, SOMAXCONN) < 0)
+    {
+        log_error_errno("could not listen on socket");
+        close(this->listen_fd);
+        this->listen_fd = -1;
+        return false;
+    }
+
+    if (pipe2(this->wakeup_fds, O_NONBLOCK | O_CLOEXEC) < 0)
+    {
+        log_error_errno("could not create wakeup pipe");
+        close(this->listen_fd);
+        this->listen_fd = -1;
+        return false;
+    }
+
+    this->pool = std::make_unique<ThreadPool>(this->worker_count);
+    this->running = true;
+    this->event_thread = std::thread([this]() { this->event_loop(); });
+    return true;
+}
+
+
+void CompileServer::Stop()
+{
+    if (!this->running.exchange(false))
+        return;
+
+    this->wake_up();
+    this->event_thread.join();
+    close(this->listen_fd);
+    this->listen_fd = -1;
+    unlink(this->socket_path.c_str());
+
+    // Requests in flight finish, but their clients may be gone already
+    {
+        std::lock_guard<std::mutex> lock(this->connections_mutex);
+        for (auto &connection : this->connections)
+            shutdown(connection.first, SHUT_RDWR);
+    }
+    this->pool.reset();
+
+    for (auto &connection : this->connections)
+        close(connection.first);
+    this->connections.clear();
+    close(this->wakeup_fds[0]);
+    close(this->wakeup_fds[1]);
+    this->wakeup_fds[0] = this->wakeup_fds[1] = -1;
+}
+
+
+std::string CompileServer::HandleRequest(const std::string &source)
+{
+    RunResult result;
+    std::istringstream input(source);
+    this->session.Run(input, result);
+
+    if (!result.diagnostics.empty())
+    {
+        // Locations are relative to the request, not to any source the
+        // session was given before
+        LineTable lines(source);
+        std::string response("error");
+        const char *separator = " ";
+        for (const Diagnostic &diagnostic : result.diagnostics.get_diagnostics())
+        {
+            char location[48];
+            snprintf(location, sizeof(location), "%llu:%llu: ",
+                     static_cast<unsigned long long>(lines.GetLine(diagnostic.range.begin)),
+                     static_cast<unsigned long long>(lines.GetColumn(diagnostic.range.begin)));
+            response += separator;
+            response += location;
+            response += diagnostic.message;
+            separator = "; ";
+        }
+        return response;
+    }
+
+    std::string response("ok");
+    for (double value : result.values)
+    {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), " %.17g", value);
+        response += buffer;
+    }
+    return response;
+}
+
+
+// Waits for new clients, for requests of the connections that have none in
+// flight, and for answered requests, until the server is stopped.
+void CompileServer::event_loop()
+{
+    std::vector<struct pollfd> polled;
+    while (this->running)
+    {
+        polled.clear();
+        polled.push_back({this->listen_fd, POLLIN, 0});
+        polled.push_back({this->wakeup_fds[0], POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lock(this->connections_mutex);
+            for (auto &connection : this->connections)
+            {
+                if (!connection.second.busy && !connection.second.closed)
+                    polled.push_back({connection.first, POLLIN, 0});
+            }
+        }
+
+        if (poll(polled.data(), polled.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error_errno("could not wait for clients");
+            return;
+        }
+        if (!this->running)
+            return;
+
+        if (polled[1].revents)
+        {
+            char buffer[64];
+            while (read(this->wakeup_fds[0], buffer, sizeof(buffer)) > 0)
+                ;
+        }
+        if (polled[0].revents)
+            this->accept_connection();
+        for (size_t i = 2; i < polled.size(); i++)
+        {
+            if (polled[i].revents)
+                this->receive(polled[i].fd);
+        }
+        this->dispatch_requests();
+    }
+}
+
+
+void CompileServer::accept_connection()
+{
+    int fd = accept(this->listen_fd, nullptr, nullptr);
+    if (fd < 0)
+    {
+        if (errno != EINTR)
+            log_error_errno("could not accept client");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(this->connections_mutex);
+    this->connections[fd];
+}
+
+
+// Reads what the client sent. Only called while no request of the
+// connection is in flight.
+void CompileServer::receive(int fd)
+{
+    char buffer[4096];
+    ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+    if (count < 0 && errno == EINTR)
+        return;
+
+    std::lock_guard<std::mutex> lock(this->connections_mutex);
+    Connection &connection = this->connections[fd];
+    if (count <= 0)
+    {
+        // Requests sent before the client shut down are still answered
+        connection.closed = true;
+        return;
+    }
+
+    connection.pending.append(buffer, count);
+    if (connection.pending.size() > max_request_bytes
+        && connection.find_newline() == std::string::npos)
+    {
+        write_all(fd, "error request too long\n");
+        connection.clear_pending();
+        connection.closed = true;
+    }
+}
+
+
+// Hands the next request of every idle connection to the workers, and
+// closes the idle connections that will not send any more.
+void CompileServer::dispatch_requests()
+{
+    std::lock_guard<std::mutex> lock(this->connections_mutex);
+    for (auto connection = this->connections.begin(); connection != this->connections.end();)
+    {
+        int fd = connection->first;
+        Connection &state = connection->second;
+        size_t newline = state.busy ? std::string::npos : state.find_newline();
+        if (state.busy)
+            ++connection;
+        else if (newline != std::string::npos)
+        {
+            std::string request = state.pending.substr(0, newline);
+            state.pending.erase(0, newline + 1);
+            state.scanned = 0;
+            state.busy = true;
+            this->pool->Submit([this, fd, request]() { this->serve_request(fd, request); });
+            ++connection;
+        }
+        else if (state.closed)
+        {
+            close(fd);
+            connection = this->connections.erase(connection);
+        }
+        else
+            ++connection;
+    }
+}
+
+
+// Answers a request of the connection, on a worker.
+void CompileServer::serve_request(int fd, std::string request)
+{
+    bool sent = write_all(fd, this->HandleRequest(request) + "\n");
+
+    {
+        std::lock_guard<std::mutex> lock(this->connections_mutex);
+        Connection &connection = this->connections[fd];
+        connection.busy = false;
+        if (!sent)
+        {
+            connection.clear_pending();
+            connection.closed = true;
+        }
+    }
+    this->wake_up();
+}
+
+
+// Returns the position of the first newline in the pending data. Only the
+// data received since the last search is scanned, so that a long request
+// arriving in many pieces is not searched over and over.
+size_t CompileServer::Connection::find_newline()
+{
+    size_t newline = this->pending.find('\n', this->scanned);
+    this->scanned = newline == std::string::npos ? this->pending.size() : newline;
+    return newline;
+}
+
+
+void CompileServer::Connection::clear_pending()
+{
+    this->pending.clear();
+    this->scanned = 0;
+}
+
+
+void CompileServer::wake_up()
+{
+    char byte = 0;
+    // A full pipe already wakes up the event loop
+    while (write(this->wakeup_fds[1], &byte, 1) < 0 && errno == EINTR)
+        ;
+}
@@ -0,0 +1,100 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "thread_pool.h"
+#include "libkaleidoscope_jit/session.h"
+
+
+// Serves compile requests for a warm JIT session over a Unix domain socket.
+//
+// The protocol is line based: every line a client sends is Kaleidoscope
+// source (any number of def, extern and top-level expression items), and
+// the server answers each one with a single line, "ok" followed by the value
+// of every top-level expression in the request, separated by spaces. If any
+// item of the request could not be parsed or compiled, the answer is
+// "error" followed by every error, as "line:column: message" within the
+// request, separated by "; ", and the values are left out. Definitions
+// persist in the session, so they are visible to every client.
+//
+// A single thread waits for clients and their requests. Each complete
+// request line is run by a worker of the thread pool, so any number of
+// clients share the workers, and requests of different connections run
+// against the session concurrently. A connection has at most one request in
+// flight, so its answers come in order, and is not read from meanwhile, so
+// a client sending faster than it is served is held back by its socket.
+// Request lines longer than max_request_bytes are answered with an error,
+// and the connection is closed.
+class CompileServer
+{
+    // A client connection, owned by the event loop while no request of it
+    // is in flight.
+    struct Connection {
+        // Received data not yet taken as a request
+        std::string pending;
+        // Length of the start of the pending data known to hold no newline
+        size_t scanned = 0;
+        // A worker is running a request of the connection
+        bool busy = false;
+        // The client will not send more requests
+        bool closed = false;
+
+        size_t find_newline();
+        void clear_pending();
+    };
+
+    JITSession &session;
+    std::string socket_path;
+    size_t worker_count;
+
+    int listen_fd = -1;
+    // Written to wake up the event loop, once a request was answered or on
+    // Stop
+    int wakeup_fds[2] = {-1, -1};
+    std::atomic<bool> running;
+    std::thread event_thread;
+    std::unique_ptr<ThreadPool> pool;
+
+    // Open client connections, by file descriptor
+    std::mutex connections_mutex;
+    std::map<int, Connection> connections;
+
+  public:
+    static const size_t max_request_bytes = 1 << 20;
+
+    CompileServer(JITSession &session, const std::string &socket_path, size_t worker_count)
+        : session(session), socket_path(socket_path), worker_count(worker_count),
+          running(false) {}
+    ~CompileServer();
+
+    // Binds the socket and starts accepting clients. Returns false, after
+    // logging why, if the socket could not be set up.
+    bool Start();
+
+    // Stops accepting clients, closes every open connection and waits for
+    // the workers to finish the requests in flight.
+    void Stop();
+
+    // Runs a single request against the session, returning the response
+    // line without its newline. Can be called from any number of threads.
+    std::string HandleRequest(const std::string &source);
+
+  private:
+    void event_loop();
+    void accept_connection();
+    void receive(int fd);
+    void dispatch_requests();
+    void serve_request(int fd, std::string request);
+    void wake_up();
+};
+
+
+#endif  // SERVER_H_
@@ -0,0 +1,50 @@
+#include "thread_pool.h"
+
+
+ThreadPool::ThreadPool(size_t worker_count)
+{
+    for (size_t i = 0; i < worker_count; i++)
+        this->workers.emplace_back([this]() { this->work(); });
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->available.notify_all();
+    for (auto &worker : this->workers)
+        worker.join();
+}
+
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push(std::move(task));
+    }
+    this->available.notify_one();
+}
+
+
+void ThreadPool::work()
+{
+    while (1)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->available.wait(lock, [this]() {
+                return this->stopping || !this->tasks.empty();
+            });
+            if (this->tasks.empty())
+                return;
+            task = std::move(this->tasks.front());
+            this->tasks.pop();
+        }
+        task();
+    }
+}
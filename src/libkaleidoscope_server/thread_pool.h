@@ -0,0 +1,38 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of worker threads running queued tasks in FIFO order.
+class ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping = false;
+
+  public:
+    ThreadPool(size_t worker_count);
+    // Finishes the queued tasks, then joins the workers.
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void Submit(std::function<void()> task);
+
+  private:
+    void work();
+};
+
+
+#endif  // THREAD_POOL_H_
@@ -0,0 +1,270 @@
+#include <set>
+#include <sstream>
+#include <string>
+#include "gtest/gtest.h"
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include "libkaleidoscope_lexer/lexer.h"
+#include "libkaleidoscope_parser/ast.h"
+#include "libkaleidoscope_parser/codegen.h"
+#include "libkaleidoscope_parser/parser.h"
+
+
+namespace
+{
+
+
+// Collects the definitions handed over by the parser driver.
+class DefinitionCollector : public TopLevelHandler
+{
+  public:
+    std::vector<std::unique_ptr<FunctionAST>> functions;
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        this->functions.push_back(std::move(function));
+    }
+};
+
+
+// Counts the instructions of the given kind in the function.
+template <typename Instruction>
+static size_t count_instructions(llvm::Function *function)
+{
+    size_t count = 0;
+    for (auto &block : *function)
+    {
+        for (auto &instruction : block)
+            count += llvm::isa<Instruction>(instruction);
+    }
+    return count;
+}
+
+
+// The fixture for testing the AST code generation.
+class CodegenTest : public ::testing::Test
+{
+  protected:
+	// set up
+    CodegenTest() {}
+  
+	// clean up
+    virtual ~CodegenTest() {}
+  
+	// additional setup code
+    virtual void SetUp() {}
+  
+	// additional cleanup code
+    virtual void TearDown() {}
+};
+
+
+TEST(CodegenTest, GeneratesFunction)
+{
+    std::istringstream stream("def foo(a b) a*b + 1");
+    DefinitionCollector collector;
+    Parser(stream).Driver(collector);
+    ASSERT_EQ(collector.functions.size(), 1u);
+
+    llvm::LLVMContext context;
+    llvm::Module module("test", context);
+    PrototypeTable prototypes;
+    CodegenContext codegen_context(module, prototypes);
+
+    llvm::Function *function = collector.functions[0]->codegen(codegen_context);
+    ASSERT_TRUE(function);
+    EXPECT_EQ(function->getName(), "foo");
+    EXPECT_EQ(function->arg_size(), 2u);
+    EXPECT_EQ(prototypes.count("foo"), 1u);
+}
+
+
+TEST(CodegenTest, RejectsUnknownVariable)
+{
+    std::istringstream stream("def foo(a) b");
+    DefinitionCollector collector;
+    Parser(stream).Driver(collector);
+    ASSERT_EQ(collector.functions.size(), 1u);
+
+    llvm::LLVMContext context;
+    llvm::Module module("test", context);
+    PrototypeTable prototypes;
+    CodegenContext codegen_context(module, prototypes);
+
+    EXPECT_FALSE(collector.functions[0]->codegen(codegen_context));
+    EXPECT_FALSE(module.getFunction("foo"));
+}
+
+
+TEST(CodegenTest, DeclaresFunctionsFromOtherModules)
+{
+    std::istringstream stream("def bar(x) foo(x, x)");
+    DefinitionCollector collector;
+    Parser(stream).Driver(collector);
+
+    llvm::LLVMContext context;
+    llvm::Module module("test", context);
+    PrototypeTable prototypes;
+    prototypes["foo"] = {"a", "b"};
+    CodegenContext codegen_context(module, prototypes);
+
+    ASSERT_TRUE(collector.functions[0]->codegen(codegen_context));
+    llvm::Function *foo = module.getFunction("foo");
+    ASSERT_TRUE(foo);
+    EXPECT_TRUE(foo->isDeclaration());
+}
+
+
+// Test to make sure math externs are only lowered to intrinsics when enabled
+TEST(CodegenTest, LowersMathExternsToIntrinsics)
+{
+    std::istringstream stream("def f(x) sin(x) + pow(x, 2)");
+    DefinitionCollector collector;
+    Parser(stream).Driver(collector);
+    ASSERT_EQ(collector.functions.size(), 1u);
+
+    llvm::LLVMContext context;
+    PrototypeTable prototypes;
+    prototypes["sin"] = {"x"};
+    prototypes["pow"] = {"x", "y"};
+    std::set<std::string> math_externs = {"sin", "pow"};
+
+    llvm::Module intrinsic_module("test", context);
+    CodegenContext intrinsic_context(intrinsic_module, prototypes);
+    intrinsic_context.math_externs = &math_externs;
+    ASSERT_TRUE(collector.functions[0]->codegen(intrinsic_context));
+    EXPECT_TRUE(intrinsic_module.getFunction("llvm.sin.f64"));
+    EXPECT_TRUE(intrinsic_module.getFunction("llvm.pow.f64"));
+    EXPECT_FALSE(intrinsic_module.getFunction("sin"));
+
+    llvm::Module call_module("test", context);
+    CodegenContext call_context(call_module, prototypes);
+    ASSERT_TRUE(collector.functions[0]->codegen(call_context));
+    EXPECT_FALSE(call_module.getFunction("llvm.sin.f64"));
+    EXPECT_TRUE(call_module.getFunction("sin"));
+
+    EXPECT_TRUE(IsMathIntrinsic("sin", 1));
+    EXPECT_FALSE(IsMathIntrinsic("sin", 2));
+    EXPECT_FALSE(IsMathIntrinsic("foo", 1));
+}
+
+
+// Test to make sure debug info maps instructions back to source lines
+TEST(CodegenTest, EmitsDebugLocations)
+{
+    std::string source("\ndef foo(a b)\n  a *\n  b");
+    std::istringstream stream(source);
+    DefinitionCollector collector;
+    Parser(stream).Driver(collector);
+
+    llvm::LLVMContext context;
+    llvm::Module module("test", context);
+    PrototypeTable prototypes;
+    LineTable lines(source);
+    CodegenContext codegen_context(module, prototypes);
+    codegen_context.EnableDebugInfo("test.ks", lines);
+
+    llvm::Function *function = collector.functions[0]->codegen(codegen_context);
+    codegen_context.FinalizeDebugInfo();
+    ASSERT_TRUE(function);
+
+    llvm::DISubprogram *subprogram = function->getSubprogram();
+    ASSERT_TRUE(subprogram);
+    EXPECT_EQ(subprogram->getLine(), 2u);
+
+    // The multiply is on the third line, fifth column
+    llvm::Instruction &multiply = function->getEntryBlock().front();
+    ASSERT_TRUE(multiply.getDebugLoc());
+    EXPECT_EQ(multiply.getDebugLoc().getLine(), 3u);
+    EXPECT_EQ(multiply.getDebugLoc().getCol(), 5u);
+}
+
+
+// Test to make sure cheap, pure conditionals do not branch
+TEST(CodegenTest, LowersCheapConditionalToSelect)
+{
+    std::istringstream stream("def clamp(x) if x < 0 then 0 else x*2");
+    DefinitionCollector collector;
+    Parser(stream).Driver(collector);
+    ASSERT_EQ(collector.functions.size(), 1u);
+
+    llvm::LLVMContext context;
+    llvm::Module module("test", context);
+    PrototypeTable prototypes;
+    CodegenContext codegen_context(module, prototypes);
+
+    llvm::Function *function = collector.functions[0]->codegen(codegen_context);
+    ASSERT_TRUE(function);
+    EXPECT_EQ(function->size(), 1u);
+    EXPECT_EQ(count_instructions<llvm::SelectInst>(function), 1u);
+}
+
+
+// Test to make sure arms with calls are only evaluated when taken
+TEST(CodegenTest, LowersConditionalWithCallsToBranches)
+{
+    std::istringstream stream("def pick(x) if x then foo(x) else 1");
+    DefinitionCollector collector;
+    Parser(stream).Driver(collector);
+
+    llvm::LLVMContext context;
+    llvm::Module module("test", context);
+    PrototypeTable prototypes;
+    prototypes["foo"] = {"a"};
+    CodegenContext codegen_context(module, prototypes);
+
+    llvm::Function *function = collector.functions[0]->codegen(codegen_context);
+    ASSERT_TRUE(function);
+    EXPECT_EQ(function->size(), 4u);
+    EXPECT_EQ(count_instructions<llvm::SelectInst>(function), 0u);
+    EXPECT_EQ(count_instructions<llvm::PHINode>(function), 1u);
+}
+
+
+// Test to make sure shared subexpressions are only lowered once
+TEST(CodegenTest, LowersSharedNodesOnce)
+{
+    std::istringstream stream("def f(x) (x*x + 1) * (x*x + 1)");
+    DefinitionCollector collector;
+    Parser parser(stream);
+    parser.EnableHashConsing();
+    parser.Driver(collector);
+    ASSERT_EQ(collector.functions.size(), 1u);
+
+    llvm::LLVMContext context;
+    llvm::Module module("test", context);
+    PrototypeTable prototypes;
+    CodegenContext codegen_context(module, prototypes);
+
+    llvm::Function *function = collector.functions[0]->codegen(codegen_context);
+    ASSERT_TRUE(function);
+    EXPECT_EQ(count_instructions<llvm::BinaryOperator>(function), 3u);
+}
+
+
+// Test to make sure a value lowered in one arm of a branch is not reused in
+// the other arm or after the branch, where it would not dominate its uses
+TEST(CodegenTest, SharedNodesRespectBranchScopes)
+{
+    std::istringstream stream("def f(x) (if x then x*x + foo(x) else x*x) + x*x");
+    DefinitionCollector collector;
+    Parser parser(stream);
+    parser.EnableHashConsing();
+    parser.Driver(collector);
+    ASSERT_EQ(collector.functions.size(), 1u);
+
+    llvm::LLVMContext context;
+    llvm::Module module("test", context);
+    PrototypeTable prototypes;
+    prototypes["foo"] = {"a"};
+    CodegenContext codegen_context(module, prototypes);
+
+    // Verification fails if a value is used where it is not defined
+    EXPECT_TRUE(collector.functions[0]->codegen(codegen_context));
+}
+
+
+}
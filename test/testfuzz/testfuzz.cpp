@@ -0,0 +1,219 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "libkaleidoscope_fuzz/fuzz.h"
+#include "libkaleidoscope_lexer/lexer.h"
+#include "libkaleidoscope_parser/parser.h"
+
+
+namespace
+{
+
+
+// The fixture for testing the fuzz harness.
+class FuzzTest : public ::testing::Test
+{
+  protected:
+	// set up
+    FuzzTest() {}
+
+	// clean up
+    virtual ~FuzzTest() {}
+
+	// additional setup code
+    virtual void SetUp() {}
+
+	// additional cleanup code
+    virtual void TearDown() {}
+};
+
+
+// Targets whose work is linear and quadratic in the size of the input.
+static void run_linear(const std::string &input)
+{
+    volatile size_t sum = 0;
+    for (int repeat = 0; repeat < 1000; repeat++)
+        for (char character : input)
+            sum += character;
+}
+
+
+static void run_quadratic(const std::string &input)
+{
+    volatile size_t sum = 0;
+    for (size_t i = 0; i < input.size(); i++)
+        for (size_t j = 0; j < input.size(); j++)
+            sum += input[i] ^ input[j];
+}
+
+
+static FuzzOptions small_options()
+{
+    FuzzOptions options;
+    options.runs = 2;
+    options.min_size = 512;
+    options.max_size = 4096;
+    options.min_seconds = 0;
+    return options;
+}
+
+
+TEST(FuzzTest, GeneratedInputsParseWithoutErrors)
+{
+    InputGenerator generator(1);
+    for (int i = 0; i < 100; i++)
+    {
+        std::string input = generator.Generate();
+        std::istringstream stream(input);
+        Parser parser(stream);
+        parser.Driver();
+        EXPECT_TRUE(parser.get_diagnostics().empty()) << input;
+    }
+}
+
+
+TEST(FuzzTest, GenerationIsRepeatable)
+{
+    InputGenerator first(7);
+    InputGenerator second(7);
+    for (int i = 0; i < 20; i++)
+    {
+        std::string input = first.Generate();
+        EXPECT_EQ(second.Generate(), input);
+        EXPECT_EQ(second.Mutate(input), first.Mutate(input));
+    }
+}
+
+
+TEST(FuzzTest, PumpRepeatsBothSlices)
+{
+    PumpSite site;
+    site.first_begin = 0;
+    site.first_end = 1;
+    site.second_begin = 2;
+    site.second_end = 3;
+    EXPECT_EQ(Pump("(x);", site, 3), "(((x)));");
+
+    site.first_begin = 1;
+    site.first_end = 3;
+    site.second_begin = site.second_end = 3;
+    EXPECT_EQ(Pump("1+1;", site, 3), "1+1+1+1;");
+}
+
+
+TEST(FuzzTest, PumpSitesAreOnTokenBoundaries)
+{
+    InputGenerator generator(3);
+    for (int i = 0; i < 50; i++)
+    {
+        std::string input = generator.Generate();
+        std::vector<size_t> boundaries;
+        std::istringstream stream(input);
+        Lexer lexer(stream);
+        for (Token token = lexer.GetToken(); token.token != tok_eof; token = lexer.GetToken())
+            boundaries.push_back(token.location);
+        boundaries.push_back(input.size());
+        auto is_boundary = [&boundaries](size_t offset) {
+            return std::find(boundaries.begin(), boundaries.end(), offset) != boundaries.end();
+        };
+
+        PumpSite site;
+        ASSERT_TRUE(generator.PickPumpSite(input, site));
+        EXPECT_LT(site.first_begin, site.first_end);
+        EXPECT_LE(site.first_end, site.second_begin);
+        EXPECT_LE(site.second_begin, site.second_end);
+        EXPECT_TRUE(is_boundary(site.first_begin) && is_boundary(site.first_end));
+        EXPECT_TRUE(is_boundary(site.second_begin) && is_boundary(site.second_end));
+    }
+}
+
+
+TEST(FuzzTest, MeasuresFrontEndCosts)
+{
+    InputCost cost;
+    ASSERT_TRUE(MeasureInput(RunFrontEnd, "def f(x) x*2+1; f(3)", small_options(), cost));
+
+    EXPECT_FALSE(cost.failed());
+    EXPECT_EQ(cost.size, 20u);
+    EXPECT_GT(cost.seconds, 0);
+    EXPECT_GT(cost.peak_rss_bytes, 0u);
+    EXPECT_GT(cost.ast_bytes, 0u);
+}
+
+
+TEST(FuzzTest, ReportsCrashesAndTimeouts)
+{
+    FuzzOptions options = small_options();
+    options.timeout_seconds = 1;
+
+    InputCost cost;
+    ASSERT_TRUE(MeasureInput([](const std::string &) { abort(); }, "x", options, cost));
+    EXPECT_EQ(cost.signal, SIGABRT);
+    EXPECT_TRUE(cost.failed());
+
+    ASSERT_TRUE(MeasureInput([](const std::string &) { while (1) pause(); }, "x", options, cost));
+    EXPECT_TRUE(cost.timed_out);
+    EXPECT_TRUE(cost.failed());
+}
+
+
+TEST(FuzzTest, FlagsSuperlinearGrowth)
+{
+    PumpSite site;
+    site.first_begin = 0;
+    site.first_end = 2;
+    site.second_begin = site.second_end = 2;
+
+    GrowthReport linear = MeasureGrowth(run_linear, "ab", site, small_options());
+    EXPECT_EQ(linear.costs.size(), 4u);
+    EXPECT_FALSE(linear.superlinear);
+    EXPECT_EQ(linear.input.size(), 4096u);
+
+    GrowthReport quadratic = MeasureGrowth(run_quadratic, "ab", site, small_options());
+    EXPECT_TRUE(quadratic.superlinear);
+    EXPECT_GT(quadratic.time_exponent, 1.5);
+}
+
+
+TEST(FuzzTest, FrontEndGrowsLinearly)
+{
+    PumpSite site;
+    site.first_begin = 1;
+    site.first_end = 3;
+    site.second_begin = site.second_end = 3;
+
+    GrowthReport report = MeasureGrowth(RunFrontEnd, "1+1;", site, small_options());
+    EXPECT_FALSE(report.failed);
+    EXPECT_NEAR(report.memory_exponent, 1, 0.05);
+}
+
+
+TEST(FuzzTest, SavesAndLoadsCorpus)
+{
+    std::string directory = "/tmp/kaleidoscope-corpus-" + std::to_string(getpid());
+    std::string slow = SaveToCorpus(directory, "slow", "1+1;");
+    std::string crash = SaveToCorpus(directory, "crash", "(((");
+    ASSERT_FALSE(slow.empty());
+    ASSERT_FALSE(crash.empty());
+    EXPECT_EQ(SaveToCorpus(directory, "slow", "1+1;"), slow);
+
+    auto corpus = LoadCorpus(directory);
+    ASSERT_EQ(corpus.size(), 2u);
+    EXPECT_EQ(directory + "/" + corpus[0].first, crash);
+    EXPECT_EQ(corpus[0].second, "(((");
+    EXPECT_EQ(directory + "/" + corpus[1].first, slow);
+    EXPECT_EQ(corpus[1].second, "1+1;");
+
+    unlink(slow.c_str());
+    unlink(crash.c_str());
+    rmdir(directory.c_str());
+}
+
+
+}
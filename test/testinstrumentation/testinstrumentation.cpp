@@ -0,0 +1,124 @@
+#include <sstream>
+#include <string>
+#include "gtest/gtest.h"
+
+#include "libkaleidoscope_instrumentation/instrumentation.h"
+#include "libkaleidoscope_lexer/lexer.h"
+#include "libkaleidoscope_parser/ast.h"
+#include "libkaleidoscope_parser/parser.h"
+
+
+namespace
+{
+
+
+// The fixture for testing the pipeline instrumentation.
+class InstrumentationTest : public ::testing::Test
+{
+  protected:
+	// set up
+    InstrumentationTest() {}
+  
+	// clean up
+    virtual ~InstrumentationTest() {}
+  
+	// additional setup code
+    virtual void SetUp()
+    {
+        ResetInstrumentation();
+        EnableInstrumentation(true);
+    }
+  
+	// additional cleanup code
+    virtual void TearDown()
+    {
+        EnableInstrumentation(false);
+        ResetInstrumentation();
+    }
+};
+
+
+TEST_F(InstrumentationTest, CountsTokens)
+{
+    std::istringstream stream("def foo(a) a");
+    Lexer lexer(stream);
+    while (lexer.GetToken().token != tok_eof) {}
+
+    // def, foo, (, a, ), a and the final eof
+    EXPECT_EQ(GetCounter(counter_tokens), 7u);
+    EXPECT_GT(GetPhaseTime(phase_lex), 0.);
+}
+
+
+TEST_F(InstrumentationTest, CountsASTNodes)
+{
+    std::istringstream stream("a+b");
+    Parser parser = Parser(stream);
+    auto expr = parser.ParseExpression();
+
+    // two variables and a binary expression
+    EXPECT_EQ(GetCounter(counter_ast_nodes), 3u);
+    EXPECT_GE(GetCounter(counter_bytes_allocated), 2 * sizeof(VariableExprAST) + sizeof(BinaryExprAST));
+}
+
+
+TEST_F(InstrumentationTest, DisabledRecordsNothing)
+{
+    EnableInstrumentation(false);
+
+    std::istringstream stream("def foo(a) a+1");
+    Parser parser = Parser(stream);
+    parser.Driver();
+
+    EXPECT_EQ(GetCounter(counter_tokens), 0u);
+    EXPECT_EQ(GetCounter(counter_ast_nodes), 0u);
+    EXPECT_EQ(GetPhaseTime(phase_parse), 0.);
+}
+
+
+TEST_F(InstrumentationTest, RecordsFunctionCodegenTime)
+{
+    {
+        PhaseTimer timer(phase_codegen, "foo");
+    }
+
+    auto timings = GetFunctionCodegenTimes();
+    ASSERT_EQ(timings.size(), 1u);
+    EXPECT_EQ(timings[0].name, "foo");
+}
+
+
+TEST_F(InstrumentationTest, DumpsJSON)
+{
+    std::istringstream stream("def foo(a) a+1");
+    Parser parser = Parser(stream);
+    parser.Driver();
+
+    std::ostringstream output;
+    DumpInstrumentationJSON(output);
+    std::string json = output.str();
+
+    EXPECT_EQ(json.front(), '{');
+    EXPECT_EQ(json.back(), '}');
+    EXPECT_NE(json.find("\"tokens\":" + std::to_string(GetCounter(counter_tokens))), std::string::npos);
+    EXPECT_NE(json.find("\"parse\":"), std::string::npos);
+}
+
+
+TEST_F(InstrumentationTest, DumpsChromeTrace)
+{
+    std::istringstream stream("extern sin(x)");
+    Parser parser = Parser(stream);
+    parser.Driver();
+
+    std::ostringstream output;
+    DumpChromeTrace(output);
+    std::string trace = output.str();
+
+    EXPECT_EQ(trace.find("{\"traceEvents\":["), 0u);
+    EXPECT_NE(trace.find("\"name\":\"parse\""), std::string::npos);
+    EXPECT_NE(trace.find("\"detail\":\"extern\""), std::string::npos);
+}
+
+
+}
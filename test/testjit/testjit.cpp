@@ -0,0 +1,984 @@
+#include <sys/resource.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "libkaleidoscope_jit/perfmap.h"
+#include "libkaleidoscope_jit/session.h"
+#include "libkaleidoscope_jit/symbol_table.h"
+#include "libkaleidoscope_parser/static_parser.h"
+
+
+namespace
+{
+
+
+// The fixture for testing the JIT execution layer.
+class JITTest : public ::testing::Test
+{
+  protected:
+	// set up
+    JITTest() {}
+  
+	// clean up
+    virtual ~JITTest() {}
+  
+	// additional setup code
+    virtual void SetUp() {}
+  
+	// additional cleanup code
+    virtual void TearDown() {}
+};
+
+
+// Generates a long program on the fly, one item at a time, so the input as a
+// whole never exists in memory. Items are either top-level expressions or
+// definitions, each with the given number of terms.
+class GeneratedSource : public std::streambuf
+{
+    std::string chunk;
+    size_t index = 0;
+    size_t count;
+    size_t terms;
+    bool definitions;
+
+  public:
+    size_t bytes = 0;
+
+    GeneratedSource(size_t count, size_t terms, bool definitions)
+        : count(count), terms(terms), definitions(definitions) {}
+
+  protected:
+    int_type underflow() override
+    {
+        if (this->index == this->count)
+            return traits_type::eof();
+
+        if (this->definitions)
+            this->chunk = "def f" + std::to_string(this->index) + "(x) x";
+        else
+            this->chunk = "1";
+        for (size_t i = 0; i < this->terms; i++)
+            this->chunk += (this->definitions ? " + x*" : " + 2*") + std::to_string(i);
+        this->chunk += "\n";
+        this->index++;
+
+        this->bytes += this->chunk.size();
+        this->setg(&this->chunk[0], &this->chunk[0], &this->chunk[0] + this->chunk.size());
+        return traits_type::to_int_type(this->chunk[0]);
+    }
+};
+
+
+// Peak resident set size of the process, in kilobytes.
+static long peak_rss()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+
+// Runs the source in a new session, returning the top-level results.
+static std::vector<double> run(const std::string &source,
+                               const JITOptions &options = JITOptions())
+{
+    std::vector<double> results;
+    auto session = JITSession::Create(options);
+    EXPECT_TRUE(session);
+    if (!session)
+        return results;
+
+    session->SetResultHandler([&results](double result) { results.push_back(result); });
+    std::istringstream stream(source);
+    session->Run(stream);
+    return results;
+}
+
+
+TEST(JITTest, EvaluatesTopLevelExpressions)
+{
+    auto results = run("1+2*3; 4 < 5");
+
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0], 7.);
+    EXPECT_EQ(results[1], 1.);
+}
+
+
+TEST(JITTest, CallsDefinedFunctions)
+{
+    auto results = run("def square(x) x*x\n"
+                       "def sumsquares(a b) square(a) + square(b)\n"
+                       "sumsquares(3, 4)");
+
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0], 25.);
+}
+
+
+TEST(JITTest, EvaluatesConditionals)
+{
+    auto results = run("def piecewise(x) if x < 0 then 0 else if x < 1 then x*x else 1\n"
+                       "def fib(n) if n < 2 then n else fib(n-1) + fib(n-2)\n"
+                       "piecewise(0-1); piecewise(0.5); piecewise(3); fib(10)");
+
+    ASSERT_EQ(results.size(), 4u);
+    EXPECT_EQ(results[0], 0.);
+    EXPECT_EQ(results[1], 0.25);
+    EXPECT_EQ(results[2], 1.);
+    EXPECT_EQ(results[3], 55.);
+}
+
+
+TEST(JITTest, EvaluatesHashConsedFunctions)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    session->SetHashConsing(true);
+
+    std::vector<double> results;
+    session->SetResultHandler([&results](double result) { results.push_back(result); });
+    std::istringstream stream("def f(x) (x+1)*(x+1)\ndef g(x) (x+1)*(x+1) + (x+1)\n"
+                              "f(2); g(2); (2+1)*(2+1)");
+    session->Run(stream);
+
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[0], 9.);
+    EXPECT_EQ(results[1], 12.);
+    EXPECT_EQ(results[2], 9.);
+}
+
+
+// Test to make sure errors in a function identical to an earlier one are
+// located in that function, not in the one its nodes could be shared with
+TEST(JITTest, LocatesErrorsOfHashConsedFunctions)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    session->SetHashConsing(true);
+
+    std::istringstream stream("def f(x) x + y\ndef g(x) x + y");
+    RunResult result;
+    session->Run(stream, result);
+
+    auto &diagnostics = result.diagnostics.get_diagnostics();
+    ASSERT_EQ(diagnostics.size(), 2u);
+    EXPECT_EQ(diagnostics[0].range.begin, 13u);
+    EXPECT_EQ(diagnostics[1].range.begin, 28u);
+}
+
+
+// Runs the source in a new session that batches top-level expressions.
+static std::vector<double> run_batched(const std::string &source, size_t batch_size)
+{
+    std::vector<double> results;
+    auto session = JITSession::Create();
+    EXPECT_TRUE(session);
+    if (!session)
+        return results;
+
+    session->SetBatchSize(batch_size);
+    session->SetResultHandler([&results](double result) { results.push_back(result); });
+    std::istringstream stream(source);
+    session->Run(stream);
+    return results;
+}
+
+
+TEST(JITTest, BatchesTopLevelExpressions)
+{
+    std::string source;
+    std::vector<double> expected;
+    for (int i = 0; i < 100; i++)
+    {
+        source += std::to_string(i) + "*2 + 1; ";
+        expected.push_back(i * 2 + 1);
+    }
+
+    EXPECT_EQ(run_batched(source, 32), expected);
+    EXPECT_EQ(run_batched(source, 1000), expected);
+}
+
+
+// Test to make sure expressions see the definitions that preceded them
+TEST(JITTest, BatchesFlushBeforeDefinitions)
+{
+    auto results = run_batched("def f(x) x\nf(1); f(2)\ndef f(x) x*10\nf(3); if f(1) > 5 then 1 else 0",
+                               64);
+    ASSERT_EQ(results.size(), 4u);
+    EXPECT_EQ(results[0], 1.);
+    EXPECT_EQ(results[1], 2.);
+    EXPECT_EQ(results[2], 30.);
+    EXPECT_EQ(results[3], 1.);
+}
+
+
+TEST(JITTest, BatchesSkipFailedExpressions)
+{
+    auto results = run_batched("1; undefined(2); 3", 64);
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0], 1.);
+    EXPECT_EQ(results[1], 3.);
+}
+
+
+// Test to make sure an empty batch evaluates to nothing
+TEST(JITTest, EvaluatesEmptyBatch)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+
+    std::vector<double> results;
+    session->SetResultHandler([&results](double result) { results.push_back(result); });
+    session->EvaluateBatch({});
+
+    EXPECT_TRUE(results.empty());
+}
+
+
+TEST(JITTest, CallsExternFunctions)
+{
+    auto results = run("extern sqrt(x)\nsqrt(16)");
+
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0], 4.);
+}
+
+
+// Test to make sure items after a parse error are still compiled and run
+TEST(JITTest, RunsItemsAroundParseErrors)
+{
+    auto results = run("1 + ; 2\ndef f(x) x *\ndef g(x) x + 1\ng(1); f(2); g(2)");
+
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[0], 2.);
+    EXPECT_EQ(results[1], 2.);
+    EXPECT_EQ(results[2], 3.);
+}
+
+
+// Test to make sure an item whose first operand fails to parse is skipped
+TEST(JITTest, SkipsItemsWithBadLeftOperand)
+{
+    auto results = run("def f(x) ) + 1;\n) * 2;\n3");
+
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0], 3.);
+}
+
+
+TEST(JITTest, MathExternsMatchLibm)
+{
+    auto results = run("extern sin(x)\nextern cos(x)\nextern pow(x y)\nextern fmax(a b)\n"
+                       "def f(x) sin(x)*cos(x) + pow(x, 3)\n"
+                       "f(0.5); fmax(2, 7); sin(1)");
+
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_DOUBLE_EQ(results[0], sin(0.5) * cos(0.5) + pow(0.5, 3));
+    EXPECT_EQ(results[1], 7.);
+    EXPECT_DOUBLE_EQ(results[2], sin(1.));
+}
+
+
+// Test to make sure fast-math results stay close to the exact ones
+TEST(JITTest, FastMathStaysWithinTolerance)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    std::vector<double> results;
+    session->SetResultHandler([&results](double result) { results.push_back(result); });
+    session->SetFastMath(true);
+
+    std::istringstream stream("extern sin(x)\nextern cos(x)\n"
+                              "def trig(a b c d) sin(a)*cos(b) + sin(b)*cos(c) + sin(c)*cos(d) + sin(d)*cos(a)\n"
+                              "trig(0.1, 0.2, 0.3, 0.4)");
+    session->Run(stream);
+
+    double expected = sin(0.1) * cos(0.2) + sin(0.2) * cos(0.3) + sin(0.3) * cos(0.4)
+                      + sin(0.4) * cos(0.1);
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_NEAR(results[0], expected, 1e-12);
+}
+
+
+// Test to make sure user definitions override the math library
+TEST(JITTest, DefinitionsOverrideMathExterns)
+{
+    auto results = run("extern sqrt(x)\nsqrt(16)\ndef sqrt(x) x*2\nsqrt(2)");
+
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0], 4.);
+    EXPECT_EQ(results[1], 4.);
+}
+
+
+TEST(JITTest, LooksUpFunctionAddress)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    std::istringstream stream("def add(a b) a+b");
+    session->Run(stream);
+
+    auto add = reinterpret_cast<double (*)(double, double)>(session->GetFunctionAddress("add"));
+    ASSERT_TRUE(add);
+    EXPECT_EQ(add(2, 3), 5.);
+}
+
+
+// Whether the perf map has an entry of the given name.
+static bool has_perf_map_entry(const std::string &function_name)
+{
+    std::ifstream map(PerfMapListener::GetPath());
+    std::string line;
+    while (std::getline(map, line))
+    {
+        std::istringstream entry(line);
+        std::string name;
+        uint64_t start, size;
+        entry >> std::hex >> start >> size >> name;
+        if (name == function_name && start && size > 0)
+            return true;
+    }
+    return false;
+}
+
+
+// Test to make sure functions are mapped under their own name, whatever
+// their version, once they are compiled
+TEST(JITTest, WritesPerfMap)
+{
+    JITOptions options;
+    options.perf_map = true;
+    auto session = JITSession::Create(options);
+    ASSERT_TRUE(session);
+
+    std::string source("def perfmapped(a) a+1\ndef perfmapped(a) a+2");
+    session->SetSource("perfmapped.ks", source);
+    std::istringstream stream(source);
+    session->Run(stream);
+
+    // Definitions are compiled on their first call
+    auto perfmapped = reinterpret_cast<double (*)(double)>(
+        session->GetFunctionAddress("perfmapped"));
+    ASSERT_TRUE(perfmapped);
+    EXPECT_FALSE(has_perf_map_entry("perfmapped"));
+
+    EXPECT_EQ(perfmapped(1), 3.);
+    EXPECT_TRUE(has_perf_map_entry("perfmapped"));
+    EXPECT_FALSE(has_perf_map_entry("perfmapped.2"));
+}
+
+
+// Test to make sure definitions are compiled right away when streaming
+TEST(JITTest, StreamingCompilesDefinitionsRightAway)
+{
+    JITOptions options;
+    options.perf_map = true;
+    options.streaming = true;
+    auto session = JITSession::Create(options);
+    ASSERT_TRUE(session);
+
+    std::istringstream stream("def streamed(a) a*3");
+    session->Run(stream);
+    EXPECT_TRUE(has_perf_map_entry("streamed"));
+
+    auto streamed = reinterpret_cast<double (*)(double)>(session->GetFunctionAddress("streamed"));
+    ASSERT_TRUE(streamed);
+    EXPECT_EQ(streamed(2), 6.);
+}
+
+
+TEST(JITTest, RegistersWithGDB)
+{
+    JITOptions options;
+    options.gdb = true;
+    std::string source("def debugged(a) a*2\ndebugged(21)");
+    auto session = JITSession::Create(options);
+    ASSERT_TRUE(session);
+
+    std::vector<double> results;
+    session->SetResultHandler([&results](double result) { results.push_back(result); });
+    session->SetSource("debugged.ks", source);
+    std::istringstream stream(source);
+    session->Run(stream);
+
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0], 42.);
+}
+
+
+// Test to make sure inputs run after the source was cleared are not located
+// in the source set before
+TEST(JITTest, ClearsSource)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    std::string prelude("def prelude(x) x\n\n");
+    session->SetSource("prelude.ks", prelude);
+    std::istringstream stream(prelude);
+    session->Run(stream);
+    session->ClearSource();
+
+    testing::internal::CaptureStderr();
+    std::istringstream request(")");
+    session->Run(request);
+    EXPECT_EQ(testing::internal::GetCapturedStderr(),
+              "ERROR: unknown token when expecting a primary expression!\n");
+}
+
+
+// Test to make sure streaming compilation does not hold on to the ASTs and
+// IR of items already run. Set KALEIDOSCOPE_STREAMING_BYTES to run it on a
+// larger generated input.
+TEST(JITTest, StreamingExpressionsUseConstantMemory)
+{
+    const size_t terms = 200;
+    size_t count = 300;
+    if (const char *bytes = getenv("KALEIDOSCOPE_STREAMING_BYTES"))
+        count = std::stoull(bytes) / (terms * 7);
+
+    JITOptions options;
+    options.streaming = true;
+    auto session = JITSession::Create(options);
+    ASSERT_TRUE(session);
+
+    // Measure once the session is warmed up
+    const size_t warm_up = 20;
+    GeneratedSource source(count, terms, false);
+    size_t results = 0;
+    long warm_rss = 0;
+    size_t warm_bytes = 0;
+    session->SetResultHandler([&](double result) {
+        if (++results == warm_up)
+        {
+            warm_rss = peak_rss();
+            warm_bytes = source.bytes;
+        }
+    });
+
+    std::istream stream(&source);
+    session->Run(stream);
+    ASSERT_EQ(results, count);
+
+    // Keeping the AST alone would take many times the size of the source
+    long growth_kb = peak_rss() - warm_rss;
+    long input_kb = (source.bytes - warm_bytes) / 1024;
+    EXPECT_LT(growth_kb, input_kb);
+}
+
+
+// Test to make sure streamed definitions only keep their machine code, which
+// takes a couple of pages per function, and not their IR.
+TEST(JITTest, StreamingDefinitionsReleaseIR)
+{
+    const size_t count = 200;
+
+    JITOptions options;
+    options.streaming = true;
+    auto session = JITSession::Create(options);
+    ASSERT_TRUE(session);
+
+    GeneratedSource source(count, 200, true);
+    std::istream stream(&source);
+    long start_rss = peak_rss();
+    session->Run(stream);
+
+    long growth_kb = peak_rss() - start_rss;
+    EXPECT_LT(growth_kb, static_cast<long>(count * 48));
+    EXPECT_TRUE(session->GetFunctionAddress("f0"));
+}
+
+
+TEST(JITTest, RedefinitionReplacesFunction)
+{
+    auto results = run("def f(x) x+1\nf(1)\ndef f(x) x*10\nf(2)\ndef g(x) f(x)\ng(3)");
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[0], 2.);
+    EXPECT_EQ(results[1], 20.);
+    EXPECT_EQ(results[2], 30.);
+}
+
+
+TEST(JITTest, RedefinitionKeepsCallersAndAddress)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+
+    // Callers compiled before the redefinition go through the stub too
+    std::istringstream first("def f(x) x+1\ndef g(x) f(x)*2");
+    session->Run(first);
+    uint64_t address = session->GetFunctionAddress("f");
+    double (*g)(double) = reinterpret_cast<double (*)(double)>(session->GetFunctionAddress("g"));
+    ASSERT_TRUE(g);
+    EXPECT_EQ(g(1), 4.);
+
+    std::istringstream second("def f(x) x+100");
+    session->Run(second);
+    EXPECT_EQ(session->GetFunctionAddress("f"), address);
+    EXPECT_EQ(g(1), 202.);
+}
+
+
+TEST(JITTest, RejectsRedefinitionWithDifferentArity)
+{
+    auto results = run("def f(x) x+1\ndef f(x y) x+y\nf(1)");
+    ASSERT_EQ(results.size(), 1u);
+    EXPECT_EQ(results[0], 2.);
+}
+
+
+// Test to make sure functions can be called from many threads while they are
+// redefined in the background. Every call must return the result of one of
+// the versions, and calls made after the last redefinition the latest one.
+TEST(JITTest, ConcurrentCallsDuringRedefinition)
+{
+    const int versions = 50;
+    const int threads = 4;
+
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    std::istringstream first("def f(x) x*1");
+    session->Run(first);
+    double (*f)(double) = reinterpret_cast<double (*)(double)>(session->GetFunctionAddress("f"));
+    ASSERT_TRUE(f);
+
+    std::atomic<bool> done(false);
+    std::atomic<int> invalid(0);
+    std::vector<std::thread> callers;
+    for (int i = 0; i < threads; i++)
+    {
+        callers.emplace_back([&]() {
+            while (!done.load(std::memory_order_acquire))
+            {
+                double result = f(2);
+                if (result < 2 || result > 2 * versions || result != static_cast<int>(result)
+                    || static_cast<int>(result) % 2)
+                    invalid++;
+            }
+        });
+    }
+
+    for (int version = 2; version <= versions; version++)
+        session->RunInBackground("def f(x) x*" + std::to_string(version));
+    session->WaitForBackground();
+    done.store(true, std::memory_order_release);
+    for (auto &caller : callers)
+        caller.join();
+
+    EXPECT_EQ(invalid.load(), 0);
+    EXPECT_EQ(f(2), 2. * versions);
+}
+
+
+TEST(JITTest, SymbolTableGrows)
+{
+    SymbolTable table;
+    const int count = 1000;
+    for (int i = 0; i < count; i++)
+    {
+        table.Insert("f" + std::to_string(i), i + 1);
+        EXPECT_EQ(table.Lookup("f0"), 1u);
+    }
+
+    for (int i = 0; i < count; i++)
+        EXPECT_EQ(table.Lookup("f" + std::to_string(i)), static_cast<uint64_t>(i + 1));
+    EXPECT_EQ(table.Lookup("missing"), 0u);
+}
+
+
+// Session with tiering enabled that only recompiles when asked to, and
+// functions called more than hot_calls times are hot.
+static std::unique_ptr<JITSession> tiered_session(const std::string &source, uint64_t hot_calls)
+{
+    auto session = JITSession::Create();
+    if (!session)
+        return nullptr;
+
+    TieringOptions options;
+    options.hot_calls = hot_calls;
+    options.window_ms = 0;
+    session->EnableTiering(options);
+    std::istringstream stream(source);
+    session->Run(stream);
+    return session;
+}
+
+
+static std::string profile_path()
+{
+    return "/tmp/kaleidoscope-profile-" + std::to_string(getpid()) + ".txt";
+}
+
+
+typedef double (*BinaryFunction)(double, double);
+typedef double (*UnaryFunction)(double);
+
+
+TEST(JITTest, TieringProfilesCallsArgumentsAndBranches)
+{
+    auto session = tiered_session("def pick(x y) if x < y then x else y", 1000000);
+    ASSERT_TRUE(session);
+    auto pick = reinterpret_cast<BinaryFunction>(session->GetFunctionAddress("pick"));
+    ASSERT_TRUE(pick);
+    for (int x = 1; x <= 10; x++)
+        EXPECT_EQ(pick(x, 5), std::min(x, 5));
+
+    ASSERT_TRUE(session->SaveProfile(profile_path()));
+    ProfileTable profiles;
+    std::ifstream input(profile_path());
+    ASSERT_TRUE(ReadProfiles(input, profiles));
+    std::remove(profile_path().c_str());
+
+    ASSERT_EQ(profiles.count("pick"), 1u);
+    const FunctionProfile &profile = profiles["pick"];
+    EXPECT_EQ(profile.calls, 10u);
+    ASSERT_EQ(profile.arguments.size(), 2u);
+    EXPECT_EQ(profile.arguments[0].min, 1.);
+    EXPECT_EQ(profile.arguments[0].max, 10.);
+    EXPECT_FALSE(profile.is_constant_argument(0));
+    EXPECT_TRUE(profile.is_constant_argument(1));
+    ASSERT_EQ(profile.branches.size(), 1u);
+    EXPECT_EQ(profile.branches[0].taken, 4u);
+    EXPECT_EQ(profile.branches[0].not_taken, 6u);
+    EXPECT_FALSE(session->IsOptimized("pick"));
+}
+
+
+// Test to make sure profiles with counts their lines cannot hold are
+// rejected before anything is allocated for them
+TEST(JITTest, RejectsMalformedProfiles)
+{
+    const char *inputs[] = {
+        "f 10 2 0 1 2\n",
+        "f 10 0 1 3\n",
+        "f 10 18446744073709551615 0\n",
+        "f 10 0 18446744073709551615\n",
+        "f 10 9223372036854775807 9223372036854775809\n",
+    };
+    for (const char *text : inputs)
+    {
+        ProfileTable profiles;
+        profiles["g"].calls = 1;
+        std::istringstream input(std::string("g 1 1 0 2 2\n") + text);
+        EXPECT_FALSE(ReadProfiles(input, profiles)) << text;
+        EXPECT_EQ(profiles.size(), 1u) << text;
+        EXPECT_TRUE(profiles["g"].arguments.empty()) << text;
+    }
+
+    ProfileTable profiles;
+    std::istringstream input("f 10 1 1 0.5 2 3 4\n");
+    ASSERT_TRUE(ReadProfiles(input, profiles));
+    EXPECT_EQ(profiles["f"].arguments.size(), 1u);
+    EXPECT_EQ(profiles["f"].branches.size(), 1u);
+}
+
+
+// Test to make sure the optimized tier computes the same results, including
+// for argument values other than the ones it was specialized for
+TEST(JITTest, TieringRecompilesHotFunctions)
+{
+    auto session = tiered_session("def g(x) x*2\ndef f(x y) if x < 0 then g(y) else g(x) + y", 10);
+    ASSERT_TRUE(session);
+    auto f = reinterpret_cast<BinaryFunction>(session->GetFunctionAddress("f"));
+    ASSERT_TRUE(f);
+    for (int i = 0; i < 20; i++)
+        EXPECT_EQ(f(i, 3), 2. * i + 3);
+
+    EXPECT_EQ(session->RecompileHotFunctions(), 2u);
+    EXPECT_TRUE(session->IsOptimized("f"));
+    EXPECT_TRUE(session->IsOptimized("g"));
+    EXPECT_EQ(session->RecompileHotFunctions(), 0u);
+
+    EXPECT_EQ(f(1, 3), 5.);
+    EXPECT_EQ(f(-1, 3), 6.);
+    EXPECT_EQ(f(2, 7), 11.);
+    EXPECT_EQ(f(-1, -0.), -0.);
+}
+
+
+TEST(JITTest, TieringRedefinitionDeoptimizesInliningCallers)
+{
+    auto session = tiered_session("def g(x) x*2\ndef f(x y) g(x) + y", 10);
+    ASSERT_TRUE(session);
+    auto f = reinterpret_cast<BinaryFunction>(session->GetFunctionAddress("f"));
+    ASSERT_TRUE(f);
+    for (int i = 0; i < 20; i++)
+        f(i, 3);
+    session->RecompileHotFunctions();
+    ASSERT_TRUE(session->IsOptimized("f"));
+
+    std::istringstream stream("def g(x) x*10");
+    session->Run(stream);
+    EXPECT_FALSE(session->IsOptimized("f"));
+    EXPECT_EQ(f(1, 3), 13.);
+}
+
+
+TEST(JITTest, TieringStartsFromSavedProfile)
+{
+    std::string source("def f(x y) x*y + 1");
+    {
+        auto session = tiered_session(source, 10);
+        ASSERT_TRUE(session);
+        auto f = reinterpret_cast<BinaryFunction>(session->GetFunctionAddress("f"));
+        ASSERT_TRUE(f);
+        for (int i = 0; i < 20; i++)
+            f(i, 2);
+        ASSERT_TRUE(session->SaveProfile(profile_path()));
+    }
+
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    ASSERT_TRUE(session->LoadProfile(profile_path()));
+    std::remove(profile_path().c_str());
+    TieringOptions options;
+    options.hot_calls = 10;
+    options.window_ms = 0;
+    session->EnableTiering(options);
+    std::istringstream stream(source);
+    session->Run(stream);
+
+    EXPECT_TRUE(session->IsOptimized("f"));
+    auto f = reinterpret_cast<BinaryFunction>(session->GetFunctionAddress("f"));
+    ASSERT_TRUE(f);
+    EXPECT_EQ(f(3, 2), 7.);
+    EXPECT_EQ(f(3, 4), 13.);
+}
+
+
+TEST(JITTest, TieringRecompilesInBackground)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    TieringOptions options;
+    options.hot_calls = 10;
+    options.window_ms = 5;
+    session->EnableTiering(options);
+    std::istringstream stream("def f(x y) x-y");
+    session->Run(stream);
+
+    auto f = reinterpret_cast<BinaryFunction>(session->GetFunctionAddress("f"));
+    ASSERT_TRUE(f);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!session->IsOptimized("f") && std::chrono::steady_clock::now() < deadline)
+        EXPECT_EQ(f(5, 2), 3.);
+    EXPECT_TRUE(session->IsOptimized("f"));
+    EXPECT_EQ(f(5, 2), 3.);
+}
+
+
+// Runs the source in the session, returning the update reports.
+static std::vector<UpdateReport> run_with_reports(JITSession &session, const std::string &source)
+{
+    std::vector<UpdateReport> reports;
+    session.SetUpdateHandler([&reports](const UpdateReport &report) {
+        reports.push_back(report);
+    });
+    std::istringstream stream(source);
+    session.Run(stream);
+    session.SetUpdateHandler(nullptr);
+    return reports;
+}
+
+
+// Test to make sure reloading a source only compiles what changed
+TEST(JITTest, ReloadingSourceOnlyCompilesChangedDefinitions)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    auto reports = run_with_reports(*session, "def a(x) x+1\n"
+                                              "def b(x) a(x)*2\n"
+                                              "def c(x) b(x) - a(x)\n");
+    ASSERT_EQ(reports.size(), 3u);
+    EXPECT_EQ(reports[2].kept, 2u);
+    auto c = reinterpret_cast<UnaryFunction>(session->GetFunctionAddress("c"));
+    ASSERT_TRUE(c);
+    EXPECT_EQ(c(1), 2.);
+
+    // Definitions that only moved count as unchanged
+    reports = run_with_reports(*session, "# reloaded\n"
+                                         "def a(x)  x + 1\n"
+                                         "def b(x) a(x)*3\n"
+                                         "def c(x) b(x) - a(x)\n");
+    ASSERT_EQ(reports.size(), 3u);
+    EXPECT_TRUE(reports[0].unchanged);
+    EXPECT_TRUE(reports[0].recompiled.empty());
+    EXPECT_EQ(reports[0].kept, 3u);
+    EXPECT_FALSE(reports[1].unchanged);
+    EXPECT_EQ(reports[1].recompiled, std::vector<std::string>({"b"}));
+    EXPECT_EQ(reports[1].kept, 2u);
+    EXPECT_GT(reports[1].saved_seconds, 0.);
+    EXPECT_TRUE(reports[2].unchanged);
+
+    EXPECT_EQ(c(1), 4.);
+    EXPECT_EQ(reinterpret_cast<UnaryFunction>(session->GetFunctionAddress("c")), c);
+}
+
+
+// Test to make sure only the callers that inlined a function are compiled
+// again with it
+TEST(JITTest, TieringRedefinitionOnlyRecompilesInliningCallers)
+{
+    auto session = tiered_session("def g(x) x*2\n"
+                                  "def f(x) g(x) + 1\n"
+                                  "def h(x) g(x) + 2\n"
+                                  "def k(x) x*x", 10);
+    ASSERT_TRUE(session);
+    auto f = reinterpret_cast<UnaryFunction>(session->GetFunctionAddress("f"));
+    auto k = reinterpret_cast<UnaryFunction>(session->GetFunctionAddress("k"));
+    ASSERT_TRUE(f && k);
+    for (int i = 0; i < 20; i++)
+    {
+        f(i);
+        k(i);
+    }
+    session->RecompileHotFunctions();
+    ASSERT_TRUE(session->IsOptimized("f"));
+    ASSERT_TRUE(session->IsOptimized("k"));
+
+    auto reports = run_with_reports(*session, "def g(x) x*10");
+    ASSERT_EQ(reports.size(), 1u);
+    EXPECT_EQ(reports[0].recompiled, std::vector<std::string>({"g", "f"}));
+    EXPECT_EQ(reports[0].kept, 2u);
+    EXPECT_FALSE(session->IsOptimized("f"));
+    EXPECT_TRUE(session->IsOptimized("k"));
+    EXPECT_EQ(f(1), 11.);
+}
+
+
+// Test to make sure calls lowered to a math intrinsic follow a definition
+// of the function that takes its place
+TEST(JITTest, DefinitionsRecompileCallersOfMathIntrinsics)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    std::vector<double> results;
+    session->SetResultHandler([&results](double result) { results.push_back(result); });
+    auto reports = run_with_reports(*session, "extern sin(x)\n"
+                                              "def f(x) sin(x) + 1\n"
+                                              "f(3)\n"
+                                              "def sin(x) x*2\n"
+                                              "f(3)");
+
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_DOUBLE_EQ(results[0], sin(3.) + 1);
+    EXPECT_EQ(results[1], 7.);
+    ASSERT_EQ(reports.size(), 2u);
+    EXPECT_EQ(reports[1].recompiled, std::vector<std::string>({"sin", "f"}));
+}
+
+
+
+typedef double (*TernaryFunction)(double, double, double);
+
+
+// Runs a source through Parser and the JIT, as StaticFunction evaluates it:
+// a top-level expression is run, and a definition is called with the
+// arguments.
+static double run_dynamic(const std::string &source, const std::vector<double> &args)
+{
+    if (source.compare(0, 4, "def ") != 0)
+    {
+        auto results = run(source);
+        EXPECT_EQ(results.size(), 1u);
+        return results.empty() ? NAN : results[0];
+    }
+
+    auto session = JITSession::Create();
+    EXPECT_TRUE(session);
+    if (!session)
+        return NAN;
+    std::istringstream stream(source);
+    session->Run(stream);
+    std::string name = source.substr(4, source.find('(') - 4);
+    uint64_t address = session->GetFunctionAddress(name);
+    EXPECT_TRUE(address) << source;
+    if (!address)
+        return NAN;
+
+    switch (args.size())
+    {
+        case 1:
+            return reinterpret_cast<UnaryFunction>(address)(args[0]);
+        case 2:
+            return reinterpret_cast<BinaryFunction>(address)(args[0], args[1]);
+        default:
+            return reinterpret_cast<TernaryFunction>(address)(args[0], args[1], args[2]);
+    }
+}
+
+
+// Results are the same when they have the same bits, which tells zeros of
+// either sign apart, or are both NaN.
+static void expect_same_result(double static_result, double dynamic_result,
+                               const char *source)
+{
+    bool same = (std::isnan(static_result) && std::isnan(dynamic_result))
+        || !memcmp(&static_result, &dynamic_result, sizeof(double));
+    EXPECT_TRUE(same) << source << ": " << static_result << " != " << dynamic_result;
+}
+
+
+#define EXPECT_STATIC_MATCHES_JIT(source, ...)                                  \
+    expect_same_result(KALEIDOSCOPE_STATIC(source)(__VA_ARGS__),                \
+                       run_dynamic(source, {__VA_ARGS__}), source)
+
+
+// Test to make sure static evaluators compute what the JIT computes for
+// the same source
+TEST(JITTest, StaticEvaluatorsMatchJIT)
+{
+    EXPECT_STATIC_MATCHES_JIT("1 + 2*3 - 8/4");
+    EXPECT_STATIC_MATCHES_JIT("8 - 4 - 2 + 64/8/2");
+    EXPECT_STATIC_MATCHES_JIT("1 < 2 + 3 > 0");
+    EXPECT_STATIC_MATCHES_JIT("# comment\n(0.1 + 0.2) * 1.2.3;");
+    EXPECT_STATIC_MATCHES_JIT("123456789.125 / 7 - 18446744073709551615");
+    EXPECT_STATIC_MATCHES_JIT("def f(x y) (x - y) * (x + y) / 3", 7.5, 2.25);
+    EXPECT_STATIC_MATCHES_JIT("def f(x) if x < 0 then 0 - x else x * 2 + 1", -3.);
+    EXPECT_STATIC_MATCHES_JIT("def f(x) if x < 0 then 0 - x else x * 2 + 1", 4.);
+    EXPECT_STATIC_MATCHES_JIT("def f(a b c) if a > b then if b > c then 1 else 2 else 3",
+                              3., 2., 1.);
+    EXPECT_STATIC_MATCHES_JIT("def f(a b c) if a > b then if b > c then 1 else 2 else 3",
+                              3., 2., 5.);
+    EXPECT_STATIC_MATCHES_JIT("def f(x, x) x", 1., 2.);
+    EXPECT_STATIC_MATCHES_JIT("def f(x) 0 - x", 0.);
+}
+
+
+// Test to make sure comparisons and conditions treat NaN and signed zeros
+// as the generated code does
+TEST(JITTest, StaticEvaluatorsMatchJITOnNaN)
+{
+    EXPECT_STATIC_MATCHES_JIT("def f(x y) x < y", NAN, 1.);
+    EXPECT_STATIC_MATCHES_JIT("def f(x y) x > y", 1., NAN);
+    EXPECT_STATIC_MATCHES_JIT("def f(x) if x then 1 else 2", NAN);
+    EXPECT_STATIC_MATCHES_JIT("def f(x) if x then 1 else 2", -0.);
+    EXPECT_STATIC_MATCHES_JIT("def f(x) if x then 1 else 2", 5.);
+    EXPECT_STATIC_MATCHES_JIT("def f(x y) x / y", 1., -0.);
+}
+
+
+// Test to make sure static evaluators run in constant expressions
+TEST(JITTest, StaticEvaluatorsRunAtCompileTime)
+{
+    auto norm = KALEIDOSCOPE_STATIC("def norm(x y) x*x + y*y");
+    static_assert(decltype(norm)::arity == 2, "");
+    static_assert(decltype(norm)::Evaluate(3, 4) == 25, "");
+    EXPECT_EQ(norm(3, 4), 25.);
+
+    auto answer = KALEIDOSCOPE_STATIC("if 1 < 2 then 42 else 0");
+    static_assert(decltype(answer)::Evaluate() == 42, "");
+}
+
+}
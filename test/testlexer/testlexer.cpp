@@ -104,4 +104,66 @@ TEST(GetTokenTest, GetsComment)
 }
 
 
+// Test to make sure numbers too large for a double do not throw
+TEST(GetTokenTest, GetsOutOfRangeNumberAsInfinity)
+{
+    std::istringstream stream(std::string(400, '9'));
+    Token token = GetToken(stream);
+
+    EXPECT_EQ(token.token, tok_number);
+    EXPECT_TRUE(std::isinf(token.number));
+}
+
+
+TEST(GetTokenTest, GetsLocation)
+{
+    std::istringstream stream("def foo\n  (x)");
+
+    Lexer lexer(stream);
+
+    EXPECT_EQ(lexer.GetToken().location, 0u);
+    EXPECT_EQ(lexer.GetToken().location, 4u);
+    EXPECT_EQ(lexer.GetToken().location, 10u);
+    EXPECT_EQ(lexer.GetToken().location, 11u);
+}
+
+
+// Test to make sure locations do not depend on the stream being seekable,
+// and that the end of input is located at the end of the input
+TEST(GetTokenTest, GetsLocationOfEndOfInput)
+{
+    std::istringstream stream("x # comment\n  1");
+    Lexer lexer(stream);
+
+    EXPECT_EQ(lexer.GetToken().location, 0u);
+    EXPECT_EQ(lexer.GetToken().location, 14u);
+    Token eof = lexer.GetToken();
+    EXPECT_EQ(eof.token, tok_eof);
+    EXPECT_EQ(eof.location, 15u);
+}
+
+
+// Test to make sure locations count from the offset the input starts at,
+// and past 4 GiB
+TEST(GetTokenTest, GetsLocationFromOffset)
+{
+    std::istringstream stream(" (x)");
+    Lexer lexer(stream, 5000000000ull);
+
+    EXPECT_EQ(lexer.GetToken().location, 5000000001ull);
+    EXPECT_EQ(lexer.GetToken().location, 5000000002ull);
+}
+
+
+TEST(GetTokenTest, LineTableMapsOffsets)
+{
+    LineTable lines("def foo\n  (x)");
+
+    EXPECT_EQ(lines.GetLine(0), 1u);
+    EXPECT_EQ(lines.GetColumn(4), 5u);
+    EXPECT_EQ(lines.GetLine(10), 2u);
+    EXPECT_EQ(lines.GetColumn(10), 3u);
+}
+
+
 }
@@ -1,10 +1,16 @@
+#include <set>
 #include <sstream>
+#include <string>
+#include <vector>
 #include <cmath>
 #include "gtest/gtest.h"
 
 #include "libkaleidoscope_lexer/lexer.h"
 #include "libkaleidoscope_parser/ast.h"
+#include "libkaleidoscope_parser/call_graph.h"
+#include "libkaleidoscope_parser/incremental.h"
 #include "libkaleidoscope_parser/parser.h"
+#include "libkaleidoscope_parser/static_parser.h"
 
 
 namespace
@@ -29,6 +35,71 @@ class ParserTest : public ::testing::Test
 };
 
 
+// Records the names of the items handed over by the parser driver, with
+// "" for top-level expressions.
+class ItemCollector : public TopLevelHandler
+{
+  public:
+    std::vector<std::string> names;
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        this->names.push_back(function->get_prototype()->get_name());
+    }
+    void HandleExtern(std::unique_ptr<PrototypeAST> prototype) override
+    {
+        this->names.push_back(prototype->get_name());
+    }
+    void HandleTopLevelExpression(std::unique_ptr<FunctionAST> function) override
+    {
+        this->names.push_back("");
+    }
+};
+
+
+// Checks that an edited document has the same tokens, items and
+// diagnostics as one parsed from scratch.
+static void expect_same_document(const SourceDocument &edited, const SourceDocument &fresh)
+{
+    ASSERT_EQ(edited.get_source(), fresh.get_source());
+
+    auto edited_tokens = edited.GetTokens();
+    auto fresh_tokens = fresh.GetTokens();
+    ASSERT_EQ(edited_tokens.size(), fresh_tokens.size());
+    for (size_t i = 0; i < fresh_tokens.size(); i++)
+    {
+        EXPECT_EQ(edited_tokens[i].token, fresh_tokens[i].token);
+        EXPECT_EQ(edited_tokens[i].identifier, fresh_tokens[i].identifier);
+        EXPECT_EQ(edited_tokens[i].location, fresh_tokens[i].location);
+    }
+
+    auto &edited_items = edited.get_items();
+    auto &fresh_items = fresh.get_items();
+    ASSERT_EQ(edited_items.size(), fresh_items.size());
+    for (size_t i = 0; i < fresh_items.size(); i++)
+    {
+        EXPECT_EQ(edited_items[i].tokens.size(), fresh_items[i].tokens.size());
+        EXPECT_EQ(!edited_items[i].function, !fresh_items[i].function);
+        EXPECT_EQ(!edited_items[i].prototype, !fresh_items[i].prototype);
+        if (edited_items[i].function && fresh_items[i].function)
+        {
+            EXPECT_EQ(edited_items[i].function->get_prototype()->get_name(),
+                      fresh_items[i].function->get_prototype()->get_name());
+        }
+    }
+
+    auto edited_diagnostics = edited.GetDiagnostics();
+    auto fresh_diagnostics = fresh.GetDiagnostics();
+    ASSERT_EQ(edited_diagnostics.size(), fresh_diagnostics.size());
+    for (size_t i = 0; i < fresh_diagnostics.size(); i++)
+    {
+        EXPECT_EQ(edited_diagnostics[i].range.begin, fresh_diagnostics[i].range.begin);
+        EXPECT_EQ(edited_diagnostics[i].range.end, fresh_diagnostics[i].range.end);
+        EXPECT_EQ(edited_diagnostics[i].message, fresh_diagnostics[i].message);
+    }
+}
+
+
 // Test to make sure there is no precedence for non-ascii token
 TEST(ParserTest, OperatorPrecedenceTokenTest)
 {
@@ -180,4 +251,407 @@ TEST(ParserTest, ParseLeftPrecedentBinOp)
 }
 
 
+// Test to make sure nodes keep the source offset of their token
+TEST(ParserTest, ParseRecordsLocations)
+{
+    std::istringstream stream("a + foo(b)");
+    Parser parser = Parser(stream);
+
+    auto expr = parser.ParseExpression();
+    auto binary_expr = dynamic_cast<BinaryExprAST*>(expr.get());
+    ASSERT_TRUE(binary_expr);
+
+    EXPECT_EQ(binary_expr->get_location(), 2u);
+    EXPECT_EQ(binary_expr->get_left()->get_location(), 0u);
+    EXPECT_EQ(binary_expr->get_right()->get_location(), 4u);
+}
+
+
+// Test to make sure the arms of a conditional extend as far as they can
+TEST(ParserTest, ParseIfExpression)
+{
+    std::istringstream stream("if a < b then a else b + 1");
+    Parser parser = Parser(stream);
+
+    auto expr = parser.ParseExpression();
+    auto if_expr = dynamic_cast<IfExprAST*>(expr.get());
+    ASSERT_TRUE(if_expr);
+
+    EXPECT_TRUE(dynamic_cast<BinaryExprAST*>(if_expr->get_condition()));
+    EXPECT_TRUE(dynamic_cast<VariableExprAST*>(if_expr->get_then()));
+    EXPECT_TRUE(dynamic_cast<BinaryExprAST*>(if_expr->get_else()));
+}
+
+
+TEST(ParserTest, ParseIfExpressionRequiresElse)
+{
+    std::istringstream stream("if a then b");
+    Parser parser = Parser(stream);
+
+    EXPECT_FALSE(parser.ParseExpression());
+}
+
+
+// Test to make sure hash-consing shares identical subtrees, but not calls
+TEST(ParserTest, HashConsingSharesSubtrees)
+{
+    std::istringstream stream("(a*b + 1) * (a*b + 1) + foo(a) + foo(a)");
+    Parser parser = Parser(stream);
+    parser.EnableHashConsing();
+
+    auto expr = parser.ParseExpression();
+    auto sum = dynamic_cast<BinaryExprAST*>(expr.get());
+    ASSERT_TRUE(sum);
+    auto left_sum = dynamic_cast<BinaryExprAST*>(sum->get_left());
+    ASSERT_TRUE(left_sum);
+    auto product = dynamic_cast<BinaryExprAST*>(left_sum->get_left());
+    ASSERT_TRUE(product);
+
+    EXPECT_EQ(product->get_left(), product->get_right());
+    EXPECT_TRUE(product->get_left()->is_shared());
+    EXPECT_NE(left_sum->get_right(), sum->get_right());
+    EXPECT_FALSE(sum->get_right()->is_shared());
+}
+
+
+TEST(ParserTest, WithoutHashConsingSubtreesAreDistinct)
+{
+    std::istringstream stream("(a*b) * (a*b)");
+    Parser parser = Parser(stream);
+
+    auto expr = parser.ParseExpression();
+    auto product = dynamic_cast<BinaryExprAST*>(expr.get());
+    ASSERT_TRUE(product);
+    EXPECT_NE(product->get_left(), product->get_right());
+}
+
+
+// Test to make sure every bad item is reported once and the rest still parse
+TEST(ParserTest, DriverRecoversFromErrors)
+{
+    std::istringstream stream("def f(x) x +\n"
+                              "def g(x y) x*y\n"
+                              "1 + ) 2; 3\n"
+                              "extern h(1)\n"
+                              "def k(x) if x then 1 2; 4");
+    Parser parser = Parser(stream);
+    ItemCollector collector;
+    parser.Driver(collector);
+
+    std::vector<std::string> expected = {"g", "", ""};
+    EXPECT_EQ(collector.names, expected);
+
+    auto &diagnostics = parser.get_diagnostics().get_diagnostics();
+    ASSERT_EQ(diagnostics.size(), 4u);
+    // The `def` that ended the first definition early
+    EXPECT_EQ(diagnostics[0].range.begin, 13u);
+    EXPECT_EQ(diagnostics[0].range.end, 16u);
+    // The stray paren
+    EXPECT_EQ(diagnostics[1].range.begin, 32u);
+    EXPECT_EQ(diagnostics[1].range.end, 33u);
+    // The number in the extern arguments
+    EXPECT_EQ(diagnostics[2].range.begin, 48u);
+    // The missing else
+    EXPECT_EQ(diagnostics[3].range.begin, 72u);
+}
+
+
+// Test to make sure an item whose first operand fails to parse is dropped,
+// rather than handed over with a missing operand
+TEST(ParserTest, DriverDropsItemsWithBadLeftOperand)
+{
+    const char *sources[] = {"def f(x) ) + 1;", ") * 2;"};
+    for (const char *source : sources)
+    {
+        std::istringstream stream(source);
+        Parser parser = Parser(stream);
+        ItemCollector collector;
+        parser.Driver(collector);
+
+        EXPECT_TRUE(collector.names.empty()) << source;
+        EXPECT_EQ(parser.get_diagnostics().size(), 1u) << source;
+    }
+}
+
+
+TEST(ParserTest, DriverWithoutErrorsHasNoDiagnostics)
+{
+    std::istringstream stream("def f(x) x*2; f(1)");
+    Parser parser = Parser(stream);
+    ItemCollector collector;
+    parser.Driver(collector);
+
+    EXPECT_EQ(collector.names.size(), 2u);
+    EXPECT_TRUE(parser.get_diagnostics().empty());
+}
+
+
+// Test to make sure nesting is bounded before it overflows the stack
+TEST(ParserTest, DriverRejectsDeeplyNestedExpressions)
+{
+    std::string nested = std::string(100, '(') + "1" + std::string(100, ')');
+    std::string too_deep = std::string(100000, '(') + "1" + std::string(100000, ')');
+    std::istringstream stream(nested + ";\n" + too_deep + ";\n" + nested);
+    Parser parser = Parser(stream);
+    ItemCollector collector;
+    parser.Driver(collector);
+
+    EXPECT_EQ(collector.names.size(), 2u);
+    ASSERT_EQ(parser.get_diagnostics().size(), 1u);
+    EXPECT_EQ(parser.get_diagnostics().get_diagnostics()[0].message,
+              "expression is nested too deeply!");
+}
+
+
+// Test to make sure a long chain of operators, whose AST is as deep as the
+// chain is long, is destroyed without overflowing the stack
+TEST(ParserTest, DestroysLongOperatorChains)
+{
+    std::string chain;
+    for (int i = 0; i < 100000; i++)
+        chain += "1+";
+    std::istringstream stream(chain + "1");
+    Parser parser = Parser(stream);
+    ItemCollector collector;
+    parser.Driver(collector);
+
+    EXPECT_EQ(collector.names.size(), 1u);
+    EXPECT_TRUE(parser.get_diagnostics().empty());
+}
+
+
+// Parses the source with the static parser, at run time.
+static StaticTree<1024> parse_static(const char *source)
+{
+    return StaticParser<1024>(source).Parse();
+}
+
+
+// Test to make sure the static parser follows the precedence of Parser
+TEST(ParserTest, StaticParserBuildsPrecedenceTree)
+{
+    constexpr StaticTree<16> tree = StaticParser<16>("def f(x y) x + y*2 < 3").Parse();
+    static_assert(tree.error == static_parse_ok, "");
+    static_assert(tree.arity == 2, "");
+
+    // (x + (y*2)) < 3
+    const StaticNode &less = tree.nodes[tree.root];
+    ASSERT_EQ(less.kind, static_binary_node);
+    EXPECT_EQ(less.op, '<');
+    const StaticNode &plus = tree.nodes[less.children[0]];
+    ASSERT_EQ(plus.kind, static_binary_node);
+    EXPECT_EQ(plus.op, '+');
+    EXPECT_EQ(tree.nodes[plus.children[0]].argument, 0u);
+    const StaticNode &times = tree.nodes[plus.children[1]];
+    ASSERT_EQ(times.kind, static_binary_node);
+    EXPECT_EQ(times.op, '*');
+    EXPECT_EQ(tree.nodes[times.children[0]].argument, 1u);
+    EXPECT_EQ(tree.nodes[times.children[1]].number, 2.);
+    EXPECT_EQ(tree.nodes[less.children[1]].number, 3.);
+}
+
+
+// Test to make sure the static parser rejects what Parser rejects, at the
+// same token
+TEST(ParserTest, StaticParserReportsParserErrors)
+{
+    std::string too_deep = std::string(300, '(') + "1" + std::string(300, ')');
+    const char *sources[] = {"1 + )", "(1 + 2;", "if 1 2", "if 1 then 2 3", "def (x) x",
+                             "def f x", "def f(x 1) x", "def f(x,,y) x", "def f(x) x * ; 2",
+                             too_deep.c_str()};
+    for (const char *source : sources)
+    {
+        std::istringstream stream(source);
+        Parser parser = Parser(stream);
+        parser.Driver();
+        ASSERT_FALSE(parser.get_diagnostics().empty()) << source;
+
+        StaticTree<1024> tree = parse_static(source);
+        EXPECT_NE(tree.error, static_parse_ok) << source;
+        EXPECT_EQ(tree.error_location, parser.get_diagnostics().get_diagnostics()[0].range.begin)
+            << source;
+    }
+    EXPECT_EQ(parse_static(too_deep.c_str()).error, static_error_too_deep);
+}
+
+
+// Test to make sure the static parser rejects what it cannot evaluate
+TEST(ParserTest, StaticParserRejectsUnsupportedSources)
+{
+    EXPECT_EQ(parse_static("def f(x) g(x)").error, static_error_call);
+    EXPECT_EQ(parse_static("extern sin(x)").error, static_error_extern);
+    EXPECT_EQ(parse_static("def f(x) y").error, static_error_variable);
+    EXPECT_EQ(parse_static("1; 2").error, static_error_trailing);
+    EXPECT_EQ(parse_static("0.12345678901234567").error, static_error_number);
+    EXPECT_EQ(parse_static("99999999999999999999").error, static_error_number);
+
+    StaticTree<1024> tree = parse_static("def f(x) x + y");
+    EXPECT_EQ(tree.error_location, 13u);
+    EXPECT_EQ(parse_static("# comment\n1.5.7;").error, static_parse_ok);
+}
+
+
+// Test to make sure an edit only parses the item it touches again
+TEST(ParserTest, IncrementalEditReusesUntouchedItems)
+{
+    std::string source;
+    for (int i = 0; i < 100; i++)
+        source += "def f" + std::to_string(i) + "(x) x*" + std::to_string(i) + "\n";
+    SourceDocument document(source);
+    ASSERT_EQ(document.get_items().size(), 100u);
+
+    std::vector<const FunctionAST *> before;
+    for (auto &item : document.get_items())
+        before.push_back(item.function.get());
+
+    // Turn the body of f50 into x*50 + 1
+    size_t offset = source.find("def f51");
+    EditStats stats;
+    ASSERT_TRUE(document.Edit(offset - 1, offset - 1, " + 1", &stats));
+    // The 50 before the edit could have grown, so it is lexed again
+    EXPECT_EQ(stats.lexed_tokens, 3u);
+    EXPECT_LE(stats.parsed_items, 2u);
+    EXPECT_EQ(stats.parsed_items + stats.reused_items, 100u);
+
+    auto &items = document.get_items();
+    ASSERT_EQ(items.size(), 100u);
+    EXPECT_NE(items[50].function.get(), before[50]);
+    EXPECT_EQ(items[10].function.get(), before[10]);
+    EXPECT_EQ(items[51].function.get(), before[51]);
+    EXPECT_EQ(items[51].displacement, 4);
+    EXPECT_EQ(items[99].function.get(), before[99]);
+
+    expect_same_document(document, SourceDocument(document.get_source()));
+}
+
+
+// Test to make sure edits that move item boundaries, comment code out and
+// introduce errors leave the same document as parsing from scratch
+TEST(ParserTest, IncrementalEditsMatchFullParse)
+{
+    SourceDocument document("def f(x) x*2\n"
+                            "f(1)\n"
+                            "2\n"
+                            "extern sin(x)\n"
+                            "def g(a b) a + b # sum\n"
+                            "g(1, 2); 3\n");
+
+    struct {
+        const char *find;
+        size_t length;
+        const char *text;
+    } edits[] = {
+        {"2\nextern", 0, "+ "},            // joins two expressions
+        {"+ 2", 2, ""},                      // splits them again
+        {"# sum", 1, ""},                    // uncomments the trailing text
+        {"sum\n", 0, "# "},                 // comments it out again
+        {"f(1)", 2, "foo("},                 // grows an identifier
+        {"extern", 6, "def"},                // turns an extern into a definition
+        {"g(1, 2)", 2, "g(1, ,"},            // introduces an error
+        {", ,", 2, ""},                      // and fixes it
+        {"def f", 0, "# "},                  // comments out the first line
+        {"\n", 1, ""},                      // and the second with it
+        {"g(a b)", 6, "g(a b) 1 +"},         // rewrites across a boundary
+    };
+
+    for (auto &edit : edits)
+    {
+        size_t offset = document.get_source().find(edit.find);
+        ASSERT_NE(offset, std::string::npos) << edit.find;
+        ASSERT_TRUE(document.Edit(offset, offset + edit.length, edit.text));
+        SCOPED_TRACE(document.get_source());
+        expect_same_document(document, SourceDocument(document.get_source()));
+    }
+
+    // Rewriting everything works too
+    ASSERT_TRUE(document.Edit(0, document.get_source().size(), "1; 2"));
+    expect_same_document(document, SourceDocument("1; 2"));
+    EXPECT_FALSE(document.Edit(3, 10, ""));
+}
+
+
+// Keeps the last definition handed over by the parser driver.
+class DefinitionHandler : public TopLevelHandler
+{
+  public:
+    std::unique_ptr<FunctionAST> function;
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        this->function = std::move(function);
+    }
+};
+
+
+static std::unique_ptr<FunctionAST> parse_definition(const std::string &source)
+{
+    std::istringstream stream(source);
+    DefinitionHandler handler;
+    Parser(stream).Driver(handler);
+    return std::move(handler.function);
+}
+
+
+// Test to make sure fingerprints only depend on the structure of a function
+TEST(ParserTest, FingerprintsIgnoreLocations)
+{
+    auto function = parse_definition("def f(x) x*2 + g(x, 1)");
+    auto moved = parse_definition("\n  def f(x)\n    x * 2+g( x,1 )");
+    auto changed = parse_definition("def f(x) x*3 + g(x, 1)");
+    auto renamed = parse_definition("def f(y) y*2 + g(y, 1)");
+    ASSERT_TRUE(function && moved && changed && renamed);
+
+    EXPECT_EQ(function->get_fingerprint(), moved->get_fingerprint());
+    EXPECT_NE(function->get_fingerprint(), changed->get_fingerprint());
+    EXPECT_NE(function->get_fingerprint(), renamed->get_fingerprint());
+    EXPECT_EQ(function->get_callees(), std::set<std::string>({"g"}));
+}
+
+
+// Test to make sure definitions with equal fingerprints can be told apart
+// by their structure, which does not depend on locations either
+TEST(ParserTest, ComparesDefinitionStructure)
+{
+    auto function = parse_definition("def f(x) if x < 1 then 0.5 else x*2 + g(x, 1)");
+    auto moved = parse_definition("\n  def f(x)\n    if x<1 then 0.5 else x * 2+g( x,1 )");
+    ASSERT_TRUE(function && moved);
+    EXPECT_EQ(function->get_structure(), moved->get_structure());
+
+    const char *changes[] = {
+        "def f(x) if x < 1 then 0.25 else x*2 + g(x, 1)",
+        "def f(x) if x > 1 then 0.5 else x*2 + g(x, 1)",
+        "def f(x) if x < 1 then 0.5 else x*2 + g(x)",
+        "def f(x) if x < 1 then 0.5 else x*2 + h(x, 1)",
+        "def f(x) if x < 1 then 0.5 else 2*x + g(x, 1)",
+        "def f(y) if y < 1 then 0.5 else y*2 + g(y, 1)",
+        "def f(x y) if x < 1 then 0.5 else x*2 + g(x, 1)",
+        "def k(x) if x < 1 then 0.5 else x*2 + g(x, 1)",
+    };
+    for (const char *change : changes)
+    {
+        auto changed = parse_definition(change);
+        ASSERT_TRUE(changed) << change;
+        EXPECT_NE(function->get_structure(), changed->get_structure()) << change;
+    }
+}
+
+
+TEST(ParserTest, CallGraphTracksCallers)
+{
+    CallGraph graph;
+    graph.SetCallees("f", {"g", "h"});
+    graph.SetCallees("k", {"g"});
+    EXPECT_EQ(graph.get_callers("g"), std::set<std::string>({"f", "k"}));
+    EXPECT_EQ(graph.get_callers("h"), std::set<std::string>({"f"}));
+
+    // A new body replaces the calls of the old one
+    graph.SetCallees("f", {"h", "k"});
+    EXPECT_EQ(graph.get_callers("g"), std::set<std::string>({"k"}));
+    EXPECT_EQ(graph.get_callers("k"), std::set<std::string>({"f"}));
+    EXPECT_EQ(graph.get_callees("f"), std::set<std::string>({"h", "k"}));
+    EXPECT_TRUE(graph.get_callers("f").empty());
+    EXPECT_EQ(graph.size(), 2u);
+}
+
+
 }
@@ -0,0 +1,227 @@
+#include <time.h>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "libkaleidoscope_jit/session.h"
+#include "libkaleidoscope_parser/parser.h"
+#include "libkaleidoscope_pipeline/pipeline.h"
+#include "libkaleidoscope_pipeline/ring_buffer.h"
+
+
+namespace
+{
+
+
+// Records the kind and name of each item handed over by the parser.
+class ItemRecorder : public TopLevelHandler
+{
+  public:
+    std::vector<std::string> items;
+
+    void HandleDefinition(std::unique_ptr<FunctionAST> function) override
+    {
+        this->items.push_back("def " + function->get_prototype()->get_name());
+    }
+
+    void HandleExtern(std::unique_ptr<PrototypeAST> prototype) override
+    {
+        this->items.push_back("extern " + prototype->get_name());
+    }
+
+    void HandleTopLevelExpression(std::unique_ptr<FunctionAST> function) override
+    {
+        this->items.push_back("expression");
+    }
+};
+
+
+// The fixture for testing the threaded pipeline.
+class PipelineTest : public ::testing::Test
+{
+  protected:
+	// set up
+    PipelineTest() {}
+  
+	// clean up
+    virtual ~PipelineTest() {}
+  
+	// additional setup code
+    virtual void SetUp() {}
+  
+	// additional cleanup code
+    virtual void TearDown() {}
+};
+
+
+TEST(PipelineTest, RingBufferIsFIFO)
+{
+    RingBuffer<int> buffer(3);
+    EXPECT_EQ(buffer.capacity(), 4u);
+
+    for (int i = 0; i < 4; i++)
+        EXPECT_TRUE(buffer.try_push(i));
+
+    // Full, so the producer has to wait
+    int value = 4;
+    EXPECT_FALSE(buffer.try_push(value));
+
+    for (int i = 0; i < 4; i++)
+    {
+        ASSERT_TRUE(buffer.try_pop(value));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_FALSE(buffer.try_pop(value));
+}
+
+
+TEST(PipelineTest, RingBufferAcrossThreads)
+{
+    const int count = 100000;
+    RingBuffer<int> buffer(16);
+
+    std::thread producer([&]() {
+        for (int i = 0; i < count; i++)
+        {
+            int value = i;
+            while (!buffer.try_push(value))
+                std::this_thread::yield();
+        }
+    });
+
+    // Every value arrives, in order
+    long long sum = 0;
+    int expected = 0;
+    bool in_order = true;
+    for (int i = 0; i < count; i++)
+    {
+        int value;
+        while (!buffer.try_pop(value))
+            std::this_thread::yield();
+        in_order = in_order && value == expected++;
+        sum += value;
+    }
+    producer.join();
+
+    EXPECT_TRUE(in_order);
+    EXPECT_EQ(sum, static_cast<long long>(count) * (count - 1) / 2);
+}
+
+
+// Test to make sure a side waiting on the other sleeps instead of spinning
+TEST(PipelineTest, RingBufferSleepsWhileWaiting)
+{
+    const int count = 20;
+    RingBuffer<int> buffer(4);
+
+    std::thread producer([&]() {
+        for (int i = 0; i < count; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            int value = i;
+            buffer.push(value);
+        }
+    });
+
+    timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    bool in_order = true;
+    for (int i = 0; i < count; i++)
+    {
+        int value;
+        buffer.pop(value);
+        in_order = in_order && value == i;
+    }
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    producer.join();
+
+    // Waiting took about 200ms, spinning would have used most of it
+    double cpu_seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    EXPECT_TRUE(in_order);
+    EXPECT_LT(cpu_seconds, 0.05);
+}
+
+
+TEST(PipelineTest, MatchesSequentialDriver)
+{
+    std::string source("extern sin(x)\n"
+                       "def foo(a b) a*b + sin(a)\n"
+                       "foo(1, 2); 3 + 4\n"
+                       "def bar(x) foo(x, x)\n");
+
+    std::istringstream sequential_stream(source);
+    ItemRecorder sequential;
+    Parser(sequential_stream).Driver(sequential);
+
+    // Tiny queues, to exercise the backpressure
+    PipelineOptions options;
+    options.token_queue_capacity = 2;
+    options.item_queue_capacity = 1;
+    std::istringstream pipelined_stream(source);
+    ItemRecorder pipelined;
+    Pipeline pipeline(pipelined, options);
+    pipeline.Run(pipelined_stream);
+
+    EXPECT_EQ(pipelined.items, sequential.items);
+    EXPECT_EQ(pipelined.items.size(), 5u);
+}
+
+
+TEST(PipelineTest, HandlesTruncatedInput)
+{
+    std::istringstream stream("def foo(a) a+1\ndef bar(");
+    ItemRecorder recorder;
+    Pipeline pipeline(recorder);
+    pipeline.Run(stream);
+
+    ASSERT_EQ(recorder.items.size(), 1u);
+    EXPECT_EQ(recorder.items[0], "def foo");
+}
+
+
+TEST(PipelineTest, RunsJITBackend)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    std::vector<double> results;
+    session->SetResultHandler([&results](double result) { results.push_back(result); });
+
+    std::istringstream stream("def square(x) x*x\nsquare(3) + 1; square(4)");
+    Pipeline pipeline(*session);
+    pipeline.Run(stream);
+
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0], 10.);
+    EXPECT_EQ(results[1], 16.);
+}
+
+
+TEST(PipelineTest, ReportsStageMetrics)
+{
+    std::string source;
+    for (int i = 0; i < 200; i++)
+        source += "def f" + std::to_string(i) + "(a b) a*b + a/b - " + std::to_string(i) + "\n";
+
+    std::istringstream stream(source);
+    ItemRecorder recorder;
+    Pipeline pipeline(recorder);
+    pipeline.Run(stream);
+
+    const PipelineMetrics &metrics = pipeline.get_metrics();
+    EXPECT_GT(metrics.wall_seconds, 0.);
+    EXPECT_EQ(metrics.lexer.items, metrics.tokens.pushes);
+    EXPECT_EQ(metrics.parser.items, 200u);
+    EXPECT_EQ(metrics.backend.items, 200u);
+
+    // The end of input marker goes through the item queue too
+    EXPECT_EQ(metrics.items.pushes, 201u);
+    EXPECT_GT(metrics.tokens.average_occupancy, 0.);
+    EXPECT_LE(metrics.tokens.average_occupancy, metrics.tokens.capacity);
+    EXPECT_LE(metrics.lexer.get_occupancy(metrics.wall_seconds), 1.);
+}
+
+
+}
@@ -0,0 +1,278 @@
+#include <unistd.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gtest/gtest.h"
+
+#include "libkaleidoscope_jit/session.h"
+#include "libkaleidoscope_server/client.h"
+#include "libkaleidoscope_server/server.h"
+
+
+namespace
+{
+
+
+// The fixture for testing the compile server.
+class ServerTest : public ::testing::Test
+{
+  protected:
+	// set up
+    ServerTest() {}
+  
+	// clean up
+    virtual ~ServerTest() {}
+  
+	// additional setup code
+    virtual void SetUp() {}
+  
+	// additional cleanup code
+    virtual void TearDown() {}
+};
+
+
+static std::string socket_path()
+{
+    return "/tmp/kaleidoscope-test-" + std::to_string(getpid()) + ".sock";
+}
+
+
+TEST(ServerTest, HandlesRequest)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    CompileServer server(*session, socket_path(), 1);
+
+    EXPECT_EQ(server.HandleRequest("def double(x) x*2"), "ok");
+    EXPECT_EQ(server.HandleRequest("double(4); double(0.5)"), "ok 8 1");
+}
+
+
+// Test to make sure requests with errors are answered with their errors,
+// located within the request, instead of their values
+TEST(ServerTest, RepliesWithErrors)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    CompileServer server(*session, socket_path(), 1);
+
+    EXPECT_EQ(server.HandleRequest("1 + )"),
+              "error 1:5: unknown token when expecting a primary expression!");
+    EXPECT_EQ(server.HandleRequest("2;\nmissing(1)"), "error 2:1: Unknown function referenced");
+    EXPECT_EQ(server.HandleRequest("def f(x) y"), "error 1:10: Unknown variable name");
+    EXPECT_EQ(server.HandleRequest("def f(x) x; def f(x, y) x"),
+              "error 1:17: cannot redefine f with a different number of arguments");
+    EXPECT_EQ(server.HandleRequest("extern f(x, y)"),
+              "error 1:8: cannot redefine f with a different number of arguments");
+
+    // The errors of one request do not leak into the next
+    EXPECT_EQ(server.HandleRequest("f(3)"), "ok 3");
+}
+
+
+// Test to make sure a call to a function that cannot be compiled on its
+// first call is answered with an error instead of bringing down the server
+TEST(ServerTest, RepliesWithLazyCompileErrors)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    CompileServer server(*session, socket_path(), 1);
+
+    EXPECT_EQ(server.HandleRequest("extern nosuch(x); def bar(x) nosuch(x)"), "ok");
+    EXPECT_EQ(server.HandleRequest("bar(1)").compare(0, 30, "error 1:1: cannot compile bar:"), 0);
+    // Later calls fail without compiling again
+    EXPECT_EQ(server.HandleRequest("1;\nbar(2)").compare(0, 10, "error 2:1:"), 0);
+
+    EXPECT_EQ(server.HandleRequest("def bar(x) x + 1"), "ok");
+    EXPECT_EQ(server.HandleRequest("bar(1)"), "ok 2");
+}
+
+
+// Test to make sure requests can run against the session from several
+// threads at once, each getting its own values
+TEST(ServerTest, HandlesRequestsConcurrently)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    CompileServer server(*session, socket_path(), 1);
+    ASSERT_EQ(server.HandleRequest("def triple(x) x*3"), "ok");
+
+    const int threads = 4;
+    const int requests = 20;
+    std::vector<int> correct(threads, 0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++)
+    {
+        workers.emplace_back([i, &correct, &server]() {
+            for (int j = 0; j < requests; j++)
+            {
+                std::string expected = "ok " + std::to_string(3 * i) + " " + std::to_string(j);
+                std::string request = "triple(" + std::to_string(i) + "); " + std::to_string(j);
+                if (server.HandleRequest(request) == expected)
+                    correct[i]++;
+            }
+        });
+    }
+    for (auto &worker : workers)
+        worker.join();
+
+    for (int i = 0; i < threads; i++)
+        EXPECT_EQ(correct[i], requests);
+}
+
+
+TEST(ServerTest, ServesPreloadedDefinitions)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    std::istringstream prelude("def square(x) x*x");
+    session->Run(prelude);
+
+    CompileServer server(*session, socket_path(), 2);
+    ASSERT_TRUE(server.Start());
+
+    CompileClient client;
+    ASSERT_TRUE(client.Connect(socket_path()));
+    std::string response;
+    ASSERT_TRUE(client.Request("square(3)", response));
+    EXPECT_EQ(response, "ok 9");
+
+    // Definitions from one request are visible to later ones
+    ASSERT_TRUE(client.Request("def cube(x)\nx*square(x)", response));
+    EXPECT_EQ(response, "ok");
+    ASSERT_TRUE(client.Request("cube(2)", response));
+    EXPECT_EQ(response, "ok 8");
+
+    server.Stop();
+}
+
+
+TEST(ServerTest, ServesConcurrentClients)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    CompileServer server(*session, socket_path(), 4);
+    ASSERT_TRUE(server.Start());
+
+    const int clients = 8;
+    const int requests = 20;
+    std::vector<int> correct(clients, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++)
+    {
+        threads.emplace_back([i, &correct]() {
+            CompileClient client;
+            if (!client.Connect(socket_path()))
+                return;
+            std::string response;
+            for (int j = 0; j < requests; j++)
+            {
+                std::string expected = "ok " + std::to_string(i * j);
+                if (client.Request(std::to_string(i) + "*" + std::to_string(j), response)
+                    && response == expected)
+                    correct[i]++;
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    server.Stop();
+
+    for (int i = 0; i < clients; i++)
+        EXPECT_EQ(correct[i], requests);
+}
+
+
+// Test to make sure clients that keep their connections open do not hold on
+// to the workers, so more clients than workers are all served
+TEST(ServerTest, ServesMoreClientsThanWorkers)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    CompileServer server(*session, socket_path(), 1);
+    ASSERT_TRUE(server.Start());
+
+    const int clients = 3;
+    std::vector<std::unique_ptr<CompileClient>> connected;
+    for (int i = 0; i < clients; i++)
+    {
+        connected.push_back(std::make_unique<CompileClient>());
+        ASSERT_TRUE(connected.back()->Connect(socket_path()));
+    }
+
+    std::string response;
+    for (int j = 0; j < 3; j++)
+    {
+        for (int i = 0; i < clients; i++)
+        {
+            ASSERT_TRUE(connected[i]->Request(std::to_string(i + j), response));
+            EXPECT_EQ(response, "ok " + std::to_string(i + j));
+        }
+    }
+    server.Stop();
+}
+
+
+// Test to make sure a request line over the limit is refused without
+// getting in the way of other clients
+TEST(ServerTest, RefusesOversizedRequests)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    CompileServer server(*session, socket_path(), 1);
+    ASSERT_TRUE(server.Start());
+
+    // The server may close the connection before the whole line is sent
+    CompileClient flooding;
+    ASSERT_TRUE(flooding.Connect(socket_path()));
+    std::string response;
+    if (flooding.Request(std::string(2 * CompileServer::max_request_bytes, '1'), response))
+    {
+        EXPECT_EQ(response, "error request too long");
+    }
+    EXPECT_FALSE(flooding.Request("1", response));
+
+    CompileClient client;
+    ASSERT_TRUE(client.Connect(socket_path()));
+    ASSERT_TRUE(client.Request("2", response));
+    EXPECT_EQ(response, "ok 2");
+    server.Stop();
+}
+
+
+TEST(ServerTest, StopClosesConnections)
+{
+    auto session = JITSession::Create();
+    ASSERT_TRUE(session);
+    CompileServer server(*session, socket_path(), 1);
+    ASSERT_TRUE(server.Start());
+
+    CompileClient client;
+    ASSERT_TRUE(client.Connect(socket_path()));
+    server.Stop();
+
+    std::string response;
+    EXPECT_FALSE(client.Request("1", response));
+    EXPECT_FALSE(CompileClient().Connect(socket_path()));
+}
+
+
+TEST(ServerTest, ComputesLatencyPercentiles)
+{
+    std::vector<double> samples;
+    for (int i = 100; i >= 1; i--)
+        samples.push_back(i);
+
+    LatencyStats stats = ComputeLatencyStats(samples);
+    EXPECT_EQ(stats.count, 100u);
+    EXPECT_EQ(stats.mean, 50.5);
+    EXPECT_EQ(stats.p50, 50.);
+    EXPECT_EQ(stats.p90, 90.);
+    EXPECT_EQ(stats.p99, 99.);
+    EXPECT_EQ(stats.max, 100.);
+}
+
+
+}